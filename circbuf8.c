@@ -1,4 +1,26 @@
 /**
+
+By default all routines mask interrupts while they touch the buffer state, so any number of
+producers and consumers (threads or ISRs) may share a circbuf.
+
+Define CBUF8_SPSC to build the lock-free single-producer/single-consumer variant instead. The
+producer only ever writes tail and the consumer only ever writes head, so no interrupt masking
+is needed. This is a drop-in replacement for queues with exactly one writer and one reader
+(i.e. serialq and the USB CDC queues, where an ISR is on one side and the main loop on the other).
+One byte of the buffer is kept free to tell a full buffer from an empty one and the len member
+is not maintained, use cbuf8_len instead.
+
+Define CBUF8_STATS (for all compilation units, since it changes struct cbuf8_t) to keep per buffer
+statistics: the highest fill level reached and the number of rejected puts and empty gets. They are
+read with cbuf8_stats and are useful for sizing buffers from field data. Without CBUF8_STATS there
+is no cost at all.
+
+A circbuf cleared with mode CBUF8_OVERWRITE never rejects data. When full, the oldest bytes are
+dropped to make room and counted in the drop member. This is meant for logging and telemetry, where
+losing old data is preferred over blocking the producer. Overwriting means the producer moves head,
+which is not possible in the lock-free CBUF8_SPSC variant, so there the new bytes are dropped (and
+counted) instead.
+
 @file		circbuf8.c
 @brief		Circular byte buffer routines. Interrupt safe.
 @author		Matej Kogovsek
@@ -8,14 +30,18 @@
 
 #include "stm32f10x.h"
 #include "circbuf8.h"
+#include <string.h>
 
 /**
 @brief Initializes (clears) circbuf.
+
+Use the cbuf8_clear macro for the default CBUF8_BLOCK mode.
 @param[in]	cb		Pointer to cbuf_t struct where circbuf state will be kept
 @param[in]	p		Pointer to byte array for data
 @param[in]	s		sizeof(p)
+@param[in]	m		Mode, CBUF8_BLOCK or CBUF8_OVERWRITE
 */
-void cbuf8_clear(volatile struct cbuf8_t* cb, uint8_t* const p, const uint16_t s)
+void cbuf8_clear_m(volatile struct cbuf8_t* cb, uint8_t* const p, const uint16_t s, const uint8_t m)
 {
 	uint32_t g = __get_PRIMASK();
 	__disable_irq();
@@ -25,6 +51,13 @@ void cbuf8_clear(volatile struct cbuf8_t* cb, uint8_t* const p, const uint16_t s
 	cb->head = 0;
 	cb->tail = 0;
 	cb->len = 0;
+	cb->mode = m;
+	cb->drop = 0;
+#ifdef CBUF8_STATS
+	cb->st.maxlen = 0;
+	cb->st.ovf = 0;
+	cb->st.unf = 0;
+#endif
 
 	__set_PRIMASK(g);
 }
@@ -33,25 +66,65 @@ void cbuf8_clear(volatile struct cbuf8_t* cb, uint8_t* const p, const uint16_t s
 @brief Insert an element.
 @param[in]	cb		Pointer to cbuf_t
 @param[in]	d		Data to insert
-@return True on success, false otherwise (buffer full).
+@return True on success, false otherwise (buffer full). Always true in CBUF8_OVERWRITE mode.
 */
 uint8_t cbuf8_put(volatile struct cbuf8_t* cb, const uint8_t d)
 {
+#ifdef CBUF8_SPSC
+	uint16_t t = cb->tail;
+	uint16_t n = t + 1;
+	if( n == cb->size ) { n = 0; }
+
+	if( n == cb->head ) {
+		if( cb->mode == CBUF8_OVERWRITE ) {
+			cb->drop++;
+			return 1;
+		}
+#ifdef CBUF8_STATS
+		cb->st.ovf++;
+#endif
+		return 0;
+	}
+
+	cb->buf[t] = d;
+	__DMB();	// data must be in place before the consumer sees the new tail
+	cb->tail = n;
+
+#ifdef CBUF8_STATS
+	uint16_t l = cbuf8_len(cb);
+	if( l > cb->st.maxlen ) { cb->st.maxlen = l; }
+#endif
+	return 1;
+#else
 	uint32_t g = __get_PRIMASK();
 	__disable_irq();
 
 	if (cb->len == cb->size) {
-		__set_PRIMASK(g);
-		return 0;
+		if( cb->mode == CBUF8_OVERWRITE ) {
+			cb->head++;
+			if(cb->head == cb->size) { cb->head = 0; }
+			cb->len--;
+			cb->drop++;
+		} else {
+#ifdef CBUF8_STATS
+			cb->st.ovf++;
+#endif
+			__set_PRIMASK(g);
+			return 0;
+		}
 	}
 
 	cb->buf[cb->tail] = d;
 	cb->tail++;
 	if(cb->tail == cb->size) { cb->tail = 0; }
 	cb->len++;
+#ifdef CBUF8_STATS
+	if( cb->len > cb->st.maxlen ) { cb->st.maxlen = cb->len; }
+#endif
 
 	__set_PRIMASK(g);
 	return 1;
+#endif
 }
 
 /**
@@ -62,10 +135,33 @@ uint8_t cbuf8_put(volatile struct cbuf8_t* cb, const uint8_t d)
 */
 uint8_t cbuf8_get(volatile struct cbuf8_t* cb, uint8_t* const d)
 {
+#ifdef CBUF8_SPSC
+	uint16_t h = cb->head;
+
+	if( h == cb->tail ) {
+#ifdef CBUF8_STATS
+		cb->st.unf++;
+#endif
+		return 0;
+	}
+
+	if( d ) {	// if d is null, cbuf_get can be used to check for data in buffer
+		*d = cb->buf[h];
+		__DMB();	// data must be read before the producer sees the slot as free
+		h++;
+		if( h == cb->size ) { h = 0; }
+		cb->head = h;
+	}
+
+	return 1;
+#else
 	uint32_t g = __get_PRIMASK();
 	__disable_irq();
 
 	if (cb->len == 0) {
+#ifdef CBUF8_STATS
+		cb->st.unf++;
+#endif
 		__set_PRIMASK(g);
 		return 0;
 	}
@@ -79,4 +175,368 @@ uint8_t cbuf8_get(volatile struct cbuf8_t* cb, uint8_t* const d)
 
 	__set_PRIMASK(g);
 	return 1;
+#endif
+}
+
+/**
+@brief Number of bytes currently in circbuf.
+@param[in]	cb		Pointer to cbuf_t
+@return Number of bytes in circbuf.
+*/
+uint16_t cbuf8_len(volatile struct cbuf8_t* cb)
+{
+#ifdef CBUF8_SPSC
+	uint16_t h = cb->head;
+	uint16_t t = cb->tail;
+	return (t >= h) ? (t - h) : (t + cb->size - h);
+#else
+	return cb->len;
+#endif
+}
+
+/**
+@brief Number of bytes that can be inserted without blocking.
+@param[in]	cb		Pointer to cbuf_t
+@return Free space in circbuf.
+*/
+uint16_t cbuf8_free(volatile struct cbuf8_t* cb)
+{
+#ifdef CBUF8_SPSC
+	return cb->size - 1 - cbuf8_len(cb);
+#else
+	return cb->size - cb->len;
+#endif
+}
+
+/** @privatesection */
+
+/**
+@brief Copy n bytes into buf starting at index t, wrapping at the end of buf.
+@return Index following the last byte written.
+*/
+static uint16_t cbuf8_cpyin(volatile struct cbuf8_t* cb, uint16_t t, const uint8_t* p, const uint16_t n)
+{
+	uint16_t c = cb->size - t;
+	if( c > n ) { c = n; }
+
+	memcpy(cb->buf + t, p, c);
+	memcpy(cb->buf, p + c, n - c);
+
+	t += n;
+	if( t >= cb->size ) { t -= cb->size; }
+	return t;
+}
+
+/**
+@brief Copy n bytes out of buf starting at index h, wrapping at the end of buf.
+@return Index following the last byte read.
+*/
+static uint16_t cbuf8_cpyout(volatile struct cbuf8_t* cb, uint16_t h, uint8_t* p, const uint16_t n)
+{
+	uint16_t c = cb->size - h;
+	if( c > n ) { c = n; }
+
+	memcpy(p, cb->buf + h, c);
+	memcpy(p + c, cb->buf, n - c);
+
+	h += n;
+	if( h >= cb->size ) { h -= cb->size; }
+	return h;
+}
+
+/** @publicsection */
+
+/**
+@brief Insert up to n elements.
+
+Data is copied in at most two contiguous spans.
+@param[in]	cb		Pointer to cbuf_t
+@param[in]	p		Data to insert
+@param[in]	n		Number of bytes to insert
+@return Number of bytes inserted (less than n if buffer full). Always n in CBUF8_OVERWRITE mode.
+*/
+uint16_t cbuf8_write(volatile struct cbuf8_t* cb, const uint8_t* p, uint16_t n)
+{
+	uint16_t r = n;
+
+#ifdef CBUF8_SPSC
+	uint16_t t = cb->tail;
+	uint16_t f = cbuf8_free(cb);
+	if( n > f ) {
+		if( cb->mode == CBUF8_OVERWRITE ) {
+			cb->drop += n - f;
+		} else {
+			r = f;
+#ifdef CBUF8_STATS
+			cb->st.ovf++;
+#endif
+		}
+		n = f;
+	}
+
+	t = cbuf8_cpyin(cb, t, p, n);
+	__DMB();	// data must be in place before the consumer sees the new tail
+	cb->tail = t;
+
+#ifdef CBUF8_STATS
+	uint16_t l = cbuf8_len(cb);
+	if( l > cb->st.maxlen ) { cb->st.maxlen = l; }
+#endif
+	return r;
+#else
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	uint16_t f = cb->size - cb->len;
+	if( n > f ) {
+		if( cb->mode == CBUF8_OVERWRITE ) {
+			if( n > cb->size ) {	// only the last size bytes can be kept
+				cb->drop += n - cb->size;
+				p += n - cb->size;
+				n = cb->size;
+			}
+			uint16_t o = n - f;	// make room by dropping the oldest bytes
+			cb->head += o;
+			if( cb->head >= cb->size ) { cb->head -= cb->size; }
+			cb->len -= o;
+			cb->drop += o;
+		} else {
+			n = f;
+			r = f;
+#ifdef CBUF8_STATS
+			cb->st.ovf++;
+#endif
+		}
+	}
+
+	cb->tail = cbuf8_cpyin(cb, cb->tail, p, n);
+	cb->len += n;
+#ifdef CBUF8_STATS
+	if( cb->len > cb->st.maxlen ) { cb->st.maxlen = cb->len; }
+#endif
+
+	__set_PRIMASK(g);
+	return r;
+#endif
+}
+
+/**
+@brief Get up to n elements.
+
+Data is copied out in at most two contiguous spans.
+@param[in]	cb		Pointer to cbuf_t
+@param[out]	p		Buffer where data is put
+@param[in]	n		Max number of bytes to get (n <= sizeof(p))
+@return Number of bytes copied to p (less than n if buffer empty).
+*/
+uint16_t cbuf8_read(volatile struct cbuf8_t* cb, uint8_t* p, uint16_t n)
+{
+#ifdef CBUF8_SPSC
+	uint16_t h = cb->head;
+	uint16_t l = cbuf8_len(cb);
+	if( n > l ) { n = l; }
+#ifdef CBUF8_STATS
+	if( l == 0 ) { cb->st.unf++; }
+#endif
+
+	h = cbuf8_cpyout(cb, h, p, n);
+	__DMB();	// data must be read before the producer sees the slots as free
+	cb->head = h;
+
+	return n;
+#else
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	if( n > cb->len ) { n = cb->len; }
+#ifdef CBUF8_STATS
+	if( cb->len == 0 ) { cb->st.unf++; }
+#endif
+
+	cb->head = cbuf8_cpyout(cb, cb->head, p, n);
+	cb->len -= n;
+
+	__set_PRIMASK(g);
+	return n;
+#endif
+}
+
+/**
+@brief Access the oldest bytes in place.
+
+Returns the largest contiguous span starting at head, i.e. for handing it to DMA. The bytes stay
+in the circbuf until cbuf8_consume is called. Peek/consume should only be used by a single consumer.
+@param[in]	cb		Pointer to cbuf_t
+@param[out]	p		Pointer to first byte of span inside buf
+@return Number of bytes in span, 0 if buffer empty.
+*/
+uint16_t cbuf8_peek(volatile struct cbuf8_t* cb, uint8_t** const p)
+{
+#ifdef CBUF8_SPSC
+	uint16_t h = cb->head;
+	uint16_t t = cb->tail;
+	uint16_t n = (t >= h) ? (t - h) : (cb->size - h);
+#else
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	uint16_t h = cb->head;
+	uint16_t n = cb->size - h;
+	if( n > cb->len ) { n = cb->len; }
+
+	__set_PRIMASK(g);
+#endif
+
+	*p = cb->buf + h;
+	return n;
+}
+
+/**
+@brief Remove n bytes previously obtained with cbuf8_peek.
+@param[in]	cb		Pointer to cbuf_t
+@param[in]	n		Number of bytes to remove (not more than returned by cbuf8_peek)
+*/
+void cbuf8_consume(volatile struct cbuf8_t* cb, const uint16_t n)
+{
+#ifdef CBUF8_SPSC
+	uint16_t h = cb->head + n;
+	if( h >= cb->size ) { h -= cb->size; }
+	__DMB();	// data must be read before the producer sees the slots as free
+	cb->head = h;
+#else
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	if( n <= cb->len ) {
+		cb->head += n;
+		if( cb->head >= cb->size ) { cb->head -= cb->size; }
+		cb->len -= n;
+	}
+
+	__set_PRIMASK(g);
+#endif
+}
+
+/**
+@brief Find a byte.
+
+The bytes in circbuf are searched in place (memchr over at most two spans), nothing is removed.
+Should only be used by the consumer.
+@param[in]	cb		Pointer to cbuf_t
+@param[in]	d		Byte to find
+@return Number of bytes up to and including the first d, 0 if d not in circbuf.
+*/
+uint16_t cbuf8_find(volatile struct cbuf8_t* cb, const uint8_t d)
+{
+#ifdef CBUF8_SPSC
+	uint16_t h = cb->head;
+	uint16_t l = cbuf8_len(cb);
+	__DMB();	// tail must be read before the data
+#else
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	uint16_t h = cb->head;
+	uint16_t l = cb->len;
+
+	__set_PRIMASK(g);
+#endif
+
+	uint16_t c = cb->size - h;
+	if( c > l ) { c = l; }
+
+	const uint8_t* p = memchr(cb->buf + h, d, c);
+	if( p ) { return p - (cb->buf + h) + 1; }
+	p = memchr(cb->buf, d, l - c);
+	if( p ) { return c + (p - cb->buf) + 1; }
+	return 0;
+}
+
+/**
+@brief Insert n bytes already written in place at tail (i.e. by a circular DMA).
+
+If there is no room for n bytes, the producer has already overwritten the oldest ones. They are
+dropped and counted in drop, and tail follows the producer by all n bytes. With CBUF8_SPSC head can
+not be moved by the producer, so the new bytes are cut short instead and tail no longer follows the
+producer. There it must only be used by producers that never write more than cbuf8_free bytes,
+which rules out a free running circular DMA (serialq refuses SER_RX_DMA with CBUF8_SPSC).
+@param[in]	cb		Pointer to cbuf_t
+@param[in]	n		Number of bytes written at tail
+*/
+void cbuf8_commit(volatile struct cbuf8_t* cb, uint16_t n)
+{
+#ifdef CBUF8_SPSC
+	uint16_t f = cbuf8_free(cb);
+	if( n > f ) {
+		cb->drop += n - f;
+#ifdef CBUF8_STATS
+		cb->st.ovf++;
+#endif
+		n = f;
+	}
+
+	uint16_t t = cb->tail + n;
+	if( t >= cb->size ) { t -= cb->size; }
+	__DMB();	// data must be in place before the consumer sees the new tail
+	cb->tail = t;
+
+#ifdef CBUF8_STATS
+	uint16_t l = cbuf8_len(cb);
+	if( l > cb->st.maxlen ) { cb->st.maxlen = l; }
+#endif
+#else
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	if( n > cb->size ) {
+		cb->drop += n - cb->size;
+		n = cb->size;
+	}
+	uint16_t f = cb->size - cb->len;
+	if( n > f ) {
+		uint16_t o = n - f;
+		cb->head += o;
+		if( cb->head >= cb->size ) { cb->head -= cb->size; }
+		cb->len -= o;
+		cb->drop += o;
+#ifdef CBUF8_STATS
+		cb->st.ovf++;
+#endif
+	}
+
+	cb->tail += n;
+	if( cb->tail >= cb->size ) { cb->tail -= cb->size; }
+	cb->len += n;
+#ifdef CBUF8_STATS
+	if( cb->len > cb->st.maxlen ) { cb->st.maxlen = cb->len; }
+#endif
+
+	__set_PRIMASK(g);
+#endif
+}
+
+#ifdef CBUF8_STATS
+/**
+@brief Get circbuf statistics.
+@param[in]	cb		Pointer to cbuf_t
+@param[out]	st		Pointer to caller allocated cbuf8_stats_t where statistics are copied
+@param[in]	clr		bool, true = reset statistics after copying
+*/
+void cbuf8_stats(volatile struct cbuf8_t* cb, struct cbuf8_stats_t* st, const uint8_t clr)
+{
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	st->maxlen = cb->st.maxlen;
+	st->ovf = cb->st.ovf;
+	st->unf = cb->st.unf;
+
+	if( clr ) {
+		cb->st.maxlen = cbuf8_len(cb);
+		cb->st.ovf = 0;
+		cb->st.unf = 0;
+	}
+
+	__set_PRIMASK(g);
 }
+#endif
@@ -3,18 +3,49 @@
 
 #include <inttypes.h>
 
+#ifdef CBUF8_STATS
+/** Circbuf statistics */
+struct cbuf8_stats_t
+{
+	uint16_t maxlen;	/**< max number of bytes ever in FIFO */
+	uint32_t ovf;	/**< number of puts/writes rejected (or cut short) because FIFO was full */
+	uint32_t unf;	/**< number of gets/reads from an empty FIFO, including empty polls (not cbuf8_peek) */
+};
+#endif
+
 /** Circbuf state struct */
 struct cbuf8_t
 {
 	uint8_t* buf;	/**< pointer to data buffer */
 	uint16_t head;	/**< current FIFO head */
 	uint16_t tail;	/**< current FIFO tail */
-	uint16_t len;	/**< number of bytes currently in FIFO */
+	uint16_t len;	/**< number of bytes currently in FIFO (not maintained with CBUF8_SPSC) */
 	uint16_t size;	/**< size of buf */
+	uint8_t mode;	/**< behaviour when full, CBUF8_BLOCK or CBUF8_OVERWRITE */
+	uint32_t drop;	/**< number of bytes dropped in CBUF8_OVERWRITE mode */
+#ifdef CBUF8_STATS
+	struct cbuf8_stats_t st;	/**< statistics */
+#endif
 };
 
-void cbuf8_clear(volatile struct cbuf8_t* cb, uint8_t* const p, const uint16_t s);
+#define CBUF8_BLOCK 0	/**< put fails when buffer full */
+#define CBUF8_OVERWRITE 1	/**< put drops the oldest byte when buffer full */
+
+void cbuf8_clear_m(volatile struct cbuf8_t* cb, uint8_t* const p, const uint16_t s, const uint8_t m);
+#define cbuf8_clear(cb, p, s) cbuf8_clear_m(cb, p, s, CBUF8_BLOCK)
 uint8_t cbuf8_put(volatile struct cbuf8_t* cb, const uint8_t d);
 uint8_t cbuf8_get(volatile struct cbuf8_t* cb, uint8_t* const d);
+uint16_t cbuf8_len(volatile struct cbuf8_t* cb);
+uint16_t cbuf8_free(volatile struct cbuf8_t* cb);
+uint16_t cbuf8_write(volatile struct cbuf8_t* cb, const uint8_t* p, uint16_t n);
+uint16_t cbuf8_read(volatile struct cbuf8_t* cb, uint8_t* p, uint16_t n);
+uint16_t cbuf8_find(volatile struct cbuf8_t* cb, const uint8_t d);
+uint16_t cbuf8_peek(volatile struct cbuf8_t* cb, uint8_t** const p);
+void cbuf8_consume(volatile struct cbuf8_t* cb, const uint16_t n);
+void cbuf8_commit(volatile struct cbuf8_t* cb, uint16_t n);
+
+#ifdef CBUF8_STATS
+void cbuf8_stats(volatile struct cbuf8_t* cb, struct cbuf8_stats_t* st, const uint8_t clr);
+#endif
 
 #endif
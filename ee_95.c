@@ -8,7 +8,6 @@
 */
 
 #include <inttypes.h>
-#include <string.h>
 
 #include "spi.h"
 
@@ -54,12 +53,12 @@ void ee95_init(uint8_t n)
 */
 uint8_t ee95_rd(uint8_t n, uint32_t adr, uint8_t* buf, uint16_t len)
 {
+	uint8_t cmd[2] = {((adr >> 5) & 0x18) | 0x03, adr & 0xff}; // READ instruction containing A9 and A8, address A7..A0
+
 	EE95_CS_LOW;
 
-	spi_rw(n, ((adr >> 5) & 0x18) | 0x03 ); // READ instruction containing A9 and A8
-	spi_rw(n, adr & 0xff ); // address A7..A0
-	memset(buf, 0, len);
-	spi_putsn(n, (char*)buf, len);
+	spi_xfer(n, cmd, 0, sizeof(cmd));
+	spi_xfer(n, 0, buf, len);
 
 	EE95_CS_HIGH;
 
@@ -90,14 +89,12 @@ void ee95_wren(uint8_t n)
 */
 uint8_t ee95_wr(uint8_t n, uint32_t adr, uint8_t* buf, uint16_t len)
 {
+	uint8_t cmd[2] = {((adr >> 5) & 0x18) | 0x02, adr & 0xff}; // WRITE instruction containing A9 and A8, address A7..A0
+
 	EE95_CS_LOW;
 
-	spi_rw(n, ((adr >> 5) & 0x18) | 0x02 ); // WRITE instruction containing A9 and A8
-	spi_rw(n, adr & 0xff ); // address A7..A0
-	while( len-- ) {
-		spi_rw(n, *buf);
-		buf++;
-	}
+	spi_xfer(n, cmd, 0, sizeof(cmd));
+	spi_xfer(n, buf, 0, len);
 
 	EE95_CS_HIGH;
 
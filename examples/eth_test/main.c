@@ -56,6 +56,8 @@ A list of supported AT commands can be requested by issuing "AT?".
 #define PHY_INT_PORT GPIOB
 #define PHY_INT_PIN GPIO_Pin_14
 
+#define AT_LINE_LEN 64	// AT command line buffer, including the terminating zero
+
 //-----------------------------------------------------------------------------
 // Constants
 //-----------------------------------------------------------------------------
@@ -121,7 +123,7 @@ static volatile uint32_t uptime;
 static volatile uint32_t lastethrx;
 static uint16_t logmask;
 
-static uint8_t uart1rxbuf[32];
+static uint8_t uart1rxbuf[AT_LINE_LEN + 16];	// a whole line with CR LF must fit, or ser_readline returns it in parts
 static uint8_t uart1txbuf[64];
 
 volatile uint32_t tmr_cnt[TMR_ID_SIZE];
@@ -235,8 +237,7 @@ char* iptoa(uint8_t* a)
 	char* p = s;
 	uint8_t i;
 	for( i = 0; i < 4; ++i ) {
-		itoa(a[i], p, 10);
-		while( *p ) ++p;
+		p += u32toa(a[i], p, 10);
 		*p = '.';
 		++p;
 	}
@@ -473,7 +474,7 @@ uint8_t proc_at_cmd(const char* s)
 			if( (i>18)&&(i<26) ) continue;
 			if( i == 28 ) continue;
 			uint16_t r = eth_phyrreg(i);
-			ser_printf("%2d %4x\r\n", i, r);
+			ser_printf("%2d %04x\r\n", i, r);
 		}
 
 		return 0;
@@ -483,6 +484,7 @@ uint8_t proc_at_cmd(const char* s)
 
 	if( 0 == strcmp(s, atstat) ) {
 		ser_printf("uptime %d\r\n", uptime);
+		ser_printf("txdrop %d\r\n", ser_txdrop(AT_CMD_UART));
 		ser_printf("lastethrx %d\r\n", lastethrx);
 		ser_printf("uid ");
 		hprintbuf(UNIQUE_DEVICE_ID_ADDR, UNIQUE_DEVICE_ID_LEN);
@@ -493,6 +495,12 @@ uint8_t proc_at_cmd(const char* s)
 		ser_printf("gw %s\r\n", iptoa(gwip));
 		ser_printf("mac ");
 		hprintbuf(mymac, 6);
+#ifdef CBUF8_STATS
+		struct cbuf8_stats_t rxst, txst;
+		ser_stats(AT_CMD_UART, &rxst, &txst, 0);
+		ser_printf("uart rx max %d/%d ovf %d\r\n", rxst.maxlen, sizeof(uart1rxbuf), rxst.ovf);
+		ser_printf("uart tx max %d/%d ovf %d\r\n", txst.maxlen, sizeof(uart1txbuf), txst.ovf);
+#endif
 		ser_printf("link ");
 		if( eth_linkup() ) {
 			uint16_t r = eth_phyrreg(31);
@@ -633,6 +641,7 @@ int main(void)
 	logmask = 0xffff;
 
 	ser_init(AT_CMD_UART, AT_CMD_BAUD, uart1txbuf, sizeof(uart1txbuf), uart1rxbuf, sizeof(uart1rxbuf));
+	ser_txmode(AT_CMD_UART, CBUF8_OVERWRITE); // heavy logging must not stall the main loop
 	ser_printf_devnum = AT_CMD_UART;
 	ser_printf("reset\r\n");
 
@@ -656,28 +665,25 @@ int main(void)
 	while( 1 ) {
 		// AT command processing
 		{
-			uint8_t d;
-			if( ser_getc(AT_CMD_UART, &d) ) {
-				static char atbuf[64];
-				static uint8_t atbuflen = 0;
-
-				// buffer overflow guard
-				if( atbuflen >= sizeof(atbuf) ) { atbuflen = 0; }
-
-				// execute on enter
-				if( (d == '\r') || (d == '\n') ) {
-					if( atbuflen ) {
-						atbuf[atbuflen] = 0;
-						atbuflen = 0;
-						uint8_t r = proc_at_cmd(atbuf);
-						if( r == 0 ) ser_printf("OK\r\n");
-						if( r == 1 ) ser_printf("ERR\r\n");
+			char atbuf[AT_LINE_LEN];
+			if( ser_readline(AT_CMD_UART, atbuf, sizeof(atbuf)) ) {
+				// apply backspaces and convert to upper case
+				char* s = atbuf;
+				char* d = atbuf;
+				for( ; *s; ++s ) {
+					if( *s == 0x7f ) {
+						if( d > atbuf ) { --d; }
+					} else {
+						*d++ = toupper(*s);
 					}
-				} else
-				if( d == 0x7f ) {	// backspace
-					if( atbuflen ) { --atbuflen; }
-				} else {			// store character
-					atbuf[atbuflen++] = toupper(d);
+				}
+				*d = 0;
+
+				// execute
+				if( atbuf[0] ) {
+					uint8_t r = proc_at_cmd(atbuf);
+					if( r == 0 ) ser_printf("OK\r\n");
+					if( r == 1 ) ser_printf("ERR\r\n");
 				}
 			}
 		}
@@ -804,8 +810,8 @@ int main(void)
 		}
 		// ARP requests
 		if( tmr_elapsed(TMR_ID_ARP_REQ) )	{
-			uint8_t ip[4];
-			if( fifo_get(&arpreqfifo, &ip) ) {
+			uint8_t* ip = fifo_peek(&arpreqfifo);
+			if( ip ) {
 				if( !arp_find_entry(ip, 0) ) {
 					arp_request_send(ip);
 					tmr_reset(TMR_ID_ARP_REQ);
@@ -813,6 +819,7 @@ int main(void)
 						ser_printf("ARP sent req for %s\r\n", iptoa(ip));
 					}
 				}
+				fifo_consume(&arpreqfifo);
 			}
 		}
 		// LED
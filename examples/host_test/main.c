@@ -0,0 +1,132 @@
+/**
+This is a host build of the ring buffer tests, for checking changes to the buffer routines without
+a board. The library sources are compiled with gcc for the PC against the stand-in stm32f10x.h in
+this directory, which emulates interrupt masking with a lock.
+
+Each test checks the routines against a simple reference model with randomized operation
+sequences that wrap the buffers many times, and reports throughput and the average and worst case
+time per call. Host timings only compare implementations to each other, use ring_bench on the
+target for cycle counts. The worst case includes any preemption by the host OS.
+
+circbuf8 is also stressed with the producer and the consumer in two threads, standing in for an
+ISR and the main loop. With CBUF8_SPSC nothing is locked, so this checks that head and tail are
+only published after the data (run it on a multi core host). mpfifo is stressed with several
+producer threads, which exercises its host path (compiler atomic builtins instead of LDREX/STREX).
+
+serialq is run against a model of the USART and its DMA channels (see periph.c), with USART1
+transmitting by DMA and USART2 by interrupt. The bytes that reach the wire are checked against
+what was written, which verifies that DMA spans chain across the end of the TX queue. USART1 also
+receives by circular DMA, including an overrun of the RX queue (not in host_test_spsc, SER_RX_DMA
+needs the default circbuf8).
+
+The itoa routines are checked in all bases 2..16 on edge values (0, INT32_MIN, UINT64_MAX and
+their neighbours), powers of the base, all 16 bit values and random values of every length. Results
+are parsed back with strtoull and compared with snprintf in bases 8, 10 and 16. ftoa and qtoa are compared with snprintf "%.*f" for
+0..9 decimals. The one known difference are exact ties (2.5, 0.125 with 2 decimals), which ftoa and
+qtoa round half away from zero and glibc to even; these are counted and checked separately.
+
+make builds two binaries, host_test with the default circbuf8 and host_test_spsc with circbuf8 built
+with CBUF8_SPSC. make run runs both; the exit status is non zero if any check failed.
+
+@file		main.c
+@brief		Host tests of the buffer routines
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+*/
+
+#include <time.h>
+
+#include "stm32f10x.h"
+#include "test.h"
+
+uint32_t test_fails;
+static uint32_t test_lfsr = 1;
+
+/**
+@brief Monotonic time in ns.
+*/
+uint64_t test_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+@brief Pseudo random number (xorshift32), repeatable for a given seed.
+*/
+uint32_t test_rand(void)
+{
+	test_lfsr ^= test_lfsr << 13;
+	test_lfsr ^= test_lfsr >> 17;
+	test_lfsr ^= test_lfsr << 5;
+	return test_lfsr;
+}
+
+/**
+@brief Seed test_rand.
+*/
+void test_seed(uint32_t s)
+{
+	test_lfsr = s ? s : 1;
+}
+
+/**
+@brief Account one operation started at t0.
+*/
+void test_lat_add(struct test_lat_t* l, uint64_t t0)
+{
+	uint64_t d = test_ns() - t0;
+	l->sum += d;
+	if( d > l->max ) { l->max = d; }
+	l->n++;
+}
+
+/**
+@brief Print average and worst case time per operation.
+*/
+void test_lat_print(const char* name, struct test_lat_t* l)
+{
+	printf("  %-28s avg %5.1f ns  max %6" PRIu64 " ns\n", name, l->n ? (double)l->sum / l->n : 0.0, l->max);
+}
+
+/**
+@brief Print throughput.
+*/
+void test_rate_print(const char* name, uint32_t ops, uint64_t ns)
+{
+	printf("  %-28s %7.2f Mops/s\n", name, ns ? ops * 1000.0 / ns : 0.0);
+}
+
+int main(void)
+{
+#ifdef CBUF8_SPSC
+	printf("circbuf8 (CBUF8_SPSC)\n");
+	test_circbuf8();
+	printf("serialq (CBUF8_SPSC)\n");
+	test_serialq();
+#else
+	printf("fifo\n");
+	test_fifo();
+	printf("msgq\n");
+	test_msgq();
+	printf("circbuf8\n");
+	test_circbuf8();
+	printf("ring\n");
+	test_ring();
+	printf("mpfifo\n");
+	test_mpfifo();
+	printf("serialq\n");
+	test_serialq();
+	printf("serframe\n");
+	test_serframe();
+	printf("itoa\n");
+	test_itoa();
+	printf("ftoa\n");
+	test_ftoa();
+#endif
+
+	printf("%s, %" PRIu32 " failed checks\n", test_fails ? "FAIL" : "PASS", test_fails);
+	return test_fails != 0;
+}
@@ -0,0 +1,91 @@
+/**
+@file		periph.c
+@brief		Host build registers and standard peripheral library subset, see stm32f10x.h
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+*/
+
+#include "stm32f10x.h"
+
+pthread_mutex_t host_irq_lock = PTHREAD_MUTEX_INITIALIZER;
+__thread uint32_t host_primask;
+
+GPIO_TypeDef host_gpio[7];
+USART_TypeDef host_usart[5];
+DMA_TypeDef host_dma[2];
+DMA_Channel_TypeDef host_dma_ch[12];
+
+/** Called with every byte written to a USART DR, set by the test playing the wire */
+void (*host_usart_tx)(USART_TypeDef* usart, uint16_t d);
+
+void RCC_AHBPeriphClockCmd(uint32_t p, FunctionalState s) {}
+void RCC_APB1PeriphClockCmd(uint32_t p, FunctionalState s) {}
+void RCC_APB2PeriphClockCmd(uint32_t p, FunctionalState s) {}
+
+void GPIO_Init(GPIO_TypeDef* gpio, GPIO_InitTypeDef* init) {}
+void GPIO_PinRemapConfig(uint32_t remap, FunctionalState s) {}
+
+void GPIO_SetBits(GPIO_TypeDef* gpio, uint16_t pin)
+{
+	gpio->ODR |= pin;
+}
+
+void GPIO_ResetBits(GPIO_TypeDef* gpio, uint16_t pin)
+{
+	gpio->ODR &= ~pin;
+}
+
+void NVIC_Init(NVIC_InitTypeDef* init) {}
+
+void USART_Init(USART_TypeDef* usart, USART_InitTypeDef* init)
+{
+	usart->SR = USART_SR_TXE | USART_SR_TC;
+	usart->CR1 = init->USART_WordLength | init->USART_Parity | init->USART_Mode;
+	usart->CR2 = init->USART_StopBits;
+	usart->CR3 = init->USART_HardwareFlowControl;
+}
+
+void USART_Cmd(USART_TypeDef* usart, FunctionalState s) {}
+
+void USART_ITConfig(USART_TypeDef* usart, uint32_t it, FunctionalState s)
+{
+	__IO uint16_t* cr = (it & 0x10000) ? &usart->CR3 : &usart->CR1;
+	if( s ) {
+		*cr |= it;
+	} else {
+		*cr &= ~it;
+	}
+}
+
+void USART_DMACmd(USART_TypeDef* usart, uint16_t req, FunctionalState s)
+{
+	if( s ) {
+		usart->CR3 |= req;
+	} else {
+		usart->CR3 &= ~req;
+	}
+}
+
+void USART_ClearFlag(USART_TypeDef* usart, uint16_t flag)
+{
+	usart->SR &= ~flag;
+}
+
+FlagStatus USART_GetFlagStatus(USART_TypeDef* usart, uint16_t flag)
+{
+	return (usart->SR & flag) ? SET : RESET;
+}
+
+void USART_SendData(USART_TypeDef* usart, uint16_t d)
+{
+	usart->DR = d;
+	if( host_usart_tx ) { host_usart_tx(usart, d); }
+}
+
+uint16_t USART_ReceiveData(USART_TypeDef* usart)
+{
+	// a DR read after the SR read clears RXNE, IDLE and the error flags
+	usart->SR &= ~(USART_SR_RXNE | USART_SR_IDLE | USART_SR_ORE | USART_SR_FE | USART_SR_NE | USART_SR_PE);
+	return usart->DR;
+}
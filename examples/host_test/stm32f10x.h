@@ -0,0 +1,269 @@
+/**
+
+Stands in for the CMSIS device header when the library is built for the host (see makefile).
+Only what the library sources used by the host tests need is provided.
+
+Peripheral registers are plain variables (see periph.c) and the standard peripheral library
+functions only set the register bits the library looks at, so a test can play the hardware: feed
+the USART and the DMA channels and call the interrupt handlers. DMA channels hold memory addresses
+in 32 bit registers, so the host build is linked as a non PIE executable, where static buffers
+have 32 bit addresses.
+
+Interrupt masking is emulated with one global lock: __disable_irq takes it unless the calling
+thread already holds it and __set_PRIMASK(0) (or __enable_irq) releases it. Code that runs
+between __disable_irq and __set_PRIMASK(g) thus excludes every other thread, just like it excludes
+every ISR on the target, and test threads can play the main loop and the interrupts.
+
+@file		stm32f10x.h
+@brief		Host build stand-in for the device header
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+*/
+
+#ifndef MAT_HOST_STM32F10X_H
+#define MAT_HOST_STM32F10X_H
+
+#include <inttypes.h>
+#include <pthread.h>
+
+#define __IO volatile
+
+extern pthread_mutex_t host_irq_lock;
+extern __thread uint32_t host_primask;
+
+static inline uint32_t __get_PRIMASK(void)
+{
+	return host_primask;
+}
+
+static inline void __disable_irq(void)
+{
+	if( !host_primask ) {
+		pthread_mutex_lock(&host_irq_lock);
+		host_primask = 1;
+	}
+}
+
+static inline void __enable_irq(void)
+{
+	if( host_primask ) {
+		host_primask = 0;
+		pthread_mutex_unlock(&host_irq_lock);
+	}
+}
+
+static inline void __set_PRIMASK(uint32_t g)
+{
+	if( g ) {
+		__disable_irq();
+	} else {
+		__enable_irq();
+	}
+}
+
+static inline void __DMB(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+typedef enum {RESET = 0, SET = !RESET} FlagStatus, ITStatus;
+typedef enum {DISABLE = 0, ENABLE = !DISABLE} FunctionalState;
+
+// registers
+
+typedef struct
+{
+	__IO uint32_t CRL, CRH, IDR, ODR, BSRR, BRR, LCKR;
+} GPIO_TypeDef;
+
+typedef struct
+{
+	__IO uint16_t SR;
+	uint16_t RESERVED0;
+	__IO uint16_t DR;
+	uint16_t RESERVED1;
+	__IO uint16_t BRR;
+	uint16_t RESERVED2;
+	__IO uint16_t CR1;
+	uint16_t RESERVED3;
+	__IO uint16_t CR2;
+	uint16_t RESERVED4;
+	__IO uint16_t CR3;
+	uint16_t RESERVED5;
+	__IO uint16_t GTPR;
+	uint16_t RESERVED6;
+} USART_TypeDef;
+
+typedef struct
+{
+	__IO uint32_t CCR, CNDTR, CPAR, CMAR;
+} DMA_Channel_TypeDef;
+
+typedef struct
+{
+	__IO uint32_t ISR, IFCR;
+} DMA_TypeDef;
+
+extern GPIO_TypeDef host_gpio[7];
+extern USART_TypeDef host_usart[5];
+extern DMA_TypeDef host_dma[2];
+extern DMA_Channel_TypeDef host_dma_ch[12];	// DMA1 channels 1..7, DMA2 channels 1..5
+
+#define GPIOA (&host_gpio[0])
+#define GPIOB (&host_gpio[1])
+#define GPIOC (&host_gpio[2])
+#define GPIOD (&host_gpio[3])
+#define GPIOE (&host_gpio[4])
+#define USART1 (&host_usart[0])
+#define USART2 (&host_usart[1])
+#define USART3 (&host_usart[2])
+#define UART4 (&host_usart[3])
+#define UART5 (&host_usart[4])
+#define DMA1 (&host_dma[0])
+#define DMA2 (&host_dma[1])
+#define DMA1_Channel1 (&host_dma_ch[0])
+#define DMA1_Channel2 (&host_dma_ch[1])
+#define DMA1_Channel3 (&host_dma_ch[2])
+#define DMA1_Channel4 (&host_dma_ch[3])
+#define DMA1_Channel5 (&host_dma_ch[4])
+#define DMA1_Channel6 (&host_dma_ch[5])
+#define DMA1_Channel7 (&host_dma_ch[6])
+
+typedef enum
+{
+	DMA1_Channel1_IRQn = 11, DMA1_Channel2_IRQn, DMA1_Channel3_IRQn, DMA1_Channel4_IRQn,
+	DMA1_Channel5_IRQn, DMA1_Channel6_IRQn, DMA1_Channel7_IRQn,
+	USART1_IRQn = 37, USART2_IRQn, USART3_IRQn, UART4_IRQn = 52, UART5_IRQn
+} IRQn_Type;
+
+#define USART_SR_PE 0x0001
+#define USART_SR_FE 0x0002
+#define USART_SR_NE 0x0004
+#define USART_SR_ORE 0x0008
+#define USART_SR_IDLE 0x0010
+#define USART_SR_RXNE 0x0020
+#define USART_SR_TC 0x0040
+#define USART_SR_TXE 0x0080
+#define USART_CR1_IDLEIE 0x0010
+#define USART_CR1_RXNEIE 0x0020
+#define USART_CR1_TCIE 0x0040
+#define USART_CR1_TXEIE 0x0080
+#define USART_CR1_PEIE 0x0100
+#define USART_CR3_EIE 0x0001
+#define USART_CR3_DMAR 0x0040
+#define USART_CR3_DMAT 0x0080
+
+#define DMA_CCR1_EN 0x0001
+#define DMA_CCR1_TCIE 0x0002
+#define DMA_CCR1_HTIE 0x0004
+#define DMA_CCR1_DIR 0x0010
+#define DMA_CCR1_CIRC 0x0020
+#define DMA_CCR1_MINC 0x0080
+#define DMA_IFCR_CGIF2 0x00000010
+#define DMA_IFCR_CGIF3 0x00000100
+#define DMA_IFCR_CGIF4 0x00001000
+#define DMA_IFCR_CGIF5 0x00010000
+#define DMA_IFCR_CGIF6 0x00100000
+#define DMA_IFCR_CGIF7 0x01000000
+
+// standard peripheral library subset
+
+#define RCC_AHBPeriph_DMA1 0x0001
+#define RCC_APB2Periph_AFIO 0x0001
+#define RCC_APB2Periph_GPIOA 0x0004
+#define RCC_APB2Periph_USART1 0x4000
+#define RCC_APB1Periph_USART2 0x00020000
+#define RCC_APB1Periph_USART3 0x00040000
+#define RCC_APB1Periph_UART4 0x00080000
+#define RCC_APB1Periph_UART5 0x00100000
+void RCC_AHBPeriphClockCmd(uint32_t p, FunctionalState s);
+void RCC_APB1PeriphClockCmd(uint32_t p, FunctionalState s);
+void RCC_APB2PeriphClockCmd(uint32_t p, FunctionalState s);
+
+#define GPIO_Pin_0 0x0001
+#define GPIO_Pin_1 0x0002
+#define GPIO_Pin_2 0x0004
+#define GPIO_Pin_3 0x0008
+#define GPIO_Pin_4 0x0010
+#define GPIO_Pin_5 0x0020
+#define GPIO_Pin_6 0x0040
+#define GPIO_Pin_7 0x0080
+#define GPIO_Pin_8 0x0100
+#define GPIO_Pin_9 0x0200
+#define GPIO_Pin_10 0x0400
+#define GPIO_Pin_11 0x0800
+#define GPIO_Pin_12 0x1000
+#define GPIO_Pin_13 0x2000
+#define GPIO_Pin_14 0x4000
+#define GPIO_Pin_15 0x8000
+#define GPIO_Remap_USART1 0x00000004
+#define GPIO_Remap_USART2 0x00000008
+#define GPIO_PartialRemap_USART3 0x00140010
+#define GPIO_FullRemap_USART3 0x00140030
+typedef enum {GPIO_Speed_10MHz = 1, GPIO_Speed_2MHz, GPIO_Speed_50MHz} GPIOSpeed_TypeDef;
+typedef enum
+{
+	GPIO_Mode_AIN = 0x0, GPIO_Mode_IN_FLOATING = 0x04, GPIO_Mode_IPD = 0x28, GPIO_Mode_IPU = 0x48,
+	GPIO_Mode_Out_OD = 0x14, GPIO_Mode_Out_PP = 0x10, GPIO_Mode_AF_OD = 0x1C, GPIO_Mode_AF_PP = 0x18
+} GPIOMode_TypeDef;
+typedef struct
+{
+	uint16_t GPIO_Pin;
+	GPIOSpeed_TypeDef GPIO_Speed;
+	GPIOMode_TypeDef GPIO_Mode;
+} GPIO_InitTypeDef;
+void GPIO_Init(GPIO_TypeDef* gpio, GPIO_InitTypeDef* init);
+void GPIO_PinRemapConfig(uint32_t remap, FunctionalState s);
+void GPIO_SetBits(GPIO_TypeDef* gpio, uint16_t pin);
+void GPIO_ResetBits(GPIO_TypeDef* gpio, uint16_t pin);
+
+typedef struct
+{
+	uint8_t NVIC_IRQChannel;
+	uint8_t NVIC_IRQChannelPreemptionPriority;
+	uint8_t NVIC_IRQChannelSubPriority;
+	FunctionalState NVIC_IRQChannelCmd;
+} NVIC_InitTypeDef;
+void NVIC_Init(NVIC_InitTypeDef* init);
+
+#define USART_WordLength_8b 0x0000
+#define USART_WordLength_9b 0x1000
+#define USART_StopBits_1 0x0000
+#define USART_StopBits_2 0x2000
+#define USART_Parity_No 0x0000
+#define USART_Parity_Even 0x0400
+#define USART_Parity_Odd 0x0600
+#define USART_Mode_Rx 0x0004
+#define USART_Mode_Tx 0x0008
+#define USART_HardwareFlowControl_None 0x0000
+#define USART_HardwareFlowControl_RTS 0x0100
+#define USART_HardwareFlowControl_CTS 0x0200
+#define USART_IT_PE USART_CR1_PEIE	// CR1 bit, CR3 bit with 0x10000 added
+#define USART_IT_TXE USART_CR1_TXEIE
+#define USART_IT_TC USART_CR1_TCIE
+#define USART_IT_RXNE USART_CR1_RXNEIE
+#define USART_IT_IDLE USART_CR1_IDLEIE
+#define USART_IT_ERR (0x10000 | USART_CR3_EIE)
+#define USART_DMAReq_Tx USART_CR3_DMAT
+#define USART_DMAReq_Rx USART_CR3_DMAR
+#define USART_FLAG_TC USART_SR_TC
+typedef struct
+{
+	uint32_t USART_BaudRate;
+	uint16_t USART_WordLength;
+	uint16_t USART_StopBits;
+	uint16_t USART_Parity;
+	uint16_t USART_Mode;
+	uint16_t USART_HardwareFlowControl;
+} USART_InitTypeDef;
+void USART_Init(USART_TypeDef* usart, USART_InitTypeDef* init);
+void USART_Cmd(USART_TypeDef* usart, FunctionalState s);
+void USART_ITConfig(USART_TypeDef* usart, uint32_t it, FunctionalState s);
+void USART_DMACmd(USART_TypeDef* usart, uint16_t req, FunctionalState s);
+void USART_ClearFlag(USART_TypeDef* usart, uint16_t flag);
+FlagStatus USART_GetFlagStatus(USART_TypeDef* usart, uint16_t flag);
+void USART_SendData(USART_TypeDef* usart, uint16_t d);
+uint16_t USART_ReceiveData(USART_TypeDef* usart);
+
+#endif
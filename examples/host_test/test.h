@@ -0,0 +1,37 @@
+#ifndef MAT_HOST_TEST_H
+#define MAT_HOST_TEST_H
+
+#include <inttypes.h>
+#include <stdio.h>
+
+extern uint32_t test_fails;
+
+/** Count and report a failed check, the test goes on */
+#define CHECK(c) do { if( !(c) ) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #c); test_fails++; } } while(0)
+
+/** Per operation timing */
+struct test_lat_t
+{
+	uint64_t sum;	/**< total ns */
+	uint64_t max;	/**< worst case ns */
+	uint32_t n;	/**< number of operations */
+};
+
+uint64_t test_ns(void);
+uint32_t test_rand(void);
+void test_seed(uint32_t s);
+void test_lat_add(struct test_lat_t* l, uint64_t t0);
+void test_lat_print(const char* name, struct test_lat_t* l);
+void test_rate_print(const char* name, uint32_t ops, uint64_t ns);
+
+void test_fifo(void);
+void test_msgq(void);
+void test_circbuf8(void);
+void test_ring(void);
+void test_mpfifo(void);
+void test_serialq(void);
+void test_serframe(void);
+void test_itoa(void);
+void test_ftoa(void);
+
+#endif
@@ -0,0 +1,288 @@
+/**
+@file		test_circbuf8.c
+@brief		circbuf8 host tests, for both the default and the CBUF8_SPSC build
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+*/
+
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "mat/circbuf8.h"
+#include "test.h"
+
+#define CBUF8_MAXSIZE 67
+#define CBUF8_ITER 200000
+#define CBUF8_BENCH 4000000
+#define CBUF8_STRESS 4000000
+
+#ifdef CBUF8_SPSC
+#define CBUF8_CAP(s) ((s) - 1)	/**< one byte is kept free */
+#else
+#define CBUF8_CAP(s) (s)
+#endif
+
+static uint8_t cbuf8_mem[CBUF8_MAXSIZE];
+
+/** Reference model: bytes with sequence numbers rd .. wr - 1 are in the circbuf */
+struct cbuf8_ref_t
+{
+	uint32_t wr;	/**< sequence number of the next byte put */
+	uint32_t rd;	/**< sequence number of the next byte expected */
+	uint32_t drop;	/**< bytes dropped */
+};
+
+/**
+@brief Byte value for a sequence number.
+*/
+static inline uint8_t cbuf8_mk(const uint32_t i)
+{
+	return i ^ (i >> 8) ^ (i >> 16);
+}
+
+/**
+@brief Model of inserting n bytes into a circbuf of capacity c in mode m.
+
+The default build drops the oldest bytes in CBUF8_OVERWRITE mode, the CBUF8_SPSC build the new ones.
+@return Number of bytes inserted.
+*/
+static uint16_t cbuf8_ref_put(struct cbuf8_ref_t* r, const uint16_t c, const uint8_t m, const uint16_t n)
+{
+	uint32_t fr = c - (r->wr - r->rd);
+	uint16_t k = n;
+	if( n > fr ) {
+		r->drop += (m == CBUF8_OVERWRITE) ? n - fr : 0;
+#ifndef CBUF8_SPSC
+		if( m == CBUF8_OVERWRITE ) {
+			r->rd = r->wr + n - c;	// only the last c bytes are kept
+			r->wr += n;
+			return n;
+		}
+#endif
+		k = fr;
+	}
+	r->wr += k;
+	return k;
+}
+
+/**
+@brief Random sequence of all circbuf8 operations against the reference model.
+*/
+static void cbuf8_random(const uint16_t s, const uint8_t m, const uint32_t iter)
+{
+	volatile struct cbuf8_t cb;
+	struct cbuf8_ref_t r = {0, 0, 0};
+	const uint16_t c = CBUF8_CAP(s);
+	uint8_t d[CBUF8_MAXSIZE + 3];
+	uint32_t it;
+
+	cbuf8_clear_m(&cb, cbuf8_mem, s, m);
+
+	for( it = 0; it < iter; ++it ) {
+		uint16_t n = test_rand() % (s + 3);
+		uint16_t k, i, l = r.wr - r.rd;
+		uint8_t* p;
+
+		switch( test_rand() % 8 ) {
+		case 0:	// put
+			k = cbuf8_ref_put(&r, c, m, 1);
+			CHECK( cbuf8_put(&cb, cbuf8_mk(r.wr - k)) == (m == CBUF8_OVERWRITE ? 1 : k) );
+			break;
+		case 1:	// get
+			k = cbuf8_get(&cb, d);
+			CHECK( k == (l != 0) );
+			if( k ) {
+				CHECK( d[0] == cbuf8_mk(r.rd) );
+				r.rd++;
+			}
+			break;
+		case 2:	// write
+			for( i = 0; i < n; ++i ) { d[i] = cbuf8_mk(r.wr + i); }
+			k = cbuf8_ref_put(&r, c, m, n);
+			CHECK( cbuf8_write(&cb, d, n) == (m == CBUF8_OVERWRITE ? n : k) );
+			break;
+		case 3:	// read
+			k = (l < n) ? l : n;
+			CHECK( cbuf8_read(&cb, d, n) == k );
+			for( i = 0; i < k; ++i ) { CHECK( d[i] == cbuf8_mk(r.rd + i) ); }
+			r.rd += k;
+			break;
+		case 4:	// peek, consume part of the span
+			k = cbuf8_peek(&cb, &p);
+			CHECK( (k != 0) == (l != 0) );
+			CHECK( k <= l && p + k <= cbuf8_mem + s );
+			if( k ) {
+				for( i = 0; i < k; ++i ) { CHECK( p[i] == cbuf8_mk(r.rd + i) ); }
+				k = 1 + test_rand() % k;
+				cbuf8_consume(&cb, k);
+				r.rd += k;
+			}
+			break;
+		case 5:	// find a byte that is in the circbuf, or one that is not
+			if( l ) {
+				uint8_t v = cbuf8_mk(r.rd + test_rand() % l);
+				for( i = 0; cbuf8_mk(r.rd + i) != v; ++i );
+				CHECK( cbuf8_find(&cb, v) == i + 1 );
+			} else {
+				CHECK( cbuf8_find(&cb, 0) == 0 );
+			}
+			break;
+		case 6:	// len, free
+			CHECK( cbuf8_len(&cb) == l );
+			CHECK( cbuf8_free(&cb) == c - l );
+			break;
+		case 7:	// bytes written in place at tail, as by a circular DMA
+#ifdef CBUF8_SPSC
+			if( n > c - l ) { n = c - l; }	// overrun not supported, see cbuf8_commit
+#else
+			if( n > s ) { n = s; }
+#endif
+			for( i = 0; i < n; ++i ) { cbuf8_mem[(cb.tail + i) % s] = cbuf8_mk(r.wr + i); }
+			cbuf8_commit(&cb, n);
+			if( n > c - l ) {
+				r.drop += n - (c - l);
+				r.rd = r.wr + n - c;
+			}
+			r.wr += n;
+			break;
+		}
+
+		CHECK( cbuf8_len(&cb) == r.wr - r.rd );
+		CHECK( cb.drop == r.drop );
+		if( test_fails > 10 ) { return; }
+	}
+}
+
+/**
+@brief Time single byte and bulk transfers through a 64 byte circbuf.
+*/
+static void cbuf8_bench(void)
+{
+	volatile struct cbuf8_t cb;
+	struct test_lat_t lp = {0, 0, 0}, lg = {0, 0, 0};
+	uint8_t d = 0, b[16];
+	uint32_t i, j;
+	uint64_t t;
+
+	cbuf8_clear(&cb, cbuf8_mem, 64);
+
+	t = test_ns();
+	for( i = 0; i < CBUF8_BENCH / 32; ++i ) {
+		for( j = 0; j < 32; ++j ) { cbuf8_put(&cb, d); }
+		for( j = 0; j < 32; ++j ) { cbuf8_get(&cb, &d); }
+	}
+	test_rate_print("put+get", CBUF8_BENCH, test_ns() - t);
+
+	t = test_ns();
+	for( i = 0; i < CBUF8_BENCH / 16; ++i ) {
+		cbuf8_write(&cb, b, 16);
+		cbuf8_read(&cb, b, 16);
+	}
+	test_rate_print("write+read 16 B (bytes)", CBUF8_BENCH, test_ns() - t);
+
+	for( i = 0; i < CBUF8_BENCH / 32; ++i ) {
+		for( j = 0; j < 32; ++j ) {
+			t = test_ns();
+			cbuf8_put(&cb, d);
+			test_lat_add(&lp, t);
+		}
+		for( j = 0; j < 32; ++j ) {
+			t = test_ns();
+			cbuf8_get(&cb, &d);
+			test_lat_add(&lg, t);
+		}
+	}
+	test_lat_print("put", &lp);
+	test_lat_print("get", &lg);
+}
+
+static volatile struct cbuf8_t cbuf8_q;
+
+/**
+@brief Producer thread, puts CBUF8_STRESS sequence bytes with single puts and random length writes.
+*/
+static void* cbuf8_producer(void* a)
+{
+	uint32_t lfsr = 0x1234567, wr = 0;
+	uint8_t d[32];
+
+	while( wr < CBUF8_STRESS ) {
+		lfsr ^= lfsr << 13; lfsr ^= lfsr >> 17; lfsr ^= lfsr << 5;	// own generator, test_rand is not thread safe
+		uint16_t n = lfsr % sizeof(d), i, k;
+		if( n > CBUF8_STRESS - wr ) { n = CBUF8_STRESS - wr; }
+
+		if( n < 8 ) {
+			k = cbuf8_put(&cbuf8_q, cbuf8_mk(wr));
+		} else {
+			for( i = 0; i < n; ++i ) { d[i] = cbuf8_mk(wr + i); }
+			k = cbuf8_write(&cbuf8_q, d, n);
+		}
+		wr += k;
+		if( k == 0 ) { sched_yield(); }
+	}
+	return 0;
+}
+
+/**
+@brief Producer and consumer in two threads, the consumer using get, read and peek/consume.
+*/
+static void cbuf8_stress(const uint16_t s)
+{
+	pthread_t t;
+	uint32_t rd = 0;
+	uint8_t d[32];
+	uint64_t t0 = test_ns();
+
+	cbuf8_clear(&cbuf8_q, cbuf8_mem, s);
+	CHECK( pthread_create(&t, 0, cbuf8_producer, 0) == 0 );
+
+	while( rd < CBUF8_STRESS && test_fails < 10 ) {
+		uint16_t k = 0, i;
+		uint8_t* p;
+
+		switch( test_rand() % 3 ) {
+		case 0:
+			k = cbuf8_get(&cbuf8_q, d);
+			break;
+		case 1:
+			k = cbuf8_read(&cbuf8_q, d, 1 + test_rand() % sizeof(d));
+			break;
+		case 2:
+			k = cbuf8_peek(&cbuf8_q, &p);
+			if( k > sizeof(d) ) { k = sizeof(d); }
+			memcpy(d, p, k);
+			cbuf8_consume(&cbuf8_q, k);
+			break;
+		}
+
+		for( i = 0; i < k; ++i ) { CHECK( d[i] == cbuf8_mk(rd + i) ); }
+		rd += k;
+		if( k == 0 ) { sched_yield(); }
+	}
+
+	pthread_join(t, 0);
+	CHECK( rd == CBUF8_STRESS && cbuf8_len(&cbuf8_q) == 0 && cbuf8_q.drop == 0 );
+
+	char name[32];
+	snprintf(name, sizeof(name), "two threads, %u B", s);
+	test_rate_print(name, CBUF8_STRESS, test_ns() - t0);
+}
+
+void test_circbuf8(void)
+{
+	uint16_t s;
+
+	test_seed(2);
+	for( s = 2; s <= CBUF8_MAXSIZE; s += 5 ) {
+		cbuf8_random(s, CBUF8_BLOCK, CBUF8_ITER / 14);
+		cbuf8_random(s, CBUF8_OVERWRITE, CBUF8_ITER / 14);
+	}
+	printf("  random interleavings        done\n");
+
+	cbuf8_stress(7);
+	cbuf8_stress(64);
+
+	cbuf8_bench();
+}
@@ -0,0 +1,220 @@
+/**
+@file		test_fifo.c
+@brief		fifo host tests
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+*/
+
+#include <string.h>
+
+#include "mat/fifo.h"
+#include "test.h"
+
+#define FIFO_MAXELEM 12
+#define FIFO_MAXSIZE 17
+#define FIFO_ITER 200000
+#define FIFO_BENCH 1000000
+
+static uint8_t fifo_mem[FIFO_MAXSIZE * FIFO_MAXELEM];
+
+/** Reference model: elements wr - len .. wr - 1 are in the fifo */
+struct fifo_ref_t
+{
+	uint32_t wr;	/**< sequence number of the next element put */
+	uint32_t rd;	/**< sequence number of the next element expected */
+	uint32_t drop;	/**< elements dropped */
+};
+
+/**
+@brief Fill element d with a pattern derived from its sequence number.
+*/
+static void fifo_mk(uint8_t* d, const uint16_t e, const uint32_t i)
+{
+	uint16_t k;
+	for( k = 0; k < e; ++k ) {
+		d[k] = i * 7 + k;
+	}
+}
+
+/**
+@brief Check element d against the pattern for its sequence number.
+*/
+static uint8_t fifo_ok(const uint8_t* d, const uint16_t e, const uint32_t i)
+{
+	uint8_t x[FIFO_MAXELEM];
+	fifo_mk(x, e, i);
+	return memcmp(d, x, e) == 0;
+}
+
+/**
+@brief Model of inserting n elements into a fifo of s elements in mode m.
+
+While the oldest element is peeked (held), overwrite mode drops the new elements that do not fit.
+@return Number of elements inserted.
+*/
+static uint16_t fifo_ref_put(struct fifo_ref_t* r, const uint16_t s, const uint8_t m, const uint16_t n, const uint8_t held)
+{
+	uint32_t fr = s - (r->wr - r->rd);
+	uint16_t k = n;
+	if( n > fr ) {
+		if( (m == FIFO_OVERWRITE) && held ) {
+			r->drop += n - fr;
+			k = fr;
+		} else if( m == FIFO_OVERWRITE ) {
+			r->drop += n - fr;
+			r->rd = r->wr + n - s;	// only the last s elements are kept
+		} else {
+			k = fr;
+		}
+	}
+	r->wr += k;
+	return k;
+}
+
+/**
+@brief Random sequence of all fifo operations against the reference model.
+*/
+static void fifo_random(const uint16_t e, const uint16_t s, const uint8_t m, const uint32_t iter)
+{
+	volatile struct fifo_t f;
+	struct fifo_ref_t r = {0, 0, 0};
+	uint8_t d[(FIFO_MAXSIZE + 2) * FIFO_MAXELEM];
+	uint32_t it;
+
+	fifo_clear_m(&f, fifo_mem, s * e, e, m);
+
+	for( it = 0; it < iter; ++it ) {
+		uint16_t n = test_rand() % (s + 3);
+		uint16_t k, i;
+		uint8_t* p;
+
+		switch( test_rand() % 6 ) {
+		case 0:	// put
+			fifo_mk(d, e, r.wr);
+			k = fifo_ref_put(&r, s, m, 1, 0);
+			CHECK( fifo_put(&f, d) == k );
+			break;
+		case 1:	// get
+			k = fifo_get(&f, d);
+			CHECK( k == (r.wr != r.rd) );
+			if( k ) {
+				CHECK( fifo_ok(d, e, r.rd) );
+				r.rd++;
+			}
+			break;
+		case 2:	// put_n
+			for( i = 0; i < n; ++i ) { fifo_mk(d + i * e, e, r.wr + i); }
+			k = fifo_ref_put(&r, s, m, n, 0);
+			CHECK( fifo_put_n(&f, d, n) == (m == FIFO_OVERWRITE ? n : k) );
+			break;
+		case 3:	// get_n
+			k = r.wr - r.rd;
+			if( k > n ) { k = n; }
+			CHECK( fifo_get_n(&f, d, n) == k );
+			for( i = 0; i < k; ++i ) { CHECK( fifo_ok(d + i * e, e, r.rd + i) ); }
+			r.rd += k;
+			break;
+		case 4:	// reserve, commit
+			p = fifo_reserve(&f);
+			k = (r.wr - r.rd < s) || (m == FIFO_OVERWRITE);
+			CHECK( (p != 0) == k );
+			if( p ) {
+				fifo_mk(p, e, r.wr);
+				fifo_commit(&f);
+				fifo_ref_put(&r, s, m, 1, 0);
+			}
+			break;
+		case 5:	// peek, consume, with puts in between that must not drop the peeked element
+			p = fifo_peek(&f);
+			CHECK( (p != 0) == (r.wr != r.rd) );
+			if( p ) {
+				CHECK( fifo_ok(p, e, r.rd) );
+				if( test_rand() % 2 ) {
+					for( i = 0; i < n; ++i ) { fifo_mk(d + i * e, e, r.wr + i); }
+					k = fifo_ref_put(&r, s, m, n, 1);
+					CHECK( fifo_put_n(&f, d, n) == (m == FIFO_OVERWRITE ? n : k) );
+					uint8_t* q = fifo_reserve(&f);
+					CHECK( (q != 0) == (r.wr - r.rd < s) );
+					if( q ) {
+						fifo_mk(q, e, r.wr);
+						fifo_commit(&f);
+						fifo_ref_put(&r, s, m, 1, 1);
+					}
+					fifo_mk(d, e, r.wr);
+					k = fifo_ref_put(&r, s, m, 1, 1);
+					CHECK( fifo_put(&f, d) == (m == FIFO_OVERWRITE ? 1 : k) );
+					CHECK( fifo_ok(p, e, r.rd) );
+				}
+				fifo_consume(&f);
+				r.rd++;
+			}
+			break;
+		}
+
+		CHECK( f.len == r.wr - r.rd );
+		CHECK( f.drop == r.drop );
+		if( test_fails > 10 ) { return; }
+	}
+}
+
+/**
+@brief Time put and get of 4 byte elements, filling and draining a 64 element fifo.
+*/
+static void fifo_bench(void)
+{
+	volatile struct fifo_t f;
+	struct test_lat_t lp = {0, 0, 0}, lg = {0, 0, 0};
+	uint32_t d = 0, i, j;
+	uint64_t t;
+
+	fifo_clear(&f, fifo_mem, 64 * 4, 4);
+
+	t = test_ns();
+	for( i = 0; i < FIFO_BENCH / 32; ++i ) {
+		for( j = 0; j < 32; ++j ) { fifo_put(&f, &d); }
+		for( j = 0; j < 32; ++j ) { fifo_get(&f, &d); }
+	}
+	test_rate_print("put+get 4 B", FIFO_BENCH, test_ns() - t);
+
+	uint32_t b[16];
+	t = test_ns();
+	for( i = 0; i < FIFO_BENCH / 16; ++i ) {
+		fifo_put_n(&f, b, 16);
+		fifo_get_n(&f, b, 16);
+	}
+	test_rate_print("put_n+get_n 16x4 B (elems)", FIFO_BENCH, test_ns() - t);
+
+	for( i = 0; i < FIFO_BENCH / 32; ++i ) {
+		for( j = 0; j < 32; ++j ) {
+			t = test_ns();
+			fifo_put(&f, &d);
+			test_lat_add(&lp, t);
+		}
+		for( j = 0; j < 32; ++j ) {
+			t = test_ns();
+			fifo_get(&f, &d);
+			test_lat_add(&lg, t);
+		}
+	}
+	test_lat_print("put 4 B", &lp);
+	test_lat_print("get 4 B", &lg);
+}
+
+void test_fifo(void)
+{
+	static const uint16_t es[] = {1, 3, 4, 8, 12};
+	uint8_t i;
+	uint16_t s;
+
+	test_seed(1);
+	for( i = 0; i < sizeof(es) / sizeof(es[0]); ++i ) {
+		for( s = 1; s <= FIFO_MAXSIZE; s += 4 ) {
+			fifo_random(es[i], s, FIFO_BLOCK, FIFO_ITER / 20);
+			fifo_random(es[i], s, FIFO_OVERWRITE, FIFO_ITER / 20);
+		}
+	}
+	printf("  random interleavings        done\n");
+
+	fifo_bench();
+}
@@ -0,0 +1,149 @@
+/**
+@file		test_ftoa.c
+@brief		ftoa and qtoa host tests against snprintf
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+*/
+
+#include <string.h>
+#include <math.h>
+
+#include "mat/itoa.h"
+#include "test.h"
+
+#define FTOA_RAND 1000000
+
+static uint32_t ftoa_ties;
+
+/**
+@brief True if v * 10^prec lies exactly halfway between two integers.
+
+ftoa and qtoa round such ties half away from zero, glibc printf rounds them to even (2.5 -> "2",
+0.125 -> "0.12"), so these are the one known difference to snprintf and are only counted. Every
+float and every q value is exactly representable in a long double, so the test is exact.
+*/
+static uint8_t ftoa_tie(const double v, const uint8_t prec)
+{
+	long double x = fabsl((long double)v * powl(10, prec));
+	return x - floorl(x) == 0.5L;
+}
+
+/**
+@brief Magnitude of a decimal string in units of its last decimal (sign and point dropped).
+*/
+static uint64_t ftoa_digits(const char* s)
+{
+	uint64_t d = 0;
+	for( ; *s; ++s ) {
+		if( *s >= '0' && *s <= '9' ) { d = d * 10 + (*s - '0'); }
+	}
+	return d;
+}
+
+/**
+@brief Compare a conversion of v with prec decimals against snprintf.
+*/
+static void ftoa_chk(const char* s, const uint8_t n, const double v, const uint8_t prec)
+{
+	char r[FTOA_LEN + 16];
+
+	CHECK( n == strlen(s) && n < FTOA_LEN );
+	snprintf(r, sizeof(r), "%.*f", prec, v);
+	if( strcmp(s, r) == 0 ) { return; }
+
+	if( ftoa_tie(v, prec) ) {
+		++ftoa_ties;
+		// half away from zero: one in the last decimal above printf's magnitude
+		CHECK( ftoa_digits(s) == ftoa_digits(r) + 1 );
+	} else {
+		CHECK( 0 );
+		printf("  %a prec %u: %s, snprintf %s\n", v, prec, s, r);
+	}
+}
+
+/**
+@brief Convert float f and check the result.
+*/
+static void ftoa_val(const float f, const uint8_t prec)
+{
+	char s[FTOA_LEN];
+	uint8_t n = ftoa(f, s, prec);
+
+	if( isnan(f) ) {
+		CHECK( strcmp(s, "nan") == 0 && n == 3 );
+	} else if( isinf(f) ) {
+		CHECK( strcmp(s, f < 0 ? "-inf" : "inf") == 0 && n == strlen(s) );
+	} else if( fabsf(f) >= 18446744073709551616.0f ) {	// 2^64
+		CHECK( strcmp(s, f < 0 ? "-ovf" : "ovf") == 0 && n == strlen(s) );
+	} else {
+		ftoa_chk(s, n, f, prec);
+	}
+}
+
+void test_ftoa(void)
+{
+	static const struct { float f; uint8_t prec; const char* s; } known[] = {
+		{0.5f, 0, "1"}, {-2.5f, 0, "-3"}, {0.125f, 2, "0.13"}, {-1.25f, 1, "-1.3"},	// ties
+		{1.005f, 2, "1.00"}, {2.675f, 2, "2.67"}, {99.996f, 2, "100.00"}, {-0.0004f, 3, "-0.000"},
+		{-0.0f, 2, "-0.00"}, {1.4e-45f, 9, "0.000000000"}, {16777216.0f, 0, "16777216"}
+	};
+	char s[FTOA_LEN];
+	uint32_t i;
+	uint8_t prec;
+
+	ftoa_ties = 0;
+	for( i = 0; i < sizeof(known) / sizeof(known[0]); ++i ) {
+		CHECK( ftoa(known[i].f, s, known[i].prec) == strlen(known[i].s) && strcmp(s, known[i].s) == 0 );
+	}
+	CHECK( ftoa(1.0f, s, 12) == 11 );	// at most 9 decimals
+
+	test_seed(11);
+	for( prec = 0; prec <= 9; ++prec ) {
+		// special values and the largest and smallest of each binade
+		static const uint32_t bits[] = {0, 0x00000001, 0x007fffff, 0x00800000, 0x3f800000, 0x5f7fffff,
+			0x5f800000, 0x7f7fffff, 0x7f800000, 0x7fc00000};
+		for( i = 0; i < sizeof(bits) / sizeof(bits[0]); ++i ) {
+			union { uint32_t u; float f; } v = { bits[i] };
+			ftoa_val(v.f, prec);
+			v.u |= 0x80000000;
+			ftoa_val(v.f, prec);
+		}
+		for( i = 1; i < 254; ++i ) {
+			union { uint32_t u; float f; } v = { i << 23 };
+			ftoa_val(v.f, prec);
+			v.u |= 0x7fffff;
+			ftoa_val(v.f, prec);
+		}
+
+		for( i = 0; i < FTOA_RAND / 10; ++i ) {
+			// any bit pattern, and values in the usual range with short fractions
+			union { uint32_t u; float f; } v = { test_rand() };
+			ftoa_val(v.f, prec);
+			ftoa_val((int32_t)test_rand() / (float)(1 << (test_rand() % 24)), prec);
+
+			uint8_t q = test_rand() % 32;
+			int32_t x = test_rand();
+			x >>= test_rand() % 32;
+			uint8_t n = qtoa(x, q, s, prec);
+			ftoa_chk(s, n, ldexp(x, -q), prec);
+		}
+	}
+	CHECK( qtoa(INT32_MIN, 31, s, 2) == 5 && strcmp(s, "-1.00") == 0 );
+	CHECK( qtoa(INT32_MIN, 0, s, 0) == 11 && strcmp(s, "-2147483648") == 0 );
+	CHECK( qtoa(-1, 31, s, 9) == 12 && strcmp(s, "-0.000000000") == 0 );
+	printf("  prec 0..9 vs snprintf  done, %" PRIu32 " exact ties rounded away from zero\n", ftoa_ties);
+
+	// throughput against snprintf
+	uint64_t t;
+	uint32_t n = 0;
+	t = test_ns();
+	for( i = 0; i < FTOA_RAND; ++i ) { n += ftoa((int32_t)(i * 2654435761u) / 65536.0f, s, 3); }
+	t = test_ns() - t;
+	printf("  ftoa prec 3  %6.1f ns", (double)t / FTOA_RAND);
+	t = test_ns();
+	for( i = 0; i < FTOA_RAND; ++i ) { n += snprintf(s, sizeof(s), "%.3f", (double)((int32_t)(i * 2654435761u) / 65536.0f)); }
+	t = test_ns() - t;
+	printf("  snprintf %6.1f ns\n", (double)t / FTOA_RAND);
+	CHECK( n != 0 );
+}
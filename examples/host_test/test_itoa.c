@@ -0,0 +1,143 @@
+/**
+@file		test_itoa.c
+@brief		itoa host tests against snprintf and strtoull
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "mat/itoa.h"
+#include "test.h"
+
+#define ITOA_RAND 200000
+#define ITOA_BENCH 2000000
+
+/**
+@brief Check one converted string s of length n against value v in base b.
+@param[in]	s			String
+@param[in]	n			Returned length
+@param[in]	v			Value as unsigned (two's complement for negative values outside base 10)
+@param[in]	neg			Value is negative and converted with a sign
+@param[in]	b			Base
+@param[in]	lc			Lower case digits expected
+*/
+static void itoa_chk(const char* s, const uint8_t n, uint64_t v, const uint8_t neg, const uint8_t b, const uint8_t lc)
+{
+	char r[80];
+	char* e;
+
+	CHECK( n == strlen(s) );
+
+	// parse back
+	uint64_t p = strtoull(s + neg, &e, b);
+	CHECK( *e == 0 && p == v && (s[0] != '0' || n == 1) );	// no leading zeros
+	CHECK( (s[0] == '-') == neg );
+
+	// digit case
+	const char* c;
+	for( c = s; *c; ++c ) {
+		CHECK( lc ? !(*c >= 'A' && *c <= 'F') : !(*c >= 'a' && *c <= 'f') );
+	}
+
+	// printf where it has a conversion for the base
+	const char* f = (b == 8) ? "%s%llo" : (b == 10) ? "%s%llu" : (b == 16) ? (lc ? "%s%llx" : "%s%llX") : 0;
+	if( f ) {
+		snprintf(r, sizeof(r), f, neg ? "-" : "", (unsigned long long)v);
+		CHECK( strcmp(s, r) == 0 );
+	}
+	if( test_fails > 10 ) { exit(1); }
+}
+
+/**
+@brief Check all conversion routines for one value in one base.
+*/
+static void itoa_val(const uint64_t u, const uint8_t b)
+{
+	char s[80];
+	int64_t i = u;
+
+	itoa_chk(s, u64toa(u, s, b), u, 0, b, 0);
+	itoa_chk(s, i64toa(i, s, b), (b == 10 && i < 0) ? -(uint64_t)i : u, b == 10 && i < 0, b, 0);
+	ulltoa(u, s, b);
+	itoa_chk(s, strlen(s), u, 0, b, 0);
+
+	char* e = s + sizeof(s) - 1;
+	*e = 0;
+	char* p = u64toa_back(e, u, b, 1);
+	itoa_chk(p, e - p, u, 0, b, 1);
+
+	uint32_t u32 = u;
+	int32_t i32 = u32;
+	itoa_chk(s, u32toa(u32, s, b), u32, 0, b, 0);
+	itoa_chk(s, i32toa(i32, s, b), (b == 10 && i32 < 0) ? -(uint64_t)i32 : u32, b == 10 && i32 < 0, b, 0);
+	itoa(i32, s, b);
+	itoa_chk(s, strlen(s), (b == 10 && i32 < 0) ? -(uint64_t)i32 : u32, b == 10 && i32 < 0, b, 0);
+	utoa(u32, s, b);
+	itoa_chk(s, strlen(s), u32, 0, b, 0);
+}
+
+void test_itoa(void)
+{
+	static const uint64_t edge[] = {0, 1, INT32_MAX, (uint32_t)INT32_MIN, UINT32_MAX, (uint64_t)UINT32_MAX + 1,
+		INT64_MAX, (uint64_t)INT64_MIN, UINT64_MAX, (uint64_t)-1 << 32, 999999999, 1000000000, 4294967295999999999ull};
+	uint8_t b;
+	uint32_t i;
+	char s[80];
+
+	CHECK( u32toa(5, s, 1) == 0 && u32toa(5, s, 17) == 0 );	// invalid base
+
+	test_seed(7);
+	for( b = 2; b <= 16; ++b ) {
+		for( i = 0; i < sizeof(edge) / sizeof(edge[0]); ++i ) {
+			itoa_val(edge[i], b);
+			itoa_val(edge[i] - 1, b);
+		}
+
+		// powers of the base and their neighbours
+		uint64_t p = 1;
+		while( 1 ) {
+			itoa_val(p - 1, b);
+			itoa_val(p, b);
+			itoa_val(p + 1, b);
+			itoa_val(-p, b);
+			if( p > UINT64_MAX / b ) { break; }
+			p *= b;
+		}
+
+		// all 16 bit values, sign extended too
+		for( i = 0; i <= 0xffff; ++i ) {
+			itoa_val(i, b);
+			itoa_val((int16_t)i, b);
+		}
+
+		// random values of all lengths
+		for( i = 0; i < ITOA_RAND / 15; ++i ) {
+			uint64_t v = ((uint64_t)test_rand() << 32) | test_rand();
+			itoa_val(v >> (test_rand() % 64), b);
+		}
+	}
+	printf("  bases 2..16 vs snprintf, strtoull  done\n");
+
+	// throughput against snprintf
+	uint64_t t;
+	uint32_t n = 0;
+	static const uint8_t bases[] = {10, 16, 2, 7};
+	for( b = 0; b < sizeof(bases); ++b ) {
+		t = test_ns();
+		for( i = 0; i < ITOA_BENCH; ++i ) { n += i32toa(i * 2654435761u, s, bases[b]); }
+		t = test_ns() - t;
+		printf("  i32toa base %2u  %6.1f ns", bases[b], (double)t / ITOA_BENCH);
+		if( bases[b] == 10 || bases[b] == 16 ) {
+			t = test_ns();
+			for( i = 0; i < ITOA_BENCH; ++i ) { n += snprintf(s, sizeof(s), bases[b] == 10 ? "%d" : "%X", (int)(i * 2654435761u)); }
+			t = test_ns() - t;
+			printf("  snprintf %6.1f ns", (double)t / ITOA_BENCH);
+		}
+		printf("\n");
+	}
+	CHECK( n != 0 );
+}
@@ -0,0 +1,159 @@
+/**
+@file		test_mpfifo.c
+@brief		mpfifo host tests
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+*/
+
+#include <sched.h>
+#include <pthread.h>
+
+#include "mat/mpfifo.h"
+#include "test.h"
+
+#define MPFIFO_ITER 300000
+#define MPFIFO_BENCH 2000000
+#define MPFIFO_PROD 4
+#define MPFIFO_STRESS 500000	// elements per producer
+
+static uint32_t mpfifo_mem[MPFIFO_BUFSIZE(64, 8) / 4];
+
+/**
+@brief Random put/get sequence against the reference model.
+*/
+static void mpfifo_random(const uint16_t n)
+{
+	volatile struct mpfifo_t f;
+	uint32_t wr = 0, rd = 0, it;
+
+	CHECK( mpfifo_clear(&f, mpfifo_mem, MPFIFO_BUFSIZE(n, 8), 8) == n );
+
+	for( it = 0; it < MPFIFO_ITER; ++it ) {
+		uint32_t e[2];
+		if( test_rand() % 2 ) {
+			e[0] = wr;
+			e[1] = ~wr;
+			CHECK( mpfifo_put(&f, e) == (wr - rd < n) );
+			if( wr - rd < n ) { wr++; }
+		} else {
+			CHECK( mpfifo_get(&f, 0) == (wr != rd) );
+			CHECK( mpfifo_get(&f, e) == (wr != rd) );
+			if( wr != rd ) {
+				CHECK( e[0] == rd && e[1] == ~rd );
+				rd++;
+			}
+		}
+		if( test_fails > 10 ) { return; }
+	}
+}
+
+/**
+@brief Time put and get of 8 byte elements, filling and draining 32 of 64 slots.
+*/
+static void mpfifo_bench(void)
+{
+	volatile struct mpfifo_t f;
+	struct test_lat_t lp = {0, 0, 0}, lg = {0, 0, 0};
+	uint32_t e[2] = {0, 0}, i, j;
+	uint64_t t;
+
+	mpfifo_clear(&f, mpfifo_mem, sizeof(mpfifo_mem), 8);
+
+	t = test_ns();
+	for( i = 0; i < MPFIFO_BENCH / 32; ++i ) {
+		for( j = 0; j < 32; ++j ) { mpfifo_put(&f, e); }
+		for( j = 0; j < 32; ++j ) { mpfifo_get(&f, e); }
+	}
+	test_rate_print("put+get 8 B", MPFIFO_BENCH, test_ns() - t);
+
+	for( i = 0; i < MPFIFO_BENCH / 32; ++i ) {
+		for( j = 0; j < 32; ++j ) {
+			t = test_ns();
+			mpfifo_put(&f, e);
+			test_lat_add(&lp, t);
+		}
+		for( j = 0; j < 32; ++j ) {
+			t = test_ns();
+			mpfifo_get(&f, e);
+			test_lat_add(&lg, t);
+		}
+	}
+	test_lat_print("put 8 B", &lp);
+	test_lat_print("get 8 B", &lg);
+}
+
+static volatile struct mpfifo_t mpfifo_q;
+
+/**
+@brief Producer thread, puts MPFIFO_STRESS elements tagged with its number.
+*/
+static void* mpfifo_producer(void* a)
+{
+	uint32_t e[2] = {(uintptr_t)a, 0};
+
+	while( e[1] < MPFIFO_STRESS ) {
+		if( mpfifo_put(&mpfifo_q, e) ) {
+			e[1]++;
+		} else {
+			sched_yield();
+		}
+	}
+	return 0;
+}
+
+/**
+@brief MPFIFO_PROD producer threads and the consumer, each producer's elements must come out in order.
+*/
+static void mpfifo_stress(const uint16_t n)
+{
+	pthread_t t[MPFIFO_PROD];
+	uint32_t next[MPFIFO_PROD] = {0}, got = 0, e[2];
+	uintptr_t i;
+	uint64_t t0 = test_ns();
+
+	mpfifo_clear(&mpfifo_q, mpfifo_mem, MPFIFO_BUFSIZE(n, 8), 8);
+	for( i = 0; i < MPFIFO_PROD; ++i ) {
+		CHECK( pthread_create(&t[i], 0, mpfifo_producer, (void*)i) == 0 );
+	}
+
+	while( got < MPFIFO_PROD * MPFIFO_STRESS && test_fails < 10 ) {
+		if( mpfifo_get(&mpfifo_q, e) ) {
+			CHECK( e[0] < MPFIFO_PROD && e[1] == next[e[0] % MPFIFO_PROD] );
+			next[e[0] % MPFIFO_PROD]++;
+			got++;
+		} else {
+			sched_yield();
+		}
+	}
+
+	for( i = 0; i < MPFIFO_PROD; ++i ) { pthread_join(t[i], 0); }
+	CHECK( got == MPFIFO_PROD * MPFIFO_STRESS && !mpfifo_get(&mpfifo_q, 0) );
+
+	char name[32];
+	snprintf(name, sizeof(name), "%u producers, %u slots", MPFIFO_PROD, n);
+	test_rate_print(name, got, test_ns() - t0);
+}
+
+void test_mpfifo(void)
+{
+	uint16_t n;
+
+	test_seed(4);
+	for( n = 2; n <= 64; n <<= 1 ) {
+		mpfifo_random(n);
+	}
+	printf("  random interleavings        done\n");
+
+	for( n = 0; n < 2; ++n ) {	// buffer for less than two slots
+		volatile struct mpfifo_t f;
+		uint32_t e[2] = {0, 0};
+		CHECK( mpfifo_clear(&f, mpfifo_mem, MPFIFO_BUFSIZE(n, 8) + 4, 8) == 0 );
+		CHECK( !mpfifo_put(&f, e) && !mpfifo_get(&f, e) && !mpfifo_get(&f, 0) );
+	}
+
+	mpfifo_stress(2);
+	mpfifo_stress(16);
+
+	mpfifo_bench();
+}
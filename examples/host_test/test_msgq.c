@@ -0,0 +1,277 @@
+/**
+@file		test_msgq.c
+@brief		msgq host tests
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+*/
+
+#include <string.h>
+
+#include "mat/msgq.h"
+#include "test.h"
+
+#define MSGQ_MAXSIZE 301
+#define MSGQ_ITER 200000
+#define MSGQ_BENCH 1000000
+#define MSGQ_NONE 0xffff
+
+static uint8_t msgq_mem[MSGQ_MAXSIZE];
+
+/** Reference model: records rd .. wr - 1 are in the queue, at the positions the layout rules give */
+struct msgq_ref_t
+{
+	uint16_t pos[256];	/**< header position of each record, by sequence number */
+	uint16_t len[256];	/**< length of each record, by sequence number */
+	uint32_t wr;	/**< sequence number of the next record put */
+	uint32_t rd;	/**< sequence number of the next record expected */
+	uint32_t drop;	/**< records dropped */
+	uint32_t pads;	/**< records placed at the start with a padding header before the end */
+	uint32_t tails;	/**< records placed at the start with 1 byte before the end, too short for a header */
+};
+
+/**
+@brief Fill a record with a pattern derived from its sequence number.
+*/
+static void msgq_mk(uint8_t* d, const uint16_t n, const uint32_t i)
+{
+	uint16_t k;
+	for( k = 0; k < n; ++k ) {
+		d[k] = i * 31 + k;
+	}
+}
+
+/**
+@brief Check a record against the pattern for its sequence number.
+*/
+static uint8_t msgq_ok(const uint8_t* d, const uint16_t n, const uint32_t i)
+{
+	uint16_t k;
+	for( k = 0; k < n; ++k ) {
+		if( d[k] != (uint8_t)(i * 31 + k) ) { return 0; }
+	}
+	return 1;
+}
+
+/**
+@brief Where a record of n bytes goes in a queue of s bytes: after the newest record if it fits
+before the end of the buffer (not wrapped) or before the oldest one (wrapped), else at the start
+if it fits before the oldest one.
+@return Header position, MSGQ_NONE if there is no room.
+*/
+static uint16_t msgq_ref_fit(struct msgq_ref_t* r, const uint16_t s, const uint16_t n)
+{
+	uint32_t need = MSGQ_HDR + n;
+	if( need > s ) { return MSGQ_NONE; }
+	if( r->wr == r->rd ) { return 0; }
+
+	uint16_t h = r->pos[r->rd & 255];
+	uint16_t l = r->pos[(r->wr - 1) & 255];
+	uint32_t t = l + MSGQ_HDR + r->len[(r->wr - 1) & 255];
+
+	if( l >= h ) {
+		if( t + need <= s ) { return t; }
+		if( need <= h ) {
+			if( s - t >= MSGQ_HDR ) {
+				r->pads++;
+			} else if( s - t ) {
+				r->tails++;
+			}
+			return 0;
+		}
+		return MSGQ_NONE;
+	}
+	return (t + need <= h) ? t : MSGQ_NONE;
+}
+
+/**
+@brief Room for a record, dropping the oldest records in MSGQ_OVERWRITE mode unless held by a peek.
+*/
+static uint16_t msgq_ref_alloc(struct msgq_ref_t* r, const uint16_t s, const uint8_t m, const uint16_t n, const uint8_t held)
+{
+	uint16_t p = msgq_ref_fit(r, s, n);
+	while( (p == MSGQ_NONE) && (m == MSGQ_OVERWRITE) && (r->wr != r->rd) && !held && (MSGQ_HDR + n <= s) ) {
+		r->rd++;
+		r->drop++;
+		p = msgq_ref_fit(r, s, n);
+	}
+	return p;
+}
+
+/**
+@brief Model of msgq_put.
+@return msgq_put's expected return value.
+*/
+static uint8_t msgq_ref_put(struct msgq_ref_t* r, const uint16_t s, const uint8_t m, const uint16_t n, const uint8_t held)
+{
+	uint16_t p = msgq_ref_alloc(r, s, m, n, held);
+	if( p == MSGQ_NONE ) {
+		if( (m == MSGQ_OVERWRITE) && held && (MSGQ_HDR + n <= s) ) {
+			r->drop++;
+			return 1;
+		}
+		return 0;
+	}
+	r->pos[r->wr & 255] = p;
+	r->len[r->wr & 255] = n;
+	r->wr++;
+	return 1;
+}
+
+/**
+@brief Random record length, mostly short, sometimes up to and over the buffer size.
+*/
+static uint16_t msgq_rlen(const uint16_t s)
+{
+	switch( test_rand() % 8 ) {
+	case 0: return test_rand() % (s + 4);
+	case 1: return test_rand() % 3;
+	default: return test_rand() % (s / 4 + 1);
+	}
+}
+
+/**
+@brief Random sequence of all msgq operations against the reference model.
+*/
+static void msgq_random(const uint16_t s, const uint8_t m, const uint32_t iter, struct msgq_ref_t* r)
+{
+	volatile struct msgq_t q;
+	uint8_t d[MSGQ_MAXSIZE + 8];
+	uint32_t it;
+
+	memset(r, 0, sizeof(*r));
+	msgq_clear_m(&q, msgq_mem, s, m);
+
+	for( it = 0; it < iter; ++it ) {
+		uint16_t n = msgq_rlen(s);
+		uint16_t k, l;
+		uint8_t* p;
+
+		switch( test_rand() % 5 ) {
+		case 0:	// put
+			msgq_mk(d, n, r->wr);
+			k = msgq_ref_put(r, s, m, n, 0);
+			CHECK( msgq_put(&q, d, n) == k );
+			break;
+		case 1:	// get, into a buffer that may be too short
+			l = test_rand() % (s + 1);
+			k = l;
+			if( msgq_get(&q, d, &k) ) {
+				CHECK( r->wr != r->rd );
+				CHECK( k == r->len[r->rd & 255] );
+				CHECK( msgq_ok(d, (k < l) ? k : l, r->rd) );
+				r->rd++;
+			} else {
+				CHECK( r->wr == r->rd );
+			}
+			break;
+		case 2:	// reserve, commit up to n bytes, maybe with a get in between
+			l = msgq_ref_alloc(r, s, m, n, 0);
+			p = msgq_reserve(&q, n);
+			CHECK( (p != 0) == (l != MSGQ_NONE) );
+			if( test_rand() % 4 == 0 ) {
+				k = sizeof(d);
+				if( msgq_get(&q, d, &k) ) {
+					CHECK( msgq_ok(d, k, r->rd) );
+					r->rd++;
+				}
+			}
+			if( p ) {
+				CHECK( p == msgq_mem + l + MSGQ_HDR );
+				k = n ? test_rand() % (n + 1) : 0;
+				msgq_mk(p, k, r->wr);
+				msgq_commit(&q, k);
+				r->pos[r->wr & 255] = l;
+				r->len[r->wr & 255] = k;
+				r->wr++;
+			}
+			break;
+		case 3:	// peek, drop, with puts in between that must not drop the peeked record
+			p = msgq_peek(&q, &k);
+			CHECK( (p != 0) == (r->wr != r->rd) );
+			if( p ) {
+				CHECK( p == msgq_mem + r->pos[r->rd & 255] + MSGQ_HDR );
+				CHECK( k == r->len[r->rd & 255] && msgq_ok(p, k, r->rd) );
+				if( test_rand() % 2 ) {
+					msgq_mk(d, n, r->wr);
+					l = msgq_ref_put(r, s, m, n, 1);
+					CHECK( msgq_put(&q, d, n) == l );
+					CHECK( msgq_ok(p, k, r->rd) );
+				}
+				CHECK( msgq_drop(&q) );
+				r->rd++;
+			} else {
+				CHECK( !msgq_drop(&q) );
+			}
+			break;
+		case 4:	// empty it now and then, so all start positions occur
+			if( test_rand() % 16 == 0 ) {
+				while( msgq_drop(&q) ) { r->rd++; }
+			}
+			break;
+		}
+
+		CHECK( msgq_count(&q) == r->wr - r->rd );
+		CHECK( q.drop == r->drop );
+		if( test_fails > 10 ) { return; }
+	}
+}
+
+/**
+@brief Time put and get of 16 byte records, filling and draining a 1 kB queue.
+*/
+static void msgq_bench(void)
+{
+	static uint8_t buf[1024];
+	volatile struct msgq_t q;
+	uint8_t d[16];
+	uint16_t n;
+	uint32_t i, j;
+	uint64_t t;
+
+	memset(d, 0, sizeof(d));
+	msgq_clear(&q, buf, sizeof(buf));
+
+	t = test_ns();
+	for( i = 0; i < MSGQ_BENCH / 32; ++i ) {
+		for( j = 0; j < 32; ++j ) { msgq_put(&q, d, sizeof(d)); }
+		for( j = 0; j < 32; ++j ) { n = sizeof(d); msgq_get(&q, d, &n); }
+	}
+	test_rate_print("put+get 16 B", MSGQ_BENCH, test_ns() - t);
+
+	t = test_ns();
+	for( i = 0; i < MSGQ_BENCH / 32; ++i ) {
+		for( j = 0; j < 32; ++j ) {
+			uint8_t* p = msgq_reserve(&q, sizeof(d));
+			memcpy(p, d, sizeof(d));
+			msgq_commit(&q, sizeof(d));
+		}
+		for( j = 0; j < 32; ++j ) {
+			uint8_t* p = msgq_peek(&q, &n);
+			memcpy(d, p, n);
+			msgq_drop(&q);
+		}
+	}
+	test_rate_print("reserve+peek 16 B", MSGQ_BENCH, test_ns() - t);
+}
+
+void test_msgq(void)
+{
+	struct msgq_ref_t r;
+	uint32_t pads = 0, tails = 0;
+	uint16_t s;
+
+	test_seed(13);
+	for( s = 2; s <= MSGQ_MAXSIZE; s += 11 ) {
+		msgq_random(s, MSGQ_BLOCK, MSGQ_ITER / 20, &r);
+		pads += r.pads;
+		tails += r.tails;
+		msgq_random(s, MSGQ_OVERWRITE, MSGQ_ITER / 20, &r);
+		pads += r.pads;
+		tails += r.tails;
+	}
+	CHECK( pads && tails );	// both kinds of padding at the wrap occurred
+	printf("  random interleavings        done, %" PRIu32 " padded wraps, %" PRIu32 " 1 byte tails\n", pads, tails);
+
+	msgq_bench();
+}
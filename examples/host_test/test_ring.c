@@ -0,0 +1,154 @@
+/**
+@file		test_ring.c
+@brief		DECLARE_RING host tests
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+*/
+
+#include <string.h>
+
+#include "mat/ring.h"
+#include "mat/fifo.h"
+#include "test.h"
+
+#define RING_ITER 300000	// more than 65536 puts, so the free running counters wrap
+#define RING_BENCH 4000000
+
+struct ring_ev_t
+{
+	uint32_t seq;
+	uint16_t chk;
+};
+
+DECLARE_RING(evq, struct ring_ev_t, 16)
+DECLARE_RING(evq1, struct ring_ev_t, 1)
+DECLARE_RING(bigq, uint8_t, 32768)
+
+static evq_t ev;
+static evq1_t ev1;
+static bigq_t big;
+
+/**
+@brief Random put/get sequence against the reference model, for any ring of struct ring_ev_t.
+*/
+#define RING_RANDOM(name, r, size) \
+do { \
+	uint32_t wr = 0, rd = 0, it; \
+	name##_clear(r); \
+	for( it = 0; it < RING_ITER; ++it ) { \
+		struct ring_ev_t e; \
+		if( test_rand() % 2 ) { \
+			e.seq = wr; \
+			e.chk = ~wr; \
+			CHECK( name##_put(r, &e) == (wr - rd < (size)) ); \
+			if( wr - rd < (size) ) { wr++; } \
+		} else { \
+			CHECK( name##_get(r, 0) == (wr != rd) ); \
+			CHECK( name##_get(r, &e) == (wr != rd) ); \
+			if( wr != rd ) { \
+				CHECK( e.seq == rd && e.chk == (uint16_t)~rd ); \
+				rd++; \
+			} \
+		} \
+		CHECK( name##_len(r) == wr - rd ); \
+		if( test_fails > 10 ) { break; } \
+	} \
+} while(0)
+
+/**
+@brief Time put and get, filling and draining 8 of 16 slots.
+*/
+static void ring_bench(void)
+{
+	struct test_lat_t lp = {0, 0, 0}, lg = {0, 0, 0};
+	struct ring_ev_t e = {0, 0};
+	uint32_t i, j;
+	uint64_t t;
+
+	evq_clear(&ev);
+
+	t = test_ns();
+	for( i = 0; i < RING_BENCH / 8; ++i ) {
+		for( j = 0; j < 8; ++j ) { evq_put(&ev, &e); }
+		for( j = 0; j < 8; ++j ) { evq_get(&ev, &e); }
+	}
+	test_rate_print("put+get 8 B", RING_BENCH, test_ns() - t);
+
+	for( i = 0; i < RING_BENCH / 8; ++i ) {
+		for( j = 0; j < 8; ++j ) {
+			t = test_ns();
+			evq_put(&ev, &e);
+			test_lat_add(&lp, t);
+		}
+		for( j = 0; j < 8; ++j ) {
+			t = test_ns();
+			evq_get(&ev, &e);
+			test_lat_add(&lg, t);
+		}
+	}
+	test_lat_print("put 8 B", &lp);
+	test_lat_print("get 8 B", &lg);
+}
+
+/**
+@brief Same workload through DECLARE_RING and fifo, for element types of several sizes.
+
+On the host the fifo times include the emulated interrupt masking (a mutex), which costs more than
+on the target, so the ratio is an upper bound.
+*/
+#define RING_VS_FIFO(name, type, label) \
+do { \
+	static name##_t r; \
+	static type fb[16]; \
+	volatile struct fifo_t f; \
+	type e; \
+	uint32_t i, j; \
+	uint64_t t, tr, tf; \
+	memset(&e, 0, sizeof(e)); \
+	name##_clear(&r); \
+	fifo_clear(&f, fb, sizeof(fb), sizeof(type)); \
+	t = test_ns(); \
+	for( i = 0; i < RING_BENCH / 8; ++i ) { \
+		for( j = 0; j < 8; ++j ) { name##_put(&r, &e); } \
+		for( j = 0; j < 8; ++j ) { name##_get(&r, &e); } \
+	} \
+	tr = test_ns() - t; \
+	t = test_ns(); \
+	for( i = 0; i < RING_BENCH / 8; ++i ) { \
+		for( j = 0; j < 8; ++j ) { fifo_put(&f, &e); } \
+		for( j = 0; j < 8; ++j ) { fifo_get(&f, &e); } \
+	} \
+	tf = test_ns() - t; \
+	printf("  put+get %-6s ring %7.2f Mops/s  fifo %7.2f Mops/s  x%.1f\n", label, \
+		RING_BENCH * 1000.0 / tr, RING_BENCH * 1000.0 / tf, (double)tf / tr); \
+} while(0)
+
+DECLARE_RING(r1q, uint8_t, 16)
+DECLARE_RING(r4q, uint32_t, 16)
+DECLARE_RING(r8q, struct ring_ev_t, 16)
+struct ring_blk_t { uint32_t w[8]; };
+DECLARE_RING(r32q, struct ring_blk_t, 16)
+
+void test_ring(void)
+{
+	test_seed(3);
+	RING_RANDOM(evq, &ev, 16);
+	RING_RANDOM(evq1, &ev1, 1);
+
+	uint8_t b = 0;
+	uint32_t n = 0;
+	bigq_clear(&big);
+	while( bigq_put(&big, &b) ) { b = ++n; }
+	CHECK( n == 32768 && bigq_len(&big) == 32768 );	// a full ring of the largest size is told from an empty one
+	for( n = 0; bigq_get(&big, &b); ++n ) { CHECK( b == (uint8_t)n ); }
+	CHECK( n == 32768 && bigq_len(&big) == 0 );
+	printf("  random interleavings        done\n");
+
+	ring_bench();
+
+	RING_VS_FIFO(r1q, uint8_t, "1 B");
+	RING_VS_FIFO(r4q, uint32_t, "4 B");
+	RING_VS_FIFO(r8q, struct ring_ev_t, "8 B");
+	RING_VS_FIFO(r32q, struct ring_blk_t, "32 B");
+}
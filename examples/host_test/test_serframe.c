@@ -0,0 +1,138 @@
+/**
+@file		test_serframe.c
+@brief		serframe COBS/CRC host tests
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+*/
+
+#include <string.h>
+
+#include "mat/serframe.h"
+#include "test.h"
+
+#define SFR_MAXLEN 700	// several COBS blocks
+#define SFR_ITER 20000
+#define SFR_BENCH 2000000	// payload bytes per length
+
+/**
+@brief Bitwise CRC-16/CCITT (poly 0x1021, MSB first) to check the table free sfr_crc16 against.
+*/
+static uint16_t sfr_crc_ref(uint16_t crc, const uint8_t* p, uint16_t n)
+{
+	while( n-- ) {
+		uint8_t k;
+		crc ^= *p++ << 8;
+		for( k = 0; k < 8; ++k ) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+/**
+@brief Random payload, with runs of zeros and of non zero bytes so all COBS block kinds occur.
+*/
+static void sfr_payload(uint8_t* p, const uint16_t n)
+{
+	uint16_t i = 0;
+	while( i < n ) {
+		uint16_t r = 1 + test_rand() % 300;
+		uint8_t z = test_rand() % 3;
+		for( ; r && (i < n); --r, ++i ) {
+			p[i] = (z == 0) ? 0 : (z == 1) ? 1 + test_rand() % 255 : test_rand();
+		}
+	}
+}
+
+/**
+@brief Encode, check the encoding, decode and compare, then check that corruption is detected.
+*/
+static void sfr_roundtrip(const uint16_t n)
+{
+	uint8_t p[SFR_MAXLEN], e[SFR_ENCLEN(SFR_MAXLEN)], d[SFR_ENCLEN(SFR_MAXLEN)], ch;
+	uint8_t c = test_rand();
+
+	sfr_payload(p, n);
+	uint16_t l = sfr_encode(e, c, p, n);
+	CHECK( l <= SFR_ENCLEN(n) && e[l-1] == 0 && memchr(e, 0, l - 1) == 0 );
+
+	memcpy(d, e, l);
+	CHECK( sfr_decode(d, l, &ch) == n && ch == c && memcmp(d, p, n) == 0 );
+	memcpy(d, e, l);
+	CHECK( sfr_decode(d, l - 1, &ch) == n );	// without delimiter
+
+	// any single bit error, including one that makes a zero, must be detected
+	uint16_t i = test_rand() % (l - 1);
+	memcpy(d, e, l);
+	d[i] ^= 1 << (test_rand() % 8);
+	uint16_t r = sfr_decode(d, l, &ch);
+	CHECK( r == SFR_EBAD || r == SFR_ECRC );
+
+	// as must a truncated frame, unless only the empty block after a full one (code 1) was cut off
+	uint16_t t = 1 + test_rand() % (l - 2);
+	memcpy(d, e, l);
+	r = sfr_decode(d, t, &ch);
+	CHECK( r == SFR_EBAD || r == SFR_ECRC || ((t == l - 2) && (e[t] == 1) && (r == n)) );
+}
+
+/**
+@brief Encode and decode throughput for one payload length.
+*/
+static void sfr_bench(const uint16_t n)
+{
+	uint8_t p[SFR_MAXLEN], e[SFR_ENCLEN(SFR_MAXLEN)], d[SFR_ENCLEN(SFR_MAXLEN)], ch;
+	uint32_t i, k = SFR_BENCH / n;
+	uint16_t l = 0;
+	uint64_t t, te, td;
+
+	sfr_payload(p, n);
+
+	t = test_ns();
+	for( i = 0; i < k; ++i ) {
+		p[0] = i;
+		l = sfr_encode(e, 1, p, n);
+	}
+	te = test_ns() - t;
+
+	// decoding is in place, so each frame is copied first, the copying is timed separately
+	uint32_t ok = 0;
+	t = test_ns();
+	for( i = 0; i < k; ++i ) {
+		memcpy(d, e, l);
+		ok += sfr_decode(d, l, &ch) == n;
+	}
+	td = test_ns() - t;
+	t = test_ns();
+	for( i = 0; i < k; ++i ) {
+		memcpy(d, e, l);
+		__asm__ volatile("" : : "r"(d) : "memory");	// keep the copy
+	}
+	td -= test_ns() - t;
+	CHECK( ok == k );
+
+	printf("  %4u B  encode %6.1f MB/s %6.0f ns/frame  decode %6.1f MB/s %6.0f ns/frame\n", n,
+		(double)k * n * 1000 / te, (double)te / k, (double)k * n * 1000 / td, (double)td / k);
+}
+
+void test_serframe(void)
+{
+	uint8_t b[256];
+	uint16_t i;
+
+	test_seed(6);
+	for( i = 0; i < sizeof(b); ++i ) { b[i] = test_rand(); }
+	CHECK( sfr_crc16(0xffff, "123456789", 9) == 0x29b1 );
+	for( i = 0; i < sizeof(b); ++i ) { CHECK( sfr_crc16(0xffff, b, i) == sfr_crc_ref(0xffff, b, i) ); }
+
+	for( i = 0; i < SFR_ITER; ++i ) {
+		sfr_roundtrip((i < SFR_MAXLEN) ? i : test_rand() % SFR_MAXLEN);
+		if( test_fails > 10 ) { return; }
+	}
+	printf("  COBS/CRC round trip         done\n");
+
+	sfr_bench(8);
+	sfr_bench(64);
+	sfr_bench(250);
+	sfr_bench(600);
+}
@@ -0,0 +1,325 @@
+/**
+@file		test_serialq.c
+@brief		serialq host tests, with the USART and DMA played by the test
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+*/
+
+#include <string.h>
+
+#include "mat/serialq.h"
+#include "test.h"
+
+#define SQ_TXS 61	// odd, so DMA spans of all lengths occur
+#define SQ_RXS 64
+#define SQ_WIRE (1 << 20)
+#define SQ_ITER 200000
+
+void USART1_IRQHandler(void);
+void USART2_IRQHandler(void);
+void DMA1_Channel4_IRQHandler(void);
+void DMA1_Channel5_IRQHandler(void);
+extern void (*host_usart_tx)(USART_TypeDef* usart, uint16_t d);
+
+static uint8_t sq_txb[2][SQ_TXS];
+static uint8_t sq_rxb[2][SQ_RXS];
+
+/** Bytes sent on the wire of USART1 and USART2 */
+static uint8_t sq_wire[2][SQ_WIRE];
+static uint32_t sq_wn[2];
+
+/** TX DMA channel model */
+struct sq_dma_t
+{
+	DMA_Channel_TypeDef* ch;	/**< channel registers */
+	void (*irq)(void);	/**< channel interrupt handler */
+	uint8_t* p;	/**< memory address latched at transfer start */
+	uint16_t n;	/**< length latched at transfer start */
+	uint16_t i;	/**< bytes transferred */
+	uint8_t active;	/**< transfer in progress */
+	uint32_t spans;	/**< number of transfers */
+	uint32_t wraps;	/**< number of transfers ending at the end of the TX buffer */
+};
+
+static struct sq_dma_t sq_txdma = {DMA1_Channel4, DMA1_Channel4_IRQHandler};
+
+/**
+@brief Byte value for a sequence number.
+*/
+static inline uint8_t sq_mk(const uint32_t i)
+{
+	return i ^ (i >> 8) ^ (i >> 16);
+}
+
+/**
+@brief host_usart_tx hook, record a transmitted byte.
+*/
+static void sq_wire_put(USART_TypeDef* usart, uint16_t d)
+{
+	uint8_t w = usart - USART1;
+	if( (w < 2) && (sq_wn[w] < SQ_WIRE) ) { sq_wire[w][sq_wn[w]++] = d; }
+}
+
+/**
+@brief USART1 sends one byte taken by its TX DMA channel.
+@return True if a byte was sent.
+*/
+static uint8_t sq_txdma_tick(struct sq_dma_t* d)
+{
+	DMA_Channel_TypeDef* ch = d->ch;
+
+	if( !(ch->CCR & DMA_CCR1_EN) || !(USART1->CR3 & USART_CR3_DMAT) ) { return 0; }
+	if( !d->active ) {
+		if( ch->CNDTR == 0 ) { return 0; }
+		d->p = (uint8_t*)(uintptr_t)ch->CMAR;
+		d->n = ch->CNDTR;
+		d->i = 0;
+		d->active = 1;
+		d->spans++;
+		CHECK( d->p >= sq_txb[0] && d->p + d->n <= sq_txb[0] + SQ_TXS );	// span inside the TX buffer
+		if( d->p + d->n == sq_txb[0] + SQ_TXS ) { d->wraps++; }
+	}
+
+	sq_wire_put(USART1, d->p[d->i++]);
+	if( --ch->CNDTR == 0 ) {
+		d->active = 0;
+		if( ch->CCR & DMA_CCR1_TCIE ) { d->irq(); }
+	}
+	return 1;
+}
+
+/**
+@brief USART2 sends one byte, if its TXE interrupt is enabled.
+@return True if a byte was sent.
+*/
+static uint8_t sq_txirq_tick(void)
+{
+	uint32_t n = sq_wn[1];
+	if( (USART2->CR1 & USART_CR1_TXEIE) && (USART2->SR & USART_SR_TXE) ) { USART2_IRQHandler(); }
+	return sq_wn[1] != n;
+}
+
+/**
+@brief Send everything queued on both ports.
+*/
+static void sq_drain(void)
+{
+	while( sq_txdma_tick(&sq_txdma) | sq_txirq_tick() );
+	CHECK( ser_txdone(1) && ser_txdone(2) );
+}
+
+/**
+@brief Random non blocking writes on both ports interleaved with transmission.
+*/
+static void sq_tx_random(void)
+{
+	uint32_t seq[2] = {0, 0}, it;
+	uint8_t d[24];
+
+	sq_wn[0] = sq_wn[1] = 0;
+	sq_txdma.spans = sq_txdma.wraps = 0;
+
+	for( it = 0; it < SQ_ITER; ++it ) {
+		uint8_t w = test_rand() % 2;
+		uint16_t n = test_rand() % sizeof(d), i, f, k;
+
+		switch( test_rand() % 4 ) {
+		case 0:	// write as much as fits
+			for( i = 0; i < n; ++i ) { d[i] = sq_mk(seq[w] + i); }
+			f = ser_txfree(w + 1);
+			k = ser_write(w + 1, d, n);
+			CHECK( k == (n < f ? n : f) );
+			seq[w] += k;
+			break;
+		case 1:	// single byte
+			f = ser_txfree(w + 1);
+			k = ser_try_putc(w + 1, sq_mk(seq[w]));
+			CHECK( k == (f != 0) );
+			seq[w] += k;
+			break;
+		default:	// let both ports send some bytes
+			for( i = 0; i < n; ++i ) {
+				sq_txdma_tick(&sq_txdma);
+				sq_txirq_tick();
+			}
+			break;
+		}
+		if( test_fails > 10 ) { return; }
+	}
+	sq_drain();
+
+	for( it = 0; it < 2; ++it ) {
+		uint32_t i;
+		CHECK( sq_wn[it] == seq[it] );
+		for( i = 0; (i < sq_wn[it]) && (sq_wire[it][i] == sq_mk(i)); ++i );
+		CHECK( i == sq_wn[it] );
+	}
+	CHECK( sq_txdma.wraps > 0 && sq_txdma.spans > sq_txdma.wraps );
+	printf("  TX DMA span chaining        %" PRIu32 " bytes in %" PRIu32 " spans, %" PRIu32 " at buffer end\n",
+		sq_wn[0], sq_txdma.spans, sq_txdma.wraps);
+}
+
+/**
+@brief TX queue in CBUF8_OVERWRITE mode, write three times the queue size without sending.
+@param[in]	devnum		1 (DMA) or 2 (interrupt)
+*/
+static void sq_tx_overwrite(const uint8_t devnum)
+{
+	uint8_t d[3 * SQ_TXS];
+	uint16_t i;
+	uint8_t w = devnum - 1;
+
+	for( i = 0; i < sizeof(d); ++i ) { d[i] = sq_mk(i); }
+
+#if !defined(CBUF8_SPSC)
+	if( devnum == 1 ) {	// queued bytes are read by the DMA in place, the oldest can not be dropped
+		CHECK( ser_txmode(devnum, CBUF8_OVERWRITE) == 0 );
+		CHECK( ser_write(devnum, d, sizeof(d)) == SQ_TXS );
+		sq_drain();
+		CHECK( ser_txdrop(devnum) == 0 );
+		return;
+	}
+#endif
+	CHECK( ser_txmode(devnum, CBUF8_OVERWRITE) == 1 );
+	sq_wn[w] = 0;
+	CHECK( ser_write(devnum, d, sizeof(d)) == sizeof(d) );
+	sq_drain();
+
+#ifdef CBUF8_SPSC
+	// new bytes are dropped, the first ones that fit are sent
+	CHECK( sq_wn[w] == SQ_TXS - 1 && memcmp(sq_wire[w], d, sq_wn[w]) == 0 );
+#else
+	// oldest bytes are dropped, the last ones are sent
+	CHECK( sq_wn[w] == SQ_TXS && memcmp(sq_wire[w], d + sizeof(d) - SQ_TXS, sq_wn[w]) == 0 );
+#endif
+	CHECK( ser_txdrop(devnum) == sizeof(d) - sq_wn[w] );
+	CHECK( ser_txmode(devnum, CBUF8_BLOCK) == 1 );
+}
+
+#ifdef SER_RX_DMA
+/**
+@brief USART1 receives a byte, its circular RX DMA channel writes it to the RX buffer.
+*/
+static void sq_rxdma_put(const uint8_t b)
+{
+	DMA_Channel_TypeDef* ch = DMA1_Channel5;
+
+	if( !(ch->CCR & DMA_CCR1_EN) || !(USART1->CR3 & USART_CR3_DMAR) ) { return; }
+	((uint8_t*)(uintptr_t)ch->CMAR)[SQ_RXS - ch->CNDTR] = b;
+	if( --ch->CNDTR == SQ_RXS / 2 ) {
+		if( ch->CCR & DMA_CCR1_HTIE ) { DMA1_Channel5_IRQHandler(); }
+	} else
+	if( ch->CNDTR == 0 ) {
+		ch->CNDTR = SQ_RXS;	// circular, reloaded before the interrupt
+		if( ch->CCR & DMA_CCR1_TCIE ) { DMA1_Channel5_IRQHandler(); }
+	}
+}
+
+#ifdef SER_RX_DELIM
+/**
+@brief Number of SER_RX_DELIM bytes in the sequence from i to e.
+*/
+static uint16_t sq_delims(uint32_t i, const uint32_t e)
+{
+	uint16_t r = 0;
+	for( ; i < e; ++i ) { r += (sq_mk(i) == SER_RX_DELIM); }
+	return r;
+}
+#endif
+
+/**
+@brief USART1 idle line.
+*/
+static void sq_rx_idle(void)
+{
+	USART1->SR |= USART_SR_IDLE;
+	if( USART1->CR1 & USART_CR1_IDLEIE ) { USART1_IRQHandler(); }
+}
+
+/**
+@brief Bursts received by DMA, read in random amounts, then an overrun of the RX queue.
+*/
+static void sq_rx_dma(void)
+{
+	uint32_t wr = 0, rd = 0, it;
+	struct ser_errs_t e;
+	uint8_t d;
+
+	ser_flush_rxbuf(1);
+	ser_errs(1, &e, 1);
+
+	for( it = 0; it < SQ_ITER; ++it ) {
+		uint16_t n = test_rand() % 24, i;
+		if( test_rand() % 2 ) {
+			if( n > SQ_RXS - (wr - rd) ) { n = SQ_RXS - (wr - rd); }	// reader keeps up
+			for( i = 0; i < n; ++i ) { sq_rxdma_put(sq_mk(wr++)); }
+			if( test_rand() % 2 ) { sq_rx_idle(); }
+		} else {
+			for( i = 0; (i < n) && ser_getc(1, &d); ++i ) {
+				CHECK( d == sq_mk(rd) );
+				rd++;
+			}
+			CHECK( (i == n) || (rd == wr) );	// ser_getc picks up bytes not yet published
+		}
+#ifdef SER_RX_DELIM
+		CHECK( ser_rxlines(1) == sq_delims(rd, wr) );
+#endif
+		if( test_fails > 10 ) { return; }
+	}
+	while( ser_getc(1, &d) ) { CHECK( d == sq_mk(rd) ); rd++; }
+	CHECK( rd == wr );
+
+	// not read for 2.5 buffers: the queue must stay in step with the DMA and hold the newest bytes
+	uint32_t n = 5 * SQ_RXS / 2;
+#ifdef SER_RX_DELIM
+	while( sq_delims(wr, wr + n - SQ_RXS) == 0 ) {	// start where lines are among the dropped bytes
+		sq_rxdma_put(sq_mk(wr++));
+		sq_rx_idle();
+		CHECK( ser_getc(1, &d) && d == sq_mk(rd) );
+		rd++;
+	}
+#endif
+	for( it = 0; it < n; ++it ) { sq_rxdma_put(sq_mk(wr++)); }
+	sq_rx_idle();
+	rd = wr - SQ_RXS;
+#ifdef SER_RX_DELIM
+	CHECK( sq_delims(wr - n, wr) > sq_delims(rd, wr) );	// some were dropped
+	CHECK( ser_rxlines(1) == sq_delims(rd, wr) );	// the dropped ones are not counted
+#endif
+	while( ser_getc(1, &d) ) { CHECK( d == sq_mk(rd) ); rd++; }
+	CHECK( rd == wr );
+	ser_errs(1, &e, 1);
+	CHECK( e.cnt[SER_ERR_FULL] == n - SQ_RXS );
+
+	for( it = 0; it < 10; ++it ) { sq_rxdma_put(sq_mk(wr++)); }	// and goes on from there
+	sq_rx_idle();
+	while( ser_getc(1, &d) ) { CHECK( d == sq_mk(rd) ); rd++; }
+	CHECK( rd == wr );
+#ifdef SER_RX_DELIM
+	CHECK( ser_rxlines(1) == 0 );
+#endif
+
+	printf("  RX DMA                      %" PRIu32 " bytes\n", wr);
+}
+#endif
+
+void test_serialq(void)
+{
+	CHECK( (uintptr_t)sq_txb + sizeof(sq_txb) <= 0xffffffff );	// DMA addresses are 32 bit, see makefile
+	host_usart_tx = sq_wire_put;
+
+	ser_init(1, 115200, sq_txb[0], SQ_TXS, sq_rxb[0], SQ_RXS);
+	ser_init(2, 115200, sq_txb[1], SQ_TXS, sq_rxb[1], SQ_RXS);
+
+	test_seed(5);
+	sq_tx_random();
+
+	sq_tx_overwrite(1);
+	sq_tx_overwrite(2);
+	printf("  TX overwrite mode           done\n");
+
+#ifdef SER_RX_DMA
+	sq_rx_dma();
+#endif
+}
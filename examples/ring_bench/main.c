@@ -0,0 +1,451 @@
+/**
+This is a benchmark and stress test of the fifo and circbuf8 routines. It runs on any
+STM32F103 board with USART1 connected to a terminal @115200 baud.
+
+Cycle counts are taken with the DWT cycle counter. For each buffer and element size the
+average and worst case number of cycles per put and get is reported, first for a buffer
+that is filled and drained, then for single element and bulk transfers.
+
+After the benchmark, randomized put/get interleavings (driven by a LFSR) check that data
+comes out in order across many wrap-arounds. Finally SysTick is sped up and used as an
+interrupt producer feeding a circbuf8, while the main loop consumes and verifies the
+sequence. This exercises the interrupt safety of the routines (build the library with
+and without CBUF8_SPSC to compare both variants).
+
+The COBS/CRC frame encoder and decoder of serframe.c are benchmarked as well, with random
+payloads of several lengths, reporting cycles per frame for sfr_encode and sfr_decode.
+
+The integer conversion of itoa.c is compared to the previous divide per digit implementation
+(kept here as itoa_ref) for several bases and magnitudes, checking that both give the same string.
+Likewise ftoa is timed against the previous soft float loop of ser_putf (ftoa_ref) and checked
+against known roundings.
+
+Run it after changing any of the ring buffer, framing or conversion routines and compare the results to the
+previous run.
+
+@file		main.c
+@brief		ring buffer benchmark
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+*/
+
+#include <string.h>
+
+#include "stm32f10x.h"
+
+#include "mat/serialq.h"
+#include "mat/circbuf8.h"
+#include "mat/fifo.h"
+#include "mat/serframe.h"
+#include "mat/itoa.h"
+
+//-----------------------------------------------------------------------------
+//  Defines
+//-----------------------------------------------------------------------------
+
+#define SER_PORT 1
+#define SER_BAUD 115200
+
+#define RAND_ITER 100000
+#define ISR_ITER 100000
+#define ISR_PERIOD 2000
+
+//-----------------------------------------------------------------------------
+//  Global variables
+//-----------------------------------------------------------------------------
+
+static uint8_t uart1rxbuf[16];
+static uint8_t uart1txbuf[256];
+
+static uint32_t fifomem[256];
+static volatile struct fifo_t fifo;
+
+static uint8_t cbufmem[256];
+static volatile struct cbuf8_t cbuf;
+
+static volatile uint8_t isr_produce;
+static volatile uint8_t isr_seq;
+
+volatile uint32_t msTicks;	// counts SysTicks
+
+//-----------------------------------------------------------------------------
+//  newlib required functions
+//-----------------------------------------------------------------------------
+
+void _exit(int status)
+{
+	while(1) {}
+}
+
+//-----------------------------------------------------------------------------
+//  SysTick handler
+//-----------------------------------------------------------------------------
+
+void SysTick_Handler(void)
+{
+	if( isr_produce ) {
+		if( cbuf8_put(&cbuf, isr_seq) ) {
+			isr_seq++;
+		}
+	} else {
+		msTicks++;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//  delay functions
+//-----------------------------------------------------------------------------
+
+void _delay_ms (uint32_t ms)
+{
+	uint32_t curTicks = msTicks;
+	while ((msTicks - curTicks) < ms);
+}
+
+//-----------------------------------------------------------------------------
+//  utility functions
+//-----------------------------------------------------------------------------
+
+uint32_t lfsr(void)
+{
+	static uint32_t x = 0xace1;
+	x = (x >> 1) ^ (-(x & 1) & 0xd0000001);
+	return x;
+}
+
+void cyc_init(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/** Accumulated cycle statistics of a single operation */
+struct cyc_stat
+{
+	uint32_t n;
+	uint32_t sum;
+	uint32_t max;
+};
+
+/** Run op, accumulating its cycle count into st. Evaluates to op's result. */
+#define CYC(st, op) ({ \
+	uint32_t _c = DWT->CYCCNT; \
+	uint32_t _r = (op); \
+	_c = DWT->CYCCNT - _c; \
+	(st).n++; (st).sum += _c; \
+	if( _c > (st).max ) { (st).max = _c; } \
+	_r; })
+
+void print_stat(const char* name, struct cyc_stat* st)
+{
+	if( st->n == 0 ) return;
+	ser_printf("  %s avg %d max %d\r\n", name, st->sum / st->n, st->max);
+}
+
+//-----------------------------------------------------------------------------
+//  benchmarks
+//-----------------------------------------------------------------------------
+
+void bench_fifo(uint16_t bsize, uint16_t esize)
+{
+	uint32_t e[4] = {0};
+	struct cyc_stat sp = {0}, sg = {0}, sn = {0};
+
+	fifo_clear(&fifo, fifomem, bsize, esize);
+	while( CYC(sp, fifo_put(&fifo, e)) );
+	while( CYC(sg, fifo_get(&fifo, e)) );
+
+	// bulk transfers of 8 elements
+	uint32_t b[8*4];
+	uint16_t i;
+	for( i = 0; i < 64; ++i ) {
+		CYC(sn, fifo_put_n(&fifo, b, 8));
+		CYC(sn, fifo_get_n(&fifo, b, 8));
+	}
+
+	ser_printf("fifo size %d elem %d\r\n", bsize, esize);
+	print_stat("put  ", &sp);
+	print_stat("get  ", &sg);
+	print_stat("8xput/get", &sn);
+}
+
+void bench_cbuf8(uint16_t bsize)
+{
+	uint8_t d = 0;
+	struct cyc_stat sp = {0}, sg = {0}, sn = {0};
+
+	cbuf8_clear(&cbuf, cbufmem, bsize);
+	while( CYC(sp, cbuf8_put(&cbuf, d)) );
+	while( CYC(sg, cbuf8_get(&cbuf, &d)) );
+
+	// bulk transfers of 32 bytes
+	uint8_t b[32];
+	uint16_t i;
+	for( i = 0; i < 64; ++i ) {
+		CYC(sn, cbuf8_write(&cbuf, b, sizeof(b)));
+		CYC(sn, cbuf8_read(&cbuf, b, sizeof(b)));
+	}
+
+	ser_printf("cbuf8 size %d\r\n", bsize);
+	print_stat("put  ", &sp);
+	print_stat("get  ", &sg);
+	print_stat("32xwrite/read", &sn);
+}
+
+void bench_sfr(uint16_t n)
+{
+	uint8_t p[256];
+	uint8_t e[SFR_ENCLEN(sizeof(p))];
+	struct cyc_stat se = {0}, sd = {0};
+	uint8_t ok = 1;
+	uint16_t i, j;
+
+	for( i = 0; i < 64; ++i ) {
+		for( j = 0; j < n; ++j ) { p[j] = (lfsr() & 3) ? lfsr() : 0; }
+		uint8_t ch;
+		uint16_t l = CYC(se, sfr_encode(e, i & 7, p, n));
+		l = CYC(sd, sfr_decode(e, l, &ch));
+		if( (l != n) || (ch != (i & 7)) || memcmp(e, p, n) ) { ok = 0; }
+	}
+
+	ser_printf("sfr payload %d: %s\r\n", n, ok ? "ok" : "FAIL");
+	print_stat("encode", &se);
+	print_stat("decode", &sd);
+}
+
+/**
+Previous itoa, a signed divide and modulo per digit followed by a reverse. Like before, negative
+values are only handled in base 10, in other bases the remainders are negative and index outside
+the digit table, so bench_itoa only compares them in base 10.
+*/
+uint8_t itoa_ref(int value, char* buffer, int base)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	char* p = buffer;
+	int sign = 0;
+
+	if( (base == 10) && ((sign = value) < 0) ) { value = -value; }
+	do {
+		*p++ = digits[value % base];
+	} while( (value /= base) );
+	if( sign < 0 ) { *p++ = '-'; }
+	*p = 0;
+
+	uint8_t n = p - buffer;
+	char* s = buffer;
+	while( --p > s ) {
+		char t = *p;
+		*p = *s;
+		*s++ = t;
+	}
+	return n;
+}
+
+void bench_itoa(uint8_t base, uint32_t mask)
+{
+	char a[34], b[34];
+	struct cyc_stat so = {0}, sn = {0};
+	uint8_t ok = 1;
+	uint16_t i;
+
+	for( i = 0; i < 256; ++i ) {
+		int32_t v = lfsr() & mask;
+		if( (i & 1) && (base == 10) ) { v = -v; }
+		uint8_t n = CYC(so, itoa_ref(v, a, base));
+		if( (CYC(sn, i32toa(v, b, base)) != n) || strcmp(a, b) ) { ok = 0; }
+	}
+
+	ser_printf("itoa base %d mask %x: %s\r\n", base, mask, ok ? "ok" : "FAIL");
+	print_stat("old", &so);
+	print_stat("new", &sn);
+}
+
+/** Previous ser_putf conversion, soft float and truncating */
+uint8_t ftoa_ref(float f, char* s, uint8_t prec)
+{
+	char* p = s;
+	if( f < 0 ) {
+		f = -f;
+		*p++ = '-';
+	}
+	p += itoa_ref(f, p, 10);
+	*p++ = '.';
+	f = f - (int)f;
+	uint8_t i = prec;
+	while( i-- ) f *= 10;
+	char d[12];
+	uint8_t n = itoa_ref(f, d, 10);
+	while( prec-- > n ) { *p++ = '0'; }
+	memcpy(p, d, n + 1);
+	return p - s + n;
+}
+
+void bench_ftoa(void)
+{
+	static const struct { float f; uint8_t prec; const char* s; } t[] = {
+		{0, 2, "0.00"}, {1.005f, 2, "1.00"}, {2.675f, 2, "2.67"}, {0.125f, 2, "0.13"}, {-0.5f, 0, "-1"},
+		{-1.25f, 1, "-1.3"}, {99.996f, 2, "100.00"}, {-0.0004f, 3, "-0.000"}, {123456.789f, 3, "123456.789"},
+		{3.4e38f, 1, "ovf"}, {1e-20f, 9, "0.000000000"}, {16777216.0f, 0, "16777216"}
+	};
+	char a[FTOA_LEN], b[FTOA_LEN];
+	struct cyc_stat so = {0}, sn = {0};
+	uint8_t ok = 1;
+	uint16_t i;
+
+	for( i = 0; i < sizeof(t)/sizeof(t[0]); ++i ) {
+		if( (ftoa(t[i].f, a, t[i].prec) != strlen(t[i].s)) || strcmp(a, t[i].s) ) { ok = 0; }
+	}
+
+	for( i = 0; i < 256; ++i ) {
+		float f = (int32_t)lfsr() / 65536.0f;
+		CYC(so, ftoa_ref(f, b, 3));
+		CYC(sn, ftoa(f, a, 3));
+	}
+
+	ser_printf("ftoa: %s\r\n", ok ? "ok" : "FAIL");
+	print_stat("old", &so);
+	print_stat("new", &sn);
+}
+
+//-----------------------------------------------------------------------------
+//  stress tests
+//-----------------------------------------------------------------------------
+
+uint8_t rand_fifo(uint16_t bsize)
+{
+	uint32_t wr = 0, rd = 0, e;
+	uint32_t i;
+
+	fifo_clear(&fifo, fifomem, bsize, sizeof(e));
+
+	for( i = 0; i < RAND_ITER; ++i ) {
+		uint32_t r = lfsr();
+		uint16_t n = (r >> 8) % 8;
+		if( r & 1 ) {
+			while( n-- && fifo_put(&fifo, &wr) ) { wr++; }
+		} else {
+			while( n-- && fifo_get(&fifo, &e) ) {
+				if( e != rd ) return 1;
+				rd++;
+			}
+		}
+		if( fifo.len != wr - rd ) return 1;
+	}
+
+	return 0;
+}
+
+uint8_t rand_cbuf8(uint16_t bsize)
+{
+	uint16_t wr = 0, rd = 0;
+	uint8_t b[16];
+	uint32_t i;
+
+	cbuf8_clear(&cbuf, cbufmem, bsize);
+
+	for( i = 0; i < RAND_ITER; ++i ) {
+		uint32_t r = lfsr();
+		uint16_t n = (r >> 8) % sizeof(b);
+		uint16_t j;
+		if( r & 1 ) {
+			for( j = 0; j < n; ++j ) { b[j] = wr + j; }
+			wr += cbuf8_write(&cbuf, b, n);
+		} else {
+			n = cbuf8_read(&cbuf, b, n);
+			for( j = 0; j < n; ++j ) {
+				if( b[j] != (uint8_t)rd ) return 1;
+				rd++;
+			}
+		}
+		if( cbuf8_len(&cbuf) != (uint16_t)(wr - rd) ) return 1;
+	}
+
+	return 0;
+}
+
+uint8_t isr_cbuf8(uint16_t bsize)
+{
+	uint8_t rd = 0, d;
+	uint32_t i = 0;
+
+	cbuf8_clear(&cbuf, cbufmem, bsize);
+	isr_seq = 0;
+	isr_produce = 1;
+	SysTick_Config(ISR_PERIOD);
+
+	while( i < ISR_ITER ) {
+		if( cbuf8_get(&cbuf, &d) ) {
+			if( d != rd ) break;
+			rd++;
+			i++;
+		}
+	}
+
+	SysTick_Config(SystemCoreClock / 1000);
+	isr_produce = 0;
+
+	return (i != ISR_ITER);
+}
+
+//-----------------------------------------------------------------------------
+//  MAIN function
+//-----------------------------------------------------------------------------
+
+int main(void)
+{
+	if( SysTick_Config(SystemCoreClock / 1000) ) { // setup SysTick Timer for 1 msec interrupts
+		while( 1 );                                  // capture error
+	}
+
+	NVIC_PriorityGroupConfig(NVIC_PriorityGroup_0); // disable preemption
+
+	ser_init(SER_PORT, SER_BAUD, uart1txbuf, sizeof(uart1txbuf), uart1rxbuf, sizeof(uart1rxbuf));
+	ser_printf_devnum = SER_PORT;
+
+	cyc_init();
+
+	ser_printf("ring bench, cycles per op\r\n");
+
+	static const uint16_t esizes[] = {1, 4, 16};
+	static const uint16_t bsizes[] = {16, 256, sizeof(fifomem)};
+	uint8_t i, j;
+
+	for( i = 0; i < sizeof(esizes)/sizeof(esizes[0]); ++i ) {
+		for( j = 0; j < sizeof(bsizes)/sizeof(bsizes[0]); ++j ) {
+			bench_fifo(bsizes[j], esizes[i]);
+		}
+	}
+
+	for( j = 0; j < 2; ++j ) {
+		bench_cbuf8(bsizes[j]);
+	}
+
+	static const uint16_t fsizes[] = {8, 64, 250};
+	for( j = 0; j < sizeof(fsizes)/sizeof(fsizes[0]); ++j ) {
+		bench_sfr(fsizes[j]);
+	}
+
+	static const uint32_t imasks[] = {0xff, 0xffff, 0x7fffffff};
+	for( j = 0; j < sizeof(imasks)/sizeof(imasks[0]); ++j ) {
+		bench_itoa(10, imasks[j]);
+		bench_itoa(16, imasks[j]);
+	}
+	bench_itoa(2, 0x7fffffff);
+	bench_ftoa();
+
+	for( j = 0; j < 2; ++j ) {
+		ser_printf("random fifo size %d: %s\r\n", bsizes[j], rand_fifo(bsizes[j]) ? "FAIL" : "ok");
+		ser_printf("random cbuf8 size %d: %s\r\n", bsizes[j], rand_cbuf8(bsizes[j]) ? "FAIL" : "ok");
+	}
+
+	for( j = 0; j < 2; ++j ) {
+		uint8_t r = isr_cbuf8(bsizes[j]);
+		ser_printf("isr cbuf8 size %d: %s\r\n", bsizes[j], r ? "FAIL" : "ok");
+	}
+
+	ser_printf("done\r\n");
+
+	while( 1 );
+}
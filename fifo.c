@@ -4,6 +4,10 @@
 @author		Matej Kogovsek
 @copyright	LGPL 2.1
 @note		This file is part of mat-stm32f1-lib
+@note		Define FIFO_STATS (for all compilation units) to keep fill level and overflow/underflow statistics, see fifo_stats.
+@note		In FIFO_OVERWRITE mode puts never fail, the oldest elements are dropped (and counted in drop) instead.
+While the consumer holds the oldest element from fifo_peek, new elements that do not fit are dropped
+instead, and fifo_reserve fails.
 */
 
 #include "stm32f10x.h"
@@ -12,12 +16,15 @@
 
 /**
 @brief Initializes (clears) fifo.
+
+Use the fifo_clear macro for the default FIFO_BLOCK mode.
 @param[in]	f		Pointer to fifo_t struct where fifo state will be kept
 @param[in]	p		Pointer to element array for data
 @param[in]	s		sizeof(p)
 @param[in]	e		sizeof(element)
+@param[in]	m		Mode, FIFO_BLOCK or FIFO_OVERWRITE
 */
-void fifo_clear(volatile struct fifo_t* f, void* const p, const uint16_t s, const uint16_t e)
+void fifo_clear_m(volatile struct fifo_t* f, void* const p, const uint16_t s, const uint16_t e, const uint8_t m)
 {
 	uint32_t g = __get_PRIMASK();
 	__disable_irq();
@@ -28,6 +35,14 @@ void fifo_clear(volatile struct fifo_t* f, void* const p, const uint16_t s, cons
 	f->head = 0;
 	f->tail = 0;
 	f->len = 0;
+	f->mode = m;
+	f->drop = 0;
+	f->peek = 0;
+#ifdef FIFO_STATS
+	f->st.maxlen = 0;
+	f->st.ovf = 0;
+	f->st.unf = 0;
+#endif
 
 	__set_PRIMASK(g);
 }
@@ -36,7 +51,7 @@ void fifo_clear(volatile struct fifo_t* f, void* const p, const uint16_t s, cons
 @brief Insert an element.
 @param[in]	f		Pointer to fifo_t
 @param[in]	d		Data to insert
-@return True on success, false otherwise (buffer full).
+@return True on success, false otherwise (buffer full). Always true in FIFO_OVERWRITE mode.
 */
 uint8_t fifo_put(volatile struct fifo_t* f, const void* d)
 {
@@ -44,14 +59,31 @@ uint8_t fifo_put(volatile struct fifo_t* f, const void* d)
 	__disable_irq();
 
 	if (f->len == f->size) {
-		__set_PRIMASK(g);
-		return 0;
+		if( (f->mode == FIFO_OVERWRITE) && !f->peek ) {
+			f->head++;
+			if(f->head == f->size) { f->head = 0; }
+			f->len--;
+			f->drop++;
+		} else if( f->mode == FIFO_OVERWRITE ) {	// the oldest one is peeked, drop the new one
+			f->drop++;
+			__set_PRIMASK(g);
+			return 1;
+		} else {
+#ifdef FIFO_STATS
+			f->st.ovf++;
+#endif
+			__set_PRIMASK(g);
+			return 0;
+		}
 	}
 
 	memcpy(f->buf+(f->tail*f->elem), d, f->elem);
 	f->tail++;
 	if(f->tail == f->size) { f->tail = 0; }
 	f->len++;
+#ifdef FIFO_STATS
+	if( f->len > f->st.maxlen ) { f->st.maxlen = f->len; }
+#endif
 
 	__set_PRIMASK(g);
 	return 1;
@@ -69,12 +101,16 @@ uint8_t fifo_get(volatile struct fifo_t* f, void* const d)
 	__disable_irq();
 
 	if (f->len == 0) {
+#ifdef FIFO_STATS
+		f->st.unf++;
+#endif
 		__set_PRIMASK(g);
 		return 0;
 	}
 
 	if( d ) {	// if d is null, cbuf_get can be used to check for data in buffer
 		memcpy(d, f->buf+(f->head*f->elem), f->elem);
+		f->peek = 0;
 		f->head++;
 		if(f->head == f->size) { f->head = 0; }
 		f->len--;
@@ -83,3 +119,218 @@ uint8_t fifo_get(volatile struct fifo_t* f, void* const d)
 	__set_PRIMASK(g);
 	return 1;
 }
+
+/**
+@brief Insert up to n elements.
+
+Elements are copied in at most two contiguous spans.
+@param[in]	f		Pointer to fifo_t
+@param[in]	d		Elements to insert
+@param[in]	n		Number of elements to insert
+@return Number of elements inserted (less than n if buffer full). Always n in FIFO_OVERWRITE mode.
+*/
+uint16_t fifo_put_n(volatile struct fifo_t* f, const void* d, uint16_t n)
+{
+	uint16_t r = n;
+
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	uint16_t fr = f->size - f->len;
+	if( n > fr ) {
+		if( (f->mode == FIFO_OVERWRITE) && f->peek ) {	// the oldest one is peeked, drop the new ones
+			f->drop += n - fr;
+			n = fr;
+		} else if( f->mode == FIFO_OVERWRITE ) {
+			if( n > f->size ) {	// only the last size elements can be kept
+				f->drop += n - f->size;
+				d += (n - f->size)*f->elem;
+				n = f->size;
+			}
+			uint16_t o = n - fr;	// make room by dropping the oldest elements
+			f->head += o;
+			if(f->head >= f->size) { f->head -= f->size; }
+			f->len -= o;
+			f->drop += o;
+		} else {
+			n = fr;
+			r = fr;
+#ifdef FIFO_STATS
+			f->st.ovf++;
+#endif
+		}
+	}
+
+	uint16_t c = f->size - f->tail;
+	if( c > n ) { c = n; }
+
+	memcpy(f->buf+(f->tail*f->elem), d, c*f->elem);
+	memcpy(f->buf, d+(c*f->elem), (n-c)*f->elem);
+	f->tail += n;
+	if(f->tail >= f->size) { f->tail -= f->size; }
+	f->len += n;
+#ifdef FIFO_STATS
+	if( f->len > f->st.maxlen ) { f->st.maxlen = f->len; }
+#endif
+
+	__set_PRIMASK(g);
+	return r;
+}
+
+/**
+@brief Get up to n elements.
+
+Elements are copied out in at most two contiguous spans.
+@param[in]	f		Pointer to fifo_t
+@param[out]	d		Pointer to buffer where elements are put
+@param[in]	n		Max number of elements to get
+@return Number of elements copied to d (less than n if buffer empty).
+*/
+uint16_t fifo_get_n(volatile struct fifo_t* f, void* const d, uint16_t n)
+{
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	if( n > f->len ) { n = f->len; }
+#ifdef FIFO_STATS
+	if( f->len == 0 ) { f->st.unf++; }
+#endif
+
+	uint16_t c = f->size - f->head;
+	if( c > n ) { c = n; }
+
+	memcpy(d, f->buf+(f->head*f->elem), c*f->elem);
+	memcpy(d+(c*f->elem), f->buf, (n-c)*f->elem);
+	if( n ) { f->peek = 0; }
+	f->head += n;
+	if(f->head >= f->size) { f->head -= f->size; }
+	f->len -= n;
+
+	__set_PRIMASK(g);
+	return n;
+}
+
+/**
+@brief Reserve the next free element for in place writing.
+
+The element is not inserted until fifo_commit is called. Only one reservation may be outstanding,
+so reserve/commit should only be used by a single producer. In FIFO_OVERWRITE mode the oldest
+element is dropped if the fifo is full, unless the consumer holds it from fifo_peek.
+@param[in]	f		Pointer to fifo_t
+@return Pointer to the free element inside buf, 0 if buffer full (and the oldest element peeked in FIFO_OVERWRITE mode).
+*/
+void* fifo_reserve(volatile struct fifo_t* f)
+{
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	void* p = 0;
+	if( (f->len == f->size) && (f->mode == FIFO_OVERWRITE) && !f->peek ) {
+		f->head++;
+		if(f->head == f->size) { f->head = 0; }
+		f->len--;
+		f->drop++;
+	}
+	if( f->len < f->size ) {
+		p = f->buf+(f->tail*f->elem);
+	}
+#ifdef FIFO_STATS
+	else { f->st.ovf++; }
+#endif
+
+	__set_PRIMASK(g);
+	return p;
+}
+
+/**
+@brief Insert the element previously obtained with fifo_reserve.
+@param[in]	f		Pointer to fifo_t
+*/
+void fifo_commit(volatile struct fifo_t* f)
+{
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	if( f->len < f->size ) {
+		f->tail++;
+		if(f->tail == f->size) { f->tail = 0; }
+		f->len++;
+#ifdef FIFO_STATS
+		if( f->len > f->st.maxlen ) { f->st.maxlen = f->len; }
+#endif
+	}
+
+	__set_PRIMASK(g);
+}
+
+/**
+@brief Access the next element in place.
+
+The element stays in the fifo until fifo_consume is called. Peek/consume should only be used
+by a single consumer. Until then, puts in FIFO_OVERWRITE mode do not drop it, they drop the new
+elements that do not fit instead.
+@param[in]	f		Pointer to fifo_t
+@return Pointer to the next element inside buf, 0 if buffer empty.
+*/
+void* fifo_peek(volatile struct fifo_t* f)
+{
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	void* p = 0;
+	if( f->len ) {
+		p = f->buf+(f->head*f->elem);
+		f->peek = 1;
+	}
+#ifdef FIFO_STATS
+	else { f->st.unf++; }
+#endif
+
+	__set_PRIMASK(g);
+	return p;
+}
+
+/**
+@brief Remove the element previously obtained with fifo_peek.
+@param[in]	f		Pointer to fifo_t
+*/
+void fifo_consume(volatile struct fifo_t* f)
+{
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	if( f->len ) {
+		f->head++;
+		if(f->head == f->size) { f->head = 0; }
+		f->len--;
+	}
+	f->peek = 0;
+
+	__set_PRIMASK(g);
+}
+
+#ifdef FIFO_STATS
+/**
+@brief Get fifo statistics.
+@param[in]	f		Pointer to fifo_t
+@param[out]	st		Pointer to caller allocated fifo_stats_t where statistics are copied
+@param[in]	clr		bool, true = reset statistics after copying
+*/
+void fifo_stats(volatile struct fifo_t* f, struct fifo_stats_t* st, const uint8_t clr)
+{
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	st->maxlen = f->st.maxlen;
+	st->ovf = f->st.ovf;
+	st->unf = f->st.unf;
+
+	if( clr ) {
+		f->st.maxlen = f->len;
+		f->st.ovf = 0;
+		f->st.unf = 0;
+	}
+
+	__set_PRIMASK(g);
+}
+#endif
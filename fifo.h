@@ -3,6 +3,16 @@
 
 #include <inttypes.h>
 
+#ifdef FIFO_STATS
+/** Fifo statistics */
+struct fifo_stats_t
+{
+	uint16_t maxlen;	/**< max number of elements ever in FIFO */
+	uint32_t ovf;	/**< number of puts rejected (or cut short) because FIFO was full */
+	uint32_t unf;	/**< number of gets from an empty FIFO */
+};
+#endif
+
 /** Circbuf state struct */
 struct fifo_t
 {
@@ -12,10 +22,31 @@ struct fifo_t
 	uint16_t len;	/**< number of elements currently in FIFO */
 	uint16_t size;	/**< size of buf */
 	uint16_t elem;	/**< single element size */
+	uint8_t mode;	/**< behaviour when full, FIFO_BLOCK or FIFO_OVERWRITE */
+	uint32_t drop;	/**< number of elements dropped in FIFO_OVERWRITE mode */
+	uint8_t peek;	/**< oldest element handed out by fifo_peek, not to be overwritten */
+#ifdef FIFO_STATS
+	struct fifo_stats_t st;	/**< statistics */
+#endif
 };
 
-void fifo_clear(volatile struct fifo_t* f, void* const p, const uint16_t s, const uint16_t e);
+#define FIFO_BLOCK 0	/**< put fails when buffer full */
+#define FIFO_OVERWRITE 1	/**< put drops the oldest element when buffer full (the new one while the oldest is peeked) */
+
+void fifo_clear_m(volatile struct fifo_t* f, void* const p, const uint16_t s, const uint16_t e, const uint8_t m);
+#define fifo_clear(f, p, s, e) fifo_clear_m(f, p, s, e, FIFO_BLOCK)
 uint8_t fifo_put(volatile struct fifo_t* f, const void* d);
 uint8_t fifo_get(volatile struct fifo_t* f, void* const d);
+uint16_t fifo_put_n(volatile struct fifo_t* f, const void* d, uint16_t n);
+uint16_t fifo_get_n(volatile struct fifo_t* f, void* const d, uint16_t n);
+
+void* fifo_reserve(volatile struct fifo_t* f);
+void fifo_commit(volatile struct fifo_t* f);
+void* fifo_peek(volatile struct fifo_t* f);
+void fifo_consume(volatile struct fifo_t* f);
+
+#ifdef FIFO_STATS
+void fifo_stats(volatile struct fifo_t* f, struct fifo_stats_t* st, const uint8_t clr);
+#endif
 
 #endif
@@ -58,23 +58,50 @@ void fls25_init(const uint8_t n)
 */
 uint8_t fls25_rd(const uint8_t n, const uint32_t adr, uint8_t* buf, uint16_t len)
 {
-	FLS25_NSS_LOW;
+	uint8_t cmd[4] = {0x03, adr >> 16, adr >> 8, adr};
 
-	spi_rw(n, 0x03);
-	spi_rw(n, adr >> 16);
-	spi_rw(n, adr >> 8);
-	spi_rw(n, adr);
+	FLS25_NSS_LOW;
 
-	while( len-- ) {
-		*buf = spi_rw(n, 0);
-		buf++;
-	}
+	spi_xfer(n, cmd, 0, sizeof(cmd));
+	spi_xfer(n, 0, buf, len);
 
 	FLS25_NSS_HIGH;
 
 	return 0;
 }
 
+#ifdef SPI_DMA
+/**
+@brief Start reading from flash with DMA, do not wait.
+
+The command is sent right away, the data is read by spi_xfer_async, which deselects the flash
+(fls25_cs) when done and then calls cb. Nothing else may use the SPI port until then.
+@param[in]	n		SPI peripheral number, its SPI_DMA bit set
+@param[in]	adr		Starting byte address
+@param[out]	buf		Caller provided buffer for data, must stay valid until completion
+@param[in]	len		Number of bytes to read (1..65535, len <= sizeof(buf))
+@param[in]	cb		Completion callback (called from interrupt), 0 to poll spi_busy instead
+@param[in]	ctx		Passed to cb
+@return True if started, false otherwise (SPI port busy).
+*/
+uint8_t fls25_rd_async(const uint8_t n, const uint32_t adr, uint8_t* buf, uint16_t len, spi_cb_t cb, void* ctx)
+{
+	uint8_t cmd[4] = {0x03, adr >> 16, adr >> 8, adr};
+
+	if( spi_busy(n) ) { return 0; }
+
+	FLS25_NSS_LOW;
+
+	spi_xfer(n, cmd, 0, sizeof(cmd));
+	if( !spi_xfer_async(n, 0, buf, len, fls25_cs, cb, ctx) ) {
+		FLS25_NSS_HIGH;
+		return 0;
+	}
+
+	return 1;
+}
+#endif
+
 /**
 @brief Flash write enable.
 @param[in]	n		SPI peripheral number
@@ -98,17 +125,12 @@ void fls25_we(const uint8_t n)
 */
 uint8_t fls25_wr(const uint8_t n, const uint32_t adr, uint8_t* buf, uint16_t len)
 {
-	FLS25_NSS_LOW;
+	uint8_t cmd[4] = {0x02, adr >> 16, adr >> 8, adr};
 
-	spi_rw(n, 0x02);
-	spi_rw(n, adr >> 16);
-	spi_rw(n, adr >> 8);
-	spi_rw(n, adr);
+	FLS25_NSS_LOW;
 
-	while( len-- ) {
-		spi_rw(n, *buf);
-		buf++;
-	}
+	spi_xfer(n, cmd, 0, sizeof(cmd));
+	spi_xfer(n, buf, 0, len);
 
 	FLS25_NSS_HIGH;
 
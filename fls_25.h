@@ -2,10 +2,14 @@
 #define MAT_SPIFLASH_H
 
 #include <inttypes.h>
+#include "spi.h"
 
 void fls25_init(const uint8_t n);
 
 uint8_t fls25_rd(const uint8_t n, const uint32_t adr, uint8_t* buf, uint16_t len);
+#ifdef SPI_DMA
+uint8_t fls25_rd_async(const uint8_t n, const uint32_t adr, uint8_t* buf, uint16_t len, spi_cb_t cb, void* ctx);
+#endif
 
 void fls25_we(const uint8_t n);
 uint8_t fls25_wr(const uint8_t n, const uint32_t adr, uint8_t* buf, uint16_t len);
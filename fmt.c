@@ -0,0 +1,336 @@
+/**
+
+A printf style formatter without dynamic memory allocation. Output is rendered into a small chunk
+on the stack and handed to a caller supplied sink whenever the chunk is full and once at the end,
+so the same engine serves serialq, the LCD and USB CDC with a few bulk writes per call.
+
+Supported are the flags '-', '+', ' ', '0' and '#', width and precision (also given as '*'), the
+length modifiers hh, h, l, ll, j and z and the conversions d, i, u, o, x, X, c, s, p, f, F and %.
+Floats are printed with at most 9 decimals. Unknown conversions are printed as '?'.
+
+@file		fmt.c
+@brief		Formatted output engine
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+*/
+
+#include "fmt.h"
+#include "itoa.h"
+#include <stddef.h>
+
+#ifndef FMT_CHUNK
+#define FMT_CHUNK 32	/**< size of the stack chunk output is rendered into (max 255) */
+#endif
+
+/** @privatesection */
+
+#define FMT_LEFT	0x01	/**< '-' flag, left justify */
+#define FMT_PLUS	0x02	/**< '+' flag, always print sign */
+#define FMT_SPACE	0x04	/**< ' ' flag, space in place of '+' */
+#define FMT_ZERO	0x08	/**< '0' flag, pad with zeros */
+#define FMT_ALT		0x10	/**< '#' flag, alternate form */
+#define FMT_UPPER	0x20	/**< upper case hex digits */
+#define FMT_PREC	0x40	/**< precision given */
+
+/** Length modifiers */
+enum { FMT_INT, FMT_CHAR, FMT_SHORT, FMT_LONG, FMT_LLONG, FMT_SIZE };
+
+/** Output state */
+struct fmt_out
+{
+	fmt_sink_t sink;	/**< output sink */
+	void* ctx;	/**< sink context */
+	int cnt;	/**< number of chars already passed to sink */
+	uint8_t n;	/**< number of chars in buf */
+	char buf[FMT_CHUNK];	/**< output chunk */
+};
+
+static void fmt_flush(struct fmt_out* o)
+{
+	if( o->n ) {
+		o->sink(o->ctx, o->buf, o->n);
+		o->cnt += o->n;
+		o->n = 0;
+	}
+}
+
+static void fmt_putc(struct fmt_out* o, const char c)
+{
+	o->buf[o->n++] = c;
+	if( o->n == FMT_CHUNK ) { fmt_flush(o); }
+}
+
+static void fmt_putn(struct fmt_out* o, const char* s, uint16_t n)
+{
+	if( n >= FMT_CHUNK ) {	// long strings go to the sink directly
+		fmt_flush(o);
+		o->sink(o->ctx, s, n);
+		o->cnt += n;
+		return;
+	}
+	while( n-- ) { fmt_putc(o, *s++); }
+}
+
+static void fmt_pad(struct fmt_out* o, const char c, int n)
+{
+	while( n-- > 0 ) { fmt_putc(o, c); }
+}
+
+/**
+@brief Output prefix (sign, 0x), nz zeros and s, justified to width w.
+*/
+static void fmt_field(struct fmt_out* o, const char* pfx, uint8_t np, const char* s, uint16_t ns, int nz, int w, uint8_t fl)
+{
+	int pad = w - np - nz - ns;
+	if( pad < 0 ) { pad = 0; }
+
+	if( !(fl & (FMT_LEFT | FMT_ZERO)) ) {
+		fmt_pad(o, ' ', pad);
+		pad = 0;
+	}
+	fmt_putn(o, pfx, np);
+	if( !(fl & FMT_LEFT) ) {	// zero padding goes after the prefix
+		fmt_pad(o, '0', pad);
+		pad = 0;
+	}
+	fmt_pad(o, '0', nz);
+	fmt_putn(o, s, ns);
+	fmt_pad(o, ' ', pad);
+}
+
+/**
+@brief Convert v to digits in base b, written backwards ending at e.
+@return Number of digits (0 for v == 0).
+*/
+static inline uint8_t fmt_utoa(char* e, uint64_t v, const uint8_t b, const uint8_t fl)
+{
+	return v ? e - u64toa_back(e, v, b, !(fl & FMT_UPPER)) : 0;
+}
+
+static void fmt_int(struct fmt_out* o, const uint64_t v, const uint8_t neg, const uint8_t b, int w, int prec, uint8_t fl)
+{
+	char d[24];
+	char* e = d + sizeof(d);
+	uint8_t nd = fmt_utoa(e, v, b, fl);
+
+	char pfx[2];
+	uint8_t np = 0;
+	if( neg ) { pfx[np++] = '-'; }
+	else if( fl & FMT_PLUS ) { pfx[np++] = '+'; }
+	else if( fl & FMT_SPACE ) { pfx[np++] = ' '; }
+	if( (fl & FMT_ALT) && (b == 16) && v ) {
+		pfx[np++] = '0';
+		pfx[np++] = (fl & FMT_UPPER) ? 'X' : 'x';
+	}
+
+	int nz = 0;
+	if( fl & FMT_PREC ) {
+		fl &= ~FMT_ZERO;
+		if( prec > nd ) { nz = prec - nd; }
+	} else
+	if( nd == 0 ) {
+		nz = 1;	// the value 0
+	}
+	if( (fl & FMT_ALT) && (b == 8) && (nz == 0) ) { nz = 1; }
+
+	fmt_field(o, pfx, np, e - nd, nd, nz, w, fl);
+}
+
+static void fmt_float(struct fmt_out* o, double f, int w, int prec, uint8_t fl)
+{
+	char pfx[1];
+	uint8_t np = 0;
+
+	if( f != f ) {
+		fmt_field(o, 0, 0, "nan", 3, 0, w, fl & ~FMT_ZERO);
+		return;
+	}
+	if( f < 0 ) {
+		f = -f;
+		pfx[np++] = '-';
+	}
+	else if( fl & FMT_PLUS ) { pfx[np++] = '+'; }
+	else if( fl & FMT_SPACE ) { pfx[np++] = ' '; }
+	if( f >= 1.8e19 ) {	// does not fit the integer part
+		fmt_field(o, pfx, np, (f - f != 0) ? "inf" : "ovf", 3, 0, w, fl & ~FMT_ZERO);
+		return;
+	}
+
+	if( !(fl & FMT_PREC) ) { prec = 6; }
+	if( prec > 9 ) { prec = 9; }
+	uint32_t sc = 1;
+	uint8_t i;
+	for( i = 0; i < prec; ++i ) { sc *= 10; }
+
+	uint64_t ip = f;
+	uint32_t fd = (f - ip) * sc + 0.5;
+	if( fd >= sc ) {	// rounded up to the next integer
+		fd -= sc;
+		ip++;
+	}
+
+	char d[32];
+	char* e = d + sizeof(d);
+	char* p = e;
+	for( i = 0; i < prec; ++i ) {
+		*--p = '0' + fd % 10;
+		fd /= 10;
+	}
+	if( prec || (fl & FMT_ALT) ) { *--p = '.'; }
+	uint8_t n = fmt_utoa(p, ip, 10, 0);
+	p -= n;
+	if( n == 0 ) { *--p = '0'; }
+
+	fmt_field(o, pfx, np, p, e - p, 0, w, fl);
+}
+
+/** @publicsection */
+
+/**
+@brief Format like vprintf, passing output to sink.
+@param[in]	sink	Output sink, called with chunks of at most FMT_CHUNK chars (longer for long %s arguments)
+@param[in]	ctx		Context passed to sink
+@param[in]	f		Format string
+@param[in]	vl		Arguments
+@return Number of chars output.
+*/
+int fmt_vprintf(fmt_sink_t sink, void* ctx, const char* f, va_list vl)
+{
+	struct fmt_out o;
+	o.sink = sink;
+	o.ctx = ctx;
+	o.cnt = 0;
+	o.n = 0;
+
+	while( *f ) {
+		if( *f != '%' ) {	// copy the run of literal chars
+			const char* s = f;
+			while( *f && (*f != '%') ) { ++f; }
+			fmt_putn(&o, s, f - s);
+			continue;
+		}
+		++f;
+
+		uint8_t fl = 0;
+		for( ;; ++f ) {
+			if( *f == '-' ) { fl |= FMT_LEFT; } else
+			if( *f == '+' ) { fl |= FMT_PLUS; } else
+			if( *f == ' ' ) { fl |= FMT_SPACE; } else
+			if( *f == '0' ) { fl |= FMT_ZERO; } else
+			if( *f == '#' ) { fl |= FMT_ALT; } else
+			break;
+		}
+
+		int w = 0;
+		if( *f == '*' ) {
+			w = va_arg(vl, int);
+			if( w < 0 ) {
+				fl |= FMT_LEFT;
+				w = -w;
+			}
+			++f;
+		} else {
+			while( (*f >= '0') && (*f <= '9') ) { w = w * 10 + (*f++ - '0'); }
+		}
+
+		int prec = 0;
+		if( *f == '.' ) {
+			fl |= FMT_PREC;
+			++f;
+			if( *f == '*' ) {
+				prec = va_arg(vl, int);
+				if( prec < 0 ) {
+					fl &= ~FMT_PREC;
+					prec = 0;
+				}
+				++f;
+			} else {
+				while( (*f >= '0') && (*f <= '9') ) { prec = prec * 10 + (*f++ - '0'); }
+			}
+		}
+
+		uint8_t len = FMT_INT;
+		if( *f == 'h' ) {
+			len = FMT_SHORT;
+			if( *++f == 'h' ) { len = FMT_CHAR; ++f; }
+		} else
+		if( *f == 'l' ) {
+			len = FMT_LONG;
+			if( *++f == 'l' ) { len = FMT_LLONG; ++f; }
+		} else
+		if( *f == 'j' ) { len = FMT_LLONG; ++f; } else
+		if( *f == 'z' ) { len = FMT_SIZE; ++f; }
+
+		char c = *f;
+		if( c == 0 ) break;
+		++f;
+
+		if( (c == 'd') || (c == 'i') ) {
+			int64_t v;
+			if( len == FMT_LLONG ) { v = va_arg(vl, long long); } else
+			if( len == FMT_LONG ) { v = va_arg(vl, long); } else
+			if( len == FMT_SIZE ) { v = va_arg(vl, ptrdiff_t); } else {
+				v = va_arg(vl, int);
+				if( len == FMT_SHORT ) { v = (short)v; } else
+				if( len == FMT_CHAR ) { v = (signed char)v; }
+			}
+			fmt_int(&o, (v < 0) ? -(uint64_t)v : (uint64_t)v, v < 0, 10, w, prec, fl);
+		} else
+		if( (c == 'u') || (c == 'o') || (c == 'x') || (c == 'X') ) {
+			uint64_t v;
+			if( len == FMT_LLONG ) { v = va_arg(vl, unsigned long long); } else
+			if( len == FMT_LONG ) { v = va_arg(vl, unsigned long); } else
+			if( len == FMT_SIZE ) { v = va_arg(vl, size_t); } else {
+				v = va_arg(vl, unsigned int);
+				if( len == FMT_SHORT ) { v = (unsigned short)v; } else
+				if( len == FMT_CHAR ) { v = (unsigned char)v; }
+			}
+			fl &= ~(FMT_PLUS | FMT_SPACE);
+			if( c == 'X' ) { fl |= FMT_UPPER; }
+			fmt_int(&o, v, 0, (c == 'u') ? 10 : (c == 'o') ? 8 : 16, w, prec, fl);
+		} else
+		if( c == 'p' ) {
+			uintptr_t v = (uintptr_t)va_arg(vl, void*);
+			fmt_int(&o, v, 0, 16, w, prec, (fl & ~(FMT_PLUS | FMT_SPACE)) | FMT_ALT);
+		} else
+		if( (c == 'f') || (c == 'F') ) {
+			fmt_float(&o, va_arg(vl, double), w, prec, fl);
+		} else
+		if( c == 'c' ) {
+			char ch = va_arg(vl, int);
+			fmt_field(&o, 0, 0, &ch, 1, 0, w, fl & ~FMT_ZERO);
+		} else
+		if( c == 's' ) {
+			const char* s = va_arg(vl, const char*);
+			if( s == 0 ) { s = "(null)"; }
+			uint16_t n = 0;
+			while( s[n] && (!(fl & FMT_PREC) || (n < prec)) ) { ++n; }
+			fmt_field(&o, 0, 0, s, n, 0, w, fl & ~FMT_ZERO);
+		} else
+		if( c == '%' ) {
+			fmt_putc(&o, '%');
+		} else {
+			fmt_putc(&o, '?');
+		}
+	}
+
+	fmt_flush(&o);
+	return o.cnt;
+}
+
+/**
+@brief Format like printf, passing output to sink.
+@param[in]	sink	Output sink
+@param[in]	ctx		Context passed to sink
+@param[in]	f		Format string
+@return Number of chars output.
+*/
+int fmt_printf(fmt_sink_t sink, void* ctx, const char* f, ...)
+{
+	va_list vl;
+	va_start(vl, f);
+	int r = fmt_vprintf(sink, ctx, f, vl);
+	va_end(vl);
+	return r;
+}
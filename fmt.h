@@ -0,0 +1,13 @@
+#ifndef MAT_FMT_H
+#define MAT_FMT_H
+
+#include <inttypes.h>
+#include <stdarg.h>
+
+/** Output sink, called with chunks of formatted output */
+typedef void (*fmt_sink_t)(void* ctx, const char* s, uint16_t n);
+
+int fmt_vprintf(fmt_sink_t sink, void* ctx, const char* f, va_list vl);
+int fmt_printf(fmt_sink_t sink, void* ctx, const char* f, ...);
+
+#endif
@@ -1,6 +1,6 @@
 /*******************************************************************************
  * File name: 		itoa.c
- * Description:		implementation of the missing itoa newlib function
+ * Description:		integer to string conversions (itoa and friends)
  * Project: 		_Wzorzec
  * Target: 			LPC2478
  * Compiler: 		arm-none-eabi-gcc
@@ -12,6 +12,7 @@
 /*==============================================================================
  Includes
 ==============================================================================*/
+# include <string.h>
 # include "itoa.h"
 
 /*==============================================================================
@@ -22,77 +23,354 @@
  Globals
 ==============================================================================*/
 
+static const char digits_uc [] = "0123456789ABCDEF";
+static const char digits_lc [] = "0123456789abcdef";
+
+/** all pairs of decimal digits, "00" to "99" */
+static const char digits_dec2 [200] =
+	"00010203040506070809" "10111213141516171819" "20212223242526272829" "30313233343536373839"
+	"40414243444546474849" "50515253545556575859" "60616263646566676869" "70717273747576777879"
+	"80818283848586878889" "90919293949596979899";
+
 /*==============================================================================
  Static function prototypes
 ==============================================================================*/
-static void __reverse (char* start, char* end);
+static char* __dec32 (char* end, uint32_t value);
+static uint8_t __ntoa (uint64_t value, uint8_t neg, char* buffer, uint8_t base);
+static uint8_t __fxtoa (uint32_t mant, int16_t exp2, uint8_t neg, char* buffer, uint8_t prec);
 
 /*==============================================================================
  Global function definitions
 ==============================================================================*/
 /*------------------------------------------------------------------------------
- function name:	itoa
+ function name:	u64toa_back
+ description:		writes digits of value backwards, ending just before 'end'. Valid 'base'
+ 						in [2;16]. No terminating zero is written, value 0 gives "0".
+ 						Base 10 takes two digits per division by a constant, bases 2, 8
+ 						and 16 use shifts and masks, other bases divide per digit.
+ parameters:		end of the output buffer (at least 64 chars before it must be
+ 						writable), value for converting, conversion base, lowercase
+ 						hex digits if nonzero
+ returned value:	pointer to the first digit
+------------------------------------------------------------------------------*/
+char* u64toa_back (char* end, uint64_t value, uint8_t base, uint8_t lc)
+{
+	const char* digits = lc ? digits_lc : digits_uc;
+	char* p = end;
+
+	if (base == 10)
+	{
+		while (value > 0xffffffff)				/* 64 bit division only while needed, 9 digits at a time */
+		{
+			uint64_t quot = value / 1000000000;
+			char* q = __dec32(p, value - quot * 1000000000);
+			while (q > p - 9) *--q = '0';
+			p = q;
+			value = quot;
+		}
+		return __dec32(p, value);
+	}
+
+	if ((base == 2) || (base == 8) || (base == 16))
+	{
+		uint8_t shift = (base == 2) ? 1 : (base == 8) ? 3 : 4;
+		uint8_t mask = base - 1;
+
+		while (value > 0xffffffff)
+		{
+			*--p = digits[value & mask];
+			value >>= shift;
+		}
+		uint32_t v = value;
+		do
+		{
+			*--p = digits[v & mask];
+		} while ((v >>= shift));
+		return p;
+	}
+
+	while (value > 0xffffffff)
+	{
+		*--p = digits[value % base];
+		value /= base;
+	}
+	uint32_t v = value;
+	do
+	{
+		*--p = digits[v % base];
+	} while ((v /= base));
+	return p;
+}
+
+/*------------------------------------------------------------------------------
+ function name:	u32toa, u64toa
+ description:		converts unsigned integer to an char array. Valid 'base' in [2;16].
+ parameters:		value for converting, the output buffer (at least 33 or 65 chars),
+ 						conversion base
+ returned value:	length of the string (0 for invalid base)
+------------------------------------------------------------------------------*/
+uint8_t u32toa (uint32_t value, char* buffer, uint8_t base)
+{
+	return __ntoa(value, 0, buffer, base);
+}
+
+uint8_t u64toa (uint64_t value, char* buffer, uint8_t base)
+{
+	return __ntoa(value, 0, buffer, base);
+}
+
+/*------------------------------------------------------------------------------
+ function name:	i32toa, i64toa
  description:		converts signed integer to an char array. Valid 'base' in [2;16].
+ 						Only base == 10 values are treated as signed, other bases
+ 						convert the two's complement.
+ parameters:		value for converting, the output buffer (at least 33 or 65 chars),
+ 						conversion base
+ returned value:	length of the string (0 for invalid base)
+------------------------------------------------------------------------------*/
+uint8_t i32toa (int32_t value, char* buffer, uint8_t base)
+{
+	if ((base == 10) && (value < 0))
+	{
+		return __ntoa(-(uint32_t)value, 1, buffer, base);
+	}
+	return __ntoa((uint32_t)value, 0, buffer, base);
+}
+
+uint8_t i64toa (int64_t value, char* buffer, uint8_t base)
+{
+	if ((base == 10) && (value < 0))
+	{
+		return __ntoa(-(uint64_t)value, 1, buffer, base);
+	}
+	return __ntoa((uint64_t)value, 0, buffer, base);
+}
+
+/*------------------------------------------------------------------------------
+ function name:	itoa, ltoa, utoa, ulltoa
+ description:		the usual names for the above. Valid 'base' in [2;16].
  						Only base == 10 values are treated as signed.
  parameters:		value for converting, the output buffer, conversion base
  returned value:	pointer to the output buffer
 ------------------------------------------------------------------------------*/
 char* itoa (int value, char* buffer, int base)
 {
-	static const char digits [] = "0123456789ABCDEF";
-	char* tmpBuffer = buffer;
-	int sign = 0;
-	int quot, rem;
+	i32toa(value, buffer, base);
+	return buffer;
+}
 
-	if ( (base >= 2) && (base <= 16) )					/* check if the base is valid */
+char* ltoa (long value, char* buffer, int base)
+{
+	if (sizeof(long) > 4)
 	{
-		if (base == 10 && (sign = value) <0) 		/* check base & sign of value in the tmp copy */
-		{
-			value = -value;
-		}
+		i64toa(value, buffer, base);
+	}
+	else
+	{
+		i32toa(value, buffer, base);
+	}
+	return buffer;
+}
 
-		do										/* calculate quotient & reminder */
-		{
-			quot = value / base;
-			rem = value % base;
-			*buffer ++ = digits[rem];				/* append the reminder to the string */
-		} while ((value = quot));
+char* utoa (unsigned value, char* buffer, int base)
+{
+	u32toa(value, buffer, base);
+	return buffer;
+}
 
-		if (sign < 0)							/* if negative value add a sign */
-		{
-			*buffer++ = '-';
-		}
+char* ulltoa (unsigned long long value, char* buffer, int base)
+{
+	u64toa(value, buffer, base);
+	return buffer;
+}
+
+/*------------------------------------------------------------------------------
+ function name:	ftoa
+ description:		converts float to decimal with prec decimals (at most 9), rounded
+ 						half away from zero (exact ties like 2.5 differ from printf,
+ 						which rounds them to even). Only integer arithmetic is used, the float
+ 						is taken apart into mantissa and exponent. Magnitudes of 2^64
+ 						and more give "ovf", not-a-number "nan", infinity "inf".
+ parameters:		value for converting, the output buffer (at least FTOA_LEN chars),
+ 						number of decimals
+ returned value:	length of the string
+------------------------------------------------------------------------------*/
+uint8_t ftoa (float value, char* buffer, uint8_t prec)
+{
+	union { float f; uint32_t u; } v = { value };
+	uint8_t neg = v.u >> 31;
+	int16_t exp = (v.u >> 23) & 0xff;
+	uint32_t mant = v.u & 0x7fffff;
 
-		__reverse(tmpBuffer, buffer - 1);		/* reverse the string */
+	if (exp == 0xff)
+	{
+		char* p = buffer;
+		if (neg && !mant) *p++ = '-';
+		memcpy(p, mant ? "nan" : "inf", 4);
+		return p - buffer + 3;
 	}
 
-	*buffer = '\0';
-	return tmpBuffer;
+	if (exp == 0)							/* denormal */
+	{
+		exp = 1;
+	}
+	else
+	{
+		mant |= 0x800000;
+	}
+
+	return __fxtoa(mant, exp - 150, neg, buffer, prec);
+}
+
+/*------------------------------------------------------------------------------
+ function name:	qtoa
+ description:		converts fixed point value (value / 2^q) to decimal with prec
+ 						decimals (at most 9), rounded half away from zero
+ parameters:		value for converting, number of fractional bits (0..31),
+ 						the output buffer (at least FTOA_LEN chars), number of decimals
+ returned value:	length of the string
+------------------------------------------------------------------------------*/
+uint8_t qtoa (int32_t value, uint8_t q, char* buffer, uint8_t prec)
+{
+	if (value < 0)
+	{
+		return __fxtoa(-(uint32_t)value, -q, 1, buffer, prec);
+	}
+	return __fxtoa(value, -q, 0, buffer, prec);
 }
 
 /*==============================================================================
  Static function definitions
 ==============================================================================*/
 /*------------------------------------------------------------------------------
- function name:	__reverse
- description:		local function reversing order of a string
- parameters:		pointer to the beginning of a string, pointer to the end of a string
- returned value:	none
+ function name:	__dec32
+ description:		local function writing decimal digits backwards, two at a time
+ parameters:		end of the output, value for converting
+ returned value:	pointer to the first digit
 ------------------------------------------------------------------------------*/
+static char* __dec32 (char* end, uint32_t value)
+{
+	while (value >= 100)
+	{
+		uint32_t quot = value / 100;			/* compiles to a multiply by constant */
+		const char* d = &digits_dec2[(value - quot * 100) * 2];
+		*--end = d[1];
+		*--end = d[0];
+		value = quot;
+	}
 
-static void __reverse (char* start, char* end)
+	if (value >= 10)
+	{
+		const char* d = &digits_dec2[value * 2];
+		*--end = d[1];
+		*--end = d[0];
+	}
+	else
+	{
+		*--end = '0' + value;
+	}
+
+	return end;
+}
+
+/*------------------------------------------------------------------------------
+ function name:	__ntoa
+ description:		local function converting to a zero terminated string
+ parameters:		magnitude, nonzero to prepend a sign, the output buffer,
+ 						conversion base
+ returned value:	length of the string
+------------------------------------------------------------------------------*/
+static uint8_t __ntoa (uint64_t value, uint8_t neg, char* buffer, uint8_t base)
 {
-	char tmp;
+	char tmp[66];
+	char* end = tmp + sizeof(tmp);
+	uint8_t len = 0;
 
-	while (end > start)
+	if ((base >= 2) && (base <= 16))			/* check if the base is valid */
 	{
-		tmp = *end;						/* save end of the string int tmp variable */
-		*end-- = *start;				/* write to the end of the string its beginning */
-		*start++ = tmp;				/* and write to the beginning stuff from tmp */
+		char* p = u64toa_back(end, value, base, 0);
+		if (neg)								/* if negative value add a sign */
+		{
+			*--p = '-';
+		}
+		while (p < end)						/* short, a byte loop beats a memcpy call */
+		{
+			buffer[len++] = *p++;
+		}
 	}
+
+	buffer[len] = '\0';
+	return len;
+}
+
+/*------------------------------------------------------------------------------
+ function name:	__fxtoa
+ description:		local function converting mant * 2^exp2 to decimal
+ parameters:		mantissa, binary exponent, nonzero to prepend a sign,
+ 						the output buffer, number of decimals
+ returned value:	length of the string
+------------------------------------------------------------------------------*/
+static uint8_t __fxtoa (uint32_t mant, int16_t exp2, uint8_t neg, char* buffer, uint8_t prec)
+{
+	static const uint32_t pow10 [] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+	uint64_t ip;							/* integer part */
+	uint32_t fd = 0;						/* prec decimals as integer */
+
+	if (prec > 9) prec = 9;
+
+	if (exp2 >= 0)
+	{
+		if ((exp2 > 32) && ((exp2 >= 64) || (mant >> (64 - exp2))))	/* does not fit 64 bits */
+		{
+			char* p = buffer;
+			if (neg) *p++ = '-';
+			memcpy(p, "ovf", 4);
+			return p - buffer + 3;
+		}
+		ip = (uint64_t)mant << exp2;
+	}
+	else if (exp2 < -63)					/* less than 2^-32, rounds to 0 even with 9 decimals */
+	{
+		ip = 0;
+	}
+	else
+	{
+		uint8_t s = -exp2;
+		ip = (s < 32) ? (mant >> s) : 0;
+		uint64_t fr = (s < 32) ? (mant & ((1UL << s) - 1)) : mant;
+
+		/* fraction * 10^prec, rounded half up, fits as fr < 2^32 and 10^prec < 2^30 */
+		fd = (fr * pow10[prec] + ((uint64_t)1 << (s - 1))) >> s;
+		if (fd >= pow10[prec])				/* rounded up to the next integer */
+		{
+			fd -= pow10[prec];
+			ip++;
+		}
+	}
+
+	char tmp[FTOA_LEN];
+	char* end = tmp + sizeof(tmp);
+	char* p = end;
+	uint8_t i;
+
+	for (i = 0; i < prec; ++i)
+	{
+		*--p = '0' + fd % 10;
+		fd /= 10;
+	}
+	if (prec) *--p = '.';
+	p = u64toa_back(p, ip, 10, 0);
+	if (neg) *--p = '-';
+
+	uint8_t len = 0;
+	while (p < end)
+	{
+		buffer[len++] = *p++;
+	}
+	buffer[len] = '\0';
+	return len;
 }
 
 /******************************************************************************
 * END OF FILE
 ******************************************************************************/
-
@@ -3,7 +3,7 @@
 
 /*******************************************************************************
  * File name: 		itoa.h
- * Description: 	implementation of the missing itoa newlib function
+ * Description: 	integer to string conversions (itoa and friends)
  * Project: 		_Wzorzec
  * Target: 			LPC2478
  * Compiler: 		arm-none-eabi-gcc
@@ -15,10 +15,12 @@
 /*==============================================================================
  Includes
 ==============================================================================*/
+#include <inttypes.h>
 
 /*==============================================================================
  Defines
 ==============================================================================*/
+#define FTOA_LEN 32		/* ftoa and qtoa buffer size: sign, 20 digits, point, 9 decimals, zero */
 
 /*==============================================================================
  Globals
@@ -27,7 +29,18 @@
 /*==============================================================================
  Global function prototypes
 ==============================================================================*/
+uint8_t u32toa (uint32_t value, char* buffer, uint8_t base);
+uint8_t i32toa (int32_t value, char* buffer, uint8_t base);
+uint8_t u64toa (uint64_t value, char* buffer, uint8_t base);
+uint8_t i64toa (int64_t value, char* buffer, uint8_t base);
+char* u64toa_back (char* end, uint64_t value, uint8_t base, uint8_t lc);
+uint8_t ftoa (float value, char* buffer, uint8_t prec);
+uint8_t qtoa (int32_t value, uint8_t q, char* buffer, uint8_t prec);
+
 char* itoa (int value, char* buffer, int base);
+char* ltoa (long value, char* buffer, int base);
+char* utoa (unsigned value, char* buffer, int base);
+char* ulltoa (unsigned long long value, char* buffer, int base);
 
 
 /******************************************************************************
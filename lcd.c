@@ -13,7 +13,9 @@ driver is implemented elsewhere.
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 #include "itoa.h"
+#include "fmt.h"
 
 /** @brief LCD width */
 #define LCD_WIDTH 20
@@ -202,11 +204,11 @@ void lcd_putsn(const char* s, uint8_t n)
 */
 void lcd_puti_lc(const uint32_t a, uint8_t r, uint8_t l, char c)
 {
-	char s[10];
+	char s[34];
 
-	itoa(a, s, r);
+	uint8_t n = i32toa(a, s, r);
 
-	while( l > strlen(s) ) {
+	while( l > n ) {
 		lcd_putc(c);
 		l--;
 	}
@@ -215,17 +217,39 @@ void lcd_puti_lc(const uint32_t a, uint8_t r, uint8_t l, char c)
 }
 
 /**
-@brief Write float with specified precision.
+@brief Write float with specified precision, rounded (see ftoa in itoa.c).
 @param[in]	f		float
-@param[in]	prec	Number of decimals
+@param[in]	prec	Number of decimals (0..9)
 */
 void lcd_putf(float f, uint8_t prec)
 {
-	lcd_puti_lc(f, 10, 0, 0);
-	lcd_putc('.');
-	while( prec-- ) {
-		f = f - (int)f;
-		f = f * 10;
-		lcd_puti_lc(f, 10, 0, 0);
-	}
+	char s[FTOA_LEN];
+	ftoa(f, s, prec);
+	lcd_puts(s);
+}
+
+/** @privatesection */
+
+/**
+@brief fmt sink.
+*/
+static void lcd_sink(void* ctx, const char* s, uint16_t n)
+{
+	while( n-- ) { lcd_putc(*s++); }
+}
+
+/** @publicsection */
+
+/**
+@brief printf to LCD (without dynamic malloc), see fmt.c for supported conversions.
+@param[in]	f		Format string
+@return Number of chars written.
+*/
+int lcd_printf(const char* f, ...)
+{
+	va_list vl;
+	va_start(vl, f);
+	int r = fmt_vprintf(lcd_sink, 0, f, vl);
+	va_end(vl);
+	return r;
 }
@@ -34,6 +34,9 @@ void lcd_puti_lc(const uint32_t a, uint8_t r, uint8_t l, char c);
 // write a float to the lcd with prec decimals
 void lcd_putf(float f, uint8_t prec);
 
+// printf to lcd
+int lcd_printf(const char* f, ...);
+
 // lcd backlight
 void lcd_bl(uint8_t on);
 
@@ -0,0 +1,170 @@
+/**
+
+A fifo any number of producers (ISRs of any priority and the main loop) can put to without
+masking interrupts, and a single consumer gets from.
+
+Every slot starts with a sequence word followed by the element. A producer reserves a slot by
+advancing tail with an exclusive load/store pair (LDREX/STREX), copies the element in and then
+publishes it by writing the slot's sequence word. An interrupt taken between LDREX and STREX
+clears the exclusive monitor, so a preempted producer simply retries with the next slot and
+higher priority producers are never blocked. The consumer only takes a slot once its sequence
+word says it has been published. If a low priority producer is preempted after reserving a
+slot, elements behind it become available once it completes.
+
+On non ARM builds (i.e. when testing on a PC) the same algorithm uses the compiler's atomic
+builtins.
+
+@file		mpfifo.c
+@brief		Lock-free multi producer, single consumer fifo
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+*/
+
+#include "mpfifo.h"
+#include <string.h>
+
+#ifdef __arm__
+#include "stm32f10x.h"
+#endif
+
+/** @privatesection */
+
+/**
+@brief Compare and swap.
+@param[in]	p		Pointer to word
+@param[in]	o		Expected value
+@param[in]	n		New value
+@return True if *p was o and has been set to n, false otherwise.
+*/
+static inline uint8_t mpfifo_cas(volatile uint32_t* p, const uint32_t o, const uint32_t n)
+{
+#ifdef __arm__
+	do {
+		if( __LDREXW(p) != o ) {
+			__CLREX();
+			return 0;
+		}
+	} while( __STREXW(n, p) );
+	return 1;
+#else
+	uint32_t e = o;
+	return __atomic_compare_exchange_n(p, &e, n, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/**
+@brief Memory barrier.
+*/
+static inline void mpfifo_dmb(void)
+{
+#ifdef __arm__
+	__DMB();
+#else
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+/**
+@brief Get slot for a sequence number.
+*/
+static inline uint8_t* mpfifo_slot(volatile struct mpfifo_t* f, const uint32_t pos)
+{
+	return f->buf + (pos & (f->size - 1)) * f->stride;
+}
+
+/** @publicsection */
+
+/**
+@brief Initializes (clears) fifo.
+
+Must not be called while producers or the consumer are active.
+@param[in]	f		Pointer to mpfifo_t struct where fifo state will be kept
+@param[in]	p		Pointer to word aligned buffer for slots
+@param[in]	s		sizeof(p), use MPFIFO_BUFSIZE to calculate
+@param[in]	e		sizeof(element)
+@return Number of slots (s rounded down to a power of two number of slots), 0 if fewer than two fit.
+*/
+uint16_t mpfifo_clear(volatile struct mpfifo_t* f, void* const p, const uint16_t s, const uint16_t e)
+{
+	f->buf = p;
+	f->elem = e;
+	f->stride = 4 + ((e + 3) & ~3);
+
+	uint16_t n = s / f->stride;
+	f->size = 1;
+	while( (f->size << 1) <= n ) { f->size <<= 1; }
+	if( n < 2 ) { f->size = 0; }	// with one slot a published element looks free to the next producer
+
+	uint16_t i;
+	for( i = 0; i < f->size; ++i ) {
+		*(volatile uint32_t*)mpfifo_slot(f, i) = i;
+	}
+
+	f->head = 0;
+	f->tail = 0;
+
+	mpfifo_dmb();
+	return f->size;
+}
+
+/**
+@brief Insert an element. Can be called from any context.
+@param[in]	f		Pointer to mpfifo_t
+@param[in]	d		Data to insert
+@return True on success, false otherwise (buffer full, or no slots).
+*/
+uint8_t mpfifo_put(volatile struct mpfifo_t* f, const void* d)
+{
+	if( f->size == 0 ) { return 0; }
+
+	uint32_t pos = f->tail;
+	uint8_t* slot;
+
+	while( 1 ) {
+		slot = mpfifo_slot(f, pos);
+		int32_t dif = *(volatile uint32_t*)slot - pos;
+
+		if( dif == 0 ) {
+			if( mpfifo_cas(&f->tail, pos, pos + 1) ) { break; }	// slot reserved
+		} else
+		if( dif < 0 ) {
+			return 0;	// slot still holds an unread element, buffer full
+		}
+
+		pos = f->tail;	// someone else took the slot, try the next one
+	}
+
+	memcpy(slot + 4, d, f->elem);
+	mpfifo_dmb();	// data must be in place before the slot is published
+	*(volatile uint32_t*)slot = pos + 1;
+
+	return 1;
+}
+
+/**
+@brief Get next element. Must only be called by a single consumer.
+@param[in]	f		Pointer to mpfifo_t
+@param[out]	d		Pointer to buffer where next element is put.
+@return True on success (data copied to d), false otherwise (buffer empty).
+*/
+uint8_t mpfifo_get(volatile struct mpfifo_t* f, void* const d)
+{
+	if( f->size == 0 ) { return 0; }
+
+	uint32_t pos = f->head;
+	uint8_t* slot = mpfifo_slot(f, pos);
+
+	if( *(volatile uint32_t*)slot != pos + 1 ) {
+		return 0;	// empty or next element not yet published
+	}
+
+	if( d ) {	// if d is null, mpfifo_get can be used to check for data in buffer
+		memcpy(d, slot + 4, f->elem);
+		mpfifo_dmb();	// data must be read before the slot is handed back to producers
+		*(volatile uint32_t*)slot = pos + f->size;
+		f->head = pos + 1;
+	}
+
+	return 1;
+}
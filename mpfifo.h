@@ -0,0 +1,24 @@
+#ifndef MAT_MPFIFO_H
+#define MAT_MPFIFO_H
+
+#include <inttypes.h>
+
+/** Multi producer fifo state struct */
+struct mpfifo_t
+{
+	uint8_t* buf;	/**< pointer to slot buffer */
+	uint32_t tail;	/**< next slot to reserve (free running, shared by producers) */
+	uint32_t head;	/**< next slot to read (free running, owned by consumer) */
+	uint16_t size;	/**< number of slots (power of two) */
+	uint16_t elem;	/**< single element size */
+	uint16_t stride;	/**< slot size (sequence word + element, word aligned) */
+};
+
+/** Size of caller allocated buffer needed for n elements of size e (n must be a power of two, at least 2) */
+#define MPFIFO_BUFSIZE(n, e) ((n) * (4 + (((e) + 3) & ~3)))
+
+uint16_t mpfifo_clear(volatile struct mpfifo_t* f, void* const p, const uint16_t s, const uint16_t e);
+uint8_t mpfifo_put(volatile struct mpfifo_t* f, const void* d);
+uint8_t mpfifo_get(volatile struct mpfifo_t* f, void* const d);
+
+#endif
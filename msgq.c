@@ -0,0 +1,325 @@
+/**
+
+A queue of variable length records (CAN frames, UDP payloads, log lines...) in a single byte
+buffer, kept the same way as circbuf8. Every record is preceded by a 2 byte length header, so
+small records take only as much space as they need instead of a worst case fifo slot.
+
+Records are never split at the end of the buffer. If a record does not fit between tail and
+the end of the buffer, the remaining bytes become padding (marked with a MSGQ_PAD header if
+there is room for one) and the record is placed at the start. This way every record can be
+accessed in place with msgq_reserve/msgq_commit and msgq_peek/msgq_drop.
+
+@file		msgq.c
+@brief		Variable length record queue. Interrupt safe.
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+@note		In MSGQ_OVERWRITE mode puts never fail (unless the record is larger than the buffer), whole oldest records are dropped (and counted in drop) instead.
+While the consumer holds the oldest record from msgq_peek, a new record that does not fit is dropped instead.
+*/
+
+#include "stm32f10x.h"
+#include "msgq.h"
+#include <string.h>
+
+/** @privatesection */
+
+#define MSGQ_PAD 0xffff	/**< header value marking padding up to the end of buffer */
+#define MSGQ_NONE 0xffff	/**< no room for record */
+
+static inline uint16_t msgq_rdhdr(volatile struct msgq_t* q, const uint16_t p)
+{
+	return q->buf[p] | (q->buf[p+1] << 8);
+}
+
+static inline void msgq_wrhdr(volatile struct msgq_t* q, const uint16_t p, const uint16_t h)
+{
+	q->buf[p] = h;
+	q->buf[p+1] = h >> 8;
+}
+
+/**
+@brief Skip padding at head. Call with interrupts disabled and cnt > 0.
+*/
+static void msgq_skip(volatile struct msgq_t* q)
+{
+	uint16_t e = q->size - q->head;
+	if( (e < MSGQ_HDR) || (msgq_rdhdr(q, q->head) == MSGQ_PAD) ) {
+		q->len -= e;
+		q->head = 0;
+	}
+}
+
+/**
+@brief Remove the record at head. Call with interrupts disabled and cnt > 0.
+
+Padding following it is skipped too, so its room is free at once.
+*/
+static void msgq_remove(volatile struct msgq_t* q)
+{
+	msgq_skip(q);
+	uint16_t n = MSGQ_HDR + msgq_rdhdr(q, q->head);
+	q->head += n;
+	if( q->head == q->size ) { q->head = 0; }
+	q->len -= n;
+	q->cnt--;
+	q->peek = 0;
+	if( q->cnt ) { msgq_skip(q); }
+}
+
+/**
+@brief Find room for a record. Call with interrupts disabled.
+@param[in]	q		Pointer to msgq_t
+@param[in]	n		Record length
+@return Header position of the record, MSGQ_NONE if there is no room.
+*/
+static uint16_t msgq_fit(volatile struct msgq_t* q, const uint16_t n)
+{
+	if( q->len == 0 ) {	// empty, start at the beginning for the most contiguous room
+		q->head = 0;
+		q->tail = 0;
+	}
+
+	uint32_t r = MSGQ_HDR + n;
+	uint16_t fr = q->size - q->len;
+	uint16_t e = q->size - q->tail;
+
+	if( e >= r ) {
+		return (fr >= r) ? q->tail : MSGQ_NONE;
+	}
+	return (fr >= e + r) ? 0 : MSGQ_NONE;	// pad to the end and wrap
+}
+
+/**
+@brief Find room for a record, dropping old records in MSGQ_OVERWRITE mode. Call with interrupts disabled.
+*/
+static uint16_t msgq_alloc(volatile struct msgq_t* q, const uint16_t n)
+{
+	if( (uint32_t)MSGQ_HDR + n > q->size ) {
+		return MSGQ_NONE;
+	}
+
+	uint16_t p = msgq_fit(q, n);
+	while( (p == MSGQ_NONE) && (q->mode == MSGQ_OVERWRITE) && q->cnt && !q->peek ) {
+		msgq_remove(q);
+		q->drop++;
+		p = msgq_fit(q, n);
+	}
+
+	return p;
+}
+
+/**
+@brief Insert record at position p (as returned by msgq_alloc). Call with interrupts disabled.
+*/
+static void msgq_insert(volatile struct msgq_t* q, const uint16_t p, const uint16_t n)
+{
+	if( q->cnt == 0 ) {	// emptied since a msgq_reserve, no padding needed
+		q->head = p;
+		q->tail = p;
+	}
+	if( p != q->tail ) {	// wrapped, the rest of buffer is padding
+		uint16_t e = q->size - q->tail;
+		if( e >= MSGQ_HDR ) { msgq_wrhdr(q, q->tail, MSGQ_PAD); }
+		q->len += e;
+	}
+
+	msgq_wrhdr(q, p, n);
+	q->tail = p + MSGQ_HDR + n;
+	if( q->tail == q->size ) { q->tail = 0; }
+	q->len += MSGQ_HDR + n;
+	q->cnt++;
+}
+
+/** @publicsection */
+
+/**
+@brief Initializes (clears) message queue.
+
+Use the msgq_clear macro for the default MSGQ_BLOCK mode.
+@param[in]	q		Pointer to msgq_t struct where queue state will be kept
+@param[in]	p		Pointer to byte array for data
+@param[in]	s		sizeof(p)
+@param[in]	m		Mode, MSGQ_BLOCK or MSGQ_OVERWRITE
+*/
+void msgq_clear_m(volatile struct msgq_t* q, uint8_t* const p, const uint16_t s, const uint8_t m)
+{
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	q->buf = p;
+	q->size = s;
+	q->head = 0;
+	q->tail = 0;
+	q->len = 0;
+	q->cnt = 0;
+	q->rpos = MSGQ_NONE;
+	q->rlen = 0;
+	q->mode = m;
+	q->drop = 0;
+	q->peek = 0;
+
+	__set_PRIMASK(g);
+}
+
+/**
+@brief Insert a record.
+@param[in]	q		Pointer to msgq_t
+@param[in]	d		Record data
+@param[in]	n		Record length
+@return True on success, false otherwise (no room). In MSGQ_OVERWRITE mode only false if the
+record is larger than the buffer, a record dropped because the oldest one is peeked counts as success.
+*/
+uint8_t msgq_put(volatile struct msgq_t* q, const void* d, const uint16_t n)
+{
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	uint16_t p = msgq_alloc(q, n);
+	if( p == MSGQ_NONE ) {
+		uint8_t r = 0;
+		if( (q->mode == MSGQ_OVERWRITE) && q->peek && ((uint32_t)MSGQ_HDR + n <= q->size) ) {
+			q->drop++;	// the oldest one is peeked, drop the new one
+			r = 1;
+		}
+		__set_PRIMASK(g);
+		return r;
+	}
+
+	memcpy(q->buf + p + MSGQ_HDR, d, n);
+	msgq_insert(q, p, n);
+
+	__set_PRIMASK(g);
+	return 1;
+}
+
+/**
+@brief Get next record.
+
+A record longer than the caller's buffer is cut short, the rest of it is lost.
+@param[in]	q		Pointer to msgq_t
+@param[out]	d		Pointer to buffer where the record is copied
+@param[in,out]	n	In: size of d, out: record length
+@return True on success, false otherwise (queue empty).
+*/
+uint8_t msgq_get(volatile struct msgq_t* q, void* const d, uint16_t* const n)
+{
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	if( q->cnt == 0 ) {
+		__set_PRIMASK(g);
+		return 0;
+	}
+
+	msgq_skip(q);
+	uint16_t l = msgq_rdhdr(q, q->head);
+	memcpy(d, q->buf + q->head + MSGQ_HDR, (l < *n) ? l : *n);
+	*n = l;
+	msgq_remove(q);
+
+	__set_PRIMASK(g);
+	return 1;
+}
+
+/**
+@brief Reserve room for a record of up to n bytes for in place writing.
+
+The record is not inserted until msgq_commit is called. Only one reservation may be outstanding,
+so reserve/commit should only be used by a single producer. In MSGQ_OVERWRITE mode old records are
+dropped to make room, but not the one the consumer holds from msgq_peek.
+@param[in]	q		Pointer to msgq_t
+@param[in]	n		Max record length
+@return Pointer to n contiguous bytes inside buf, 0 if no room.
+*/
+void* msgq_reserve(volatile struct msgq_t* q, const uint16_t n)
+{
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	void* r = 0;
+	q->rpos = msgq_alloc(q, n);
+	if( q->rpos != MSGQ_NONE ) {
+		q->rlen = n;
+		r = q->buf + q->rpos + MSGQ_HDR;
+	}
+
+	__set_PRIMASK(g);
+	return r;
+}
+
+/**
+@brief Insert the record previously obtained with msgq_reserve.
+@param[in]	q		Pointer to msgq_t
+@param[in]	n		Actual record length (not more than reserved)
+*/
+void msgq_commit(volatile struct msgq_t* q, uint16_t n)
+{
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	if( q->rpos != MSGQ_NONE ) {
+		if( n > q->rlen ) { n = q->rlen; }
+		msgq_insert(q, q->rpos, n);
+		q->rpos = MSGQ_NONE;
+	}
+
+	__set_PRIMASK(g);
+}
+
+/**
+@brief Access the next record in place.
+
+The record stays in the queue until msgq_drop is called. Peek/drop should only be used
+by a single consumer. Until then, MSGQ_OVERWRITE mode does not drop it to make room, so msgq_drop
+removes the same record; a new record that does not fit is dropped instead.
+@param[in]	q		Pointer to msgq_t
+@param[out]	n		Record length
+@return Pointer to the next record inside buf, 0 if queue empty.
+*/
+void* msgq_peek(volatile struct msgq_t* q, uint16_t* const n)
+{
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	void* r = 0;
+	if( q->cnt ) {
+		msgq_skip(q);
+		*n = msgq_rdhdr(q, q->head);
+		r = q->buf + q->head + MSGQ_HDR;
+		q->peek = 1;
+	}
+
+	__set_PRIMASK(g);
+	return r;
+}
+
+/**
+@brief Remove the next record (i.e. the one obtained with msgq_peek) without copying it.
+@param[in]	q		Pointer to msgq_t
+@return True if a record was removed, false otherwise (queue empty).
+*/
+uint8_t msgq_drop(volatile struct msgq_t* q)
+{
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	uint8_t r = 0;
+	if( q->cnt ) {
+		msgq_remove(q);
+		r = 1;
+	}
+
+	__set_PRIMASK(g);
+	return r;
+}
+
+/**
+@brief Number of records in queue.
+@param[in]	q		Pointer to msgq_t
+@return Number of records.
+*/
+uint16_t msgq_count(volatile struct msgq_t* q)
+{
+	return q->cnt;
+}
@@ -0,0 +1,39 @@
+#ifndef MAT_MSGQ_H
+#define MAT_MSGQ_H
+
+#include <inttypes.h>
+
+/** Message queue state struct */
+struct msgq_t
+{
+	uint8_t* buf;	/**< pointer to data buffer */
+	uint16_t head;	/**< current head (header of the oldest record or padding) */
+	uint16_t tail;	/**< current tail (where the next record or padding goes) */
+	uint16_t len;	/**< number of bytes currently used, including headers and padding */
+	uint16_t size;	/**< size of buf */
+	uint16_t cnt;	/**< number of records currently in queue */
+	uint16_t rpos;	/**< header position of the outstanding reservation */
+	uint16_t rlen;	/**< length of the outstanding reservation */
+	uint8_t mode;	/**< behaviour when full, MSGQ_BLOCK or MSGQ_OVERWRITE */
+	uint8_t peek;	/**< oldest record handed out by msgq_peek, not to be dropped */
+	uint32_t drop;	/**< number of records dropped in MSGQ_OVERWRITE mode */
+};
+
+#define MSGQ_BLOCK 0	/**< put fails when buffer full */
+#define MSGQ_OVERWRITE 1	/**< put drops the oldest records when buffer full */
+
+#define MSGQ_HDR 2	/**< per record overhead in bytes */
+
+void msgq_clear_m(volatile struct msgq_t* q, uint8_t* const p, const uint16_t s, const uint8_t m);
+#define msgq_clear(q, p, s) msgq_clear_m(q, p, s, MSGQ_BLOCK)
+uint8_t msgq_put(volatile struct msgq_t* q, const void* d, const uint16_t n);
+uint8_t msgq_get(volatile struct msgq_t* q, void* const d, uint16_t* const n);
+
+void* msgq_reserve(volatile struct msgq_t* q, const uint16_t n);
+void msgq_commit(volatile struct msgq_t* q, uint16_t n);
+void* msgq_peek(volatile struct msgq_t* q, uint16_t* const n);
+uint8_t msgq_drop(volatile struct msgq_t* q);
+
+uint16_t msgq_count(volatile struct msgq_t* q);
+
+#endif
@@ -0,0 +1,84 @@
+/**
+
+DECLARE_RING(name, type, size) generates a statically sized ring buffer of elements of the
+given type together with its own set of inline put/get routines. Since size is a compile time
+power of two, index wrapping is a mask and element copies are plain struct assignments, which
+the compiler turns into word moves instead of a memcpy call.
+
+Head and tail are free running 16 bit counters, so size must be a power of two not larger than
+32768. The producer only writes tail and the consumer only writes head, which makes the ring
+interrupt safe without masking interrupts as long as there is a single producer and a single
+consumer. With more producers (or consumers) the caller must serialize access.
+
+Example:
+@code
+DECLARE_RING(evq, struct event, 16)
+static evq_t events;
+...
+evq_put(&events, &e);
+...
+if( evq_get(&events, &e) ) { ... }
+@endcode
+
+@file		ring.h
+@brief		Compile time sized, typed ring buffers
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+*/
+
+#ifndef MAT_RING_H
+#define MAT_RING_H
+
+#include <inttypes.h>
+#include "stm32f10x.h"
+
+/** Declare ring buffer type name_t holding size elements of type, and its name_* routines */
+#define DECLARE_RING(name, type, size) \
+\
+typedef struct \
+{ \
+	type buf[size]; \
+	volatile uint16_t head; \
+	volatile uint16_t tail; \
+} name##_t; \
+\
+static inline void name##_size_check(void) \
+{ \
+	switch(0) {case 0:case ((size) > 0) && ((size) <= 32768) && (((size) & ((size)-1)) == 0):;} \
+} \
+\
+static inline void name##_clear(name##_t* r) \
+{ \
+	r->head = 0; \
+	r->tail = 0; \
+} \
+\
+static inline uint16_t name##_len(name##_t* r) \
+{ \
+	return (uint16_t)(r->tail - r->head); \
+} \
+\
+static inline uint8_t name##_put(name##_t* r, const type* d) \
+{ \
+	uint16_t t = r->tail; \
+	if( (uint16_t)(t - r->head) == (size) ) return 0; \
+	r->buf[t & ((size)-1)] = *d; \
+	__DMB(); \
+	r->tail = t + 1; \
+	return 1; \
+} \
+\
+static inline uint8_t name##_get(name##_t* r, type* d) \
+{ \
+	uint16_t h = r->head; \
+	if( h == r->tail ) return 0; \
+	if( d ) { \
+		*d = r->buf[h & ((size)-1)]; \
+		__DMB(); \
+		r->head = h + 1; \
+	} \
+	return 1; \
+}
+
+#endif
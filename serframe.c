@@ -0,0 +1,350 @@
+/**
+
+Framed binary channels over a serialq port. Every frame carries a channel number, the payload and
+a CRC-16 (CCITT, init 0xffff, over channel and payload), is COBS encoded so it contains no zero bytes
+and ends with a zero delimiter. A receiver can therefore always resynchronize on the next zero,
+and several logical channels (i.e. control, telemetry, log text) can share one USART without
+corrupting each other.
+
+Each TX channel has its own msgq (see msgq.c) of encoded frames, provided by the caller. sfr_tx
+writes frames to the serialq TX queue, always picking the next frame from the highest priority
+(lowest numbered) channel that has one. A frame is never interrupted by another one, so the most
+lower priority data ahead of a control frame is one frame plus what is already in the serialq TX
+queue. Keep that queue small (about two frames) for low latency, the channel queues hold the backlog.
+
+sfr_tx does not wait. sfr_send calls it, otherwise call it from the main loop or from
+ser_txspace_callback (build serialq with SER_TXSPACE_INT), which makes the transmission interrupt
+driven. It may be called from both, a call that finds it already running just makes it go round
+once more. Each channel may only be sent to from one context.
+
+sfr_recv takes frames straight from the serialq RX queue with ser_read_until, decodes them in
+place and checks the CRC. Frames that are too long for the caller's buffer, badly encoded or fail
+the CRC check are dropped and counted.
+
+@file		serframe.c
+@brief		COBS framed channels with CRC over serialq
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+*/
+
+#include <string.h>
+#include <stdarg.h>
+
+#include "stm32f10x.h"
+#include "serframe.h"
+#include "serialq.h"
+#include "fmt.h"
+
+/** @privatesection */
+
+/** COBS encoder state */
+struct sfr_enc_t
+{
+	uint8_t* d;	/**< output */
+	uint16_t n;	/**< output length */
+	uint16_t code;	/**< position of the current block's code byte */
+};
+
+static inline void sfr_enc_start(struct sfr_enc_t* e, uint8_t* d)
+{
+	e->d = d;
+	e->code = 0;
+	e->n = 1;
+}
+
+/**
+@brief COBS encode n bytes, appending them to the output.
+*/
+static void sfr_enc_put(struct sfr_enc_t* e, const uint8_t* p, uint16_t n)
+{
+	uint8_t* d = e->d;
+	uint16_t o = e->n;
+	uint16_t c = e->code;
+
+	while( n-- ) {
+		uint8_t b = *p++;
+		if( b == 0 ) {
+			d[c] = o - c;
+			c = o++;
+		} else {
+			d[o++] = b;
+			if( o - c == 0xff ) {	// block of 254 non-zero bytes, no zero implied
+				d[c] = 0xff;
+				c = o++;
+			}
+		}
+	}
+
+	e->n = o;
+	e->code = c;
+}
+
+/**
+@brief Finish the last block and append the delimiter.
+@return Encoded length, including delimiter.
+*/
+static inline uint16_t sfr_enc_end(struct sfr_enc_t* e)
+{
+	e->d[e->code] = e->n - e->code;
+	e->d[e->n++] = 0;
+	return e->n;
+}
+
+/** sfr_printf buffer */
+struct sfr_pbuf_t
+{
+	uint16_t n;	/**< bytes in b */
+	char b[SFR_PRINTF_LEN];
+};
+
+/**
+@brief fmt sink, collects output to a sfr_pbuf_t, cutting it short when full.
+*/
+static void sfr_sink(void* ctx, const char* s, uint16_t n)
+{
+	struct sfr_pbuf_t* pb = ctx;
+	uint16_t f = sizeof(pb->b) - pb->n;
+	if( n > f ) { n = f; }
+	memcpy(pb->b + pb->n, s, n);
+	pb->n += n;
+}
+
+/** @publicsection */
+
+/**
+@brief Update CRC-16/CCITT.
+@param[in]	crc			Initial value (0xffff) or CRC so far
+@param[in]	p			Data
+@param[in]	n			Number of bytes
+@return Updated CRC. Over data followed by its CRC (MSB first) it is 0.
+*/
+uint16_t sfr_crc16(uint16_t crc, const void* p, uint16_t n)
+{
+	const uint8_t* b = p;
+
+	while( n-- ) {
+		crc = (crc >> 8) | (crc << 8);
+		crc ^= *b++;
+		crc ^= (crc & 0xff) >> 4;
+		crc ^= crc << 12;
+		crc ^= (crc & 0xff) << 5;
+	}
+
+	return crc;
+}
+
+/**
+@brief Encode a frame.
+@param[out]	d			Buffer for the encoded frame, at least SFR_ENCLEN(n) bytes
+@param[in]	ch			Channel
+@param[in]	p			Payload
+@param[in]	n			Payload length
+@return Encoded frame length, including delimiter.
+*/
+uint16_t sfr_encode(uint8_t* d, const uint8_t ch, const void* p, const uint16_t n)
+{
+	uint16_t crc = sfr_crc16(0xffff, &ch, 1);
+	crc = sfr_crc16(crc, p, n);
+	uint8_t c[2] = {crc >> 8, crc};
+
+	struct sfr_enc_t e;
+	sfr_enc_start(&e, d);
+	sfr_enc_put(&e, &ch, 1);
+	sfr_enc_put(&e, p, n);
+	sfr_enc_put(&e, c, 2);
+	return sfr_enc_end(&e);
+}
+
+/**
+@brief Decode a frame in place.
+@param[in,out]	p		Encoded frame (with or without delimiter), decoded payload on return
+@param[in]	n			Encoded frame length
+@param[out]	ch			Channel
+@return Payload length or SFR_EEMPTY, SFR_EBAD, SFR_ECRC.
+*/
+uint16_t sfr_decode(uint8_t* p, uint16_t n, uint8_t* const ch)
+{
+	if( n && (p[n-1] == 0) ) { n--; }
+	if( n == 0 ) { return SFR_EEMPTY; }
+
+	uint16_t i = 0, o = 0;
+	while( i < n ) {
+		uint8_t c = p[i++];
+		if( (c == 0) || (c - 1 > n - i) ) { return SFR_EBAD; }
+		uint8_t k;
+		for( k = 1; k < c; ++k ) {
+			uint8_t b = p[i++];
+			if( b == 0 ) { return SFR_EBAD; }
+			p[o++] = b;
+		}
+		if( (c != 0xff) && (i < n) ) { p[o++] = 0; }	// block ended by a zero, except the last one
+	}
+
+	if( o < 3 ) { return SFR_EBAD; }
+	if( sfr_crc16(0xffff, p, o) ) { return SFR_ECRC; }
+
+	*ch = p[0];
+	o -= 3;
+	memmove(p, p + 1, o);
+	return o;
+}
+
+/**
+@brief Init framed channels.
+
+The TX queues have to be cleared by the caller (msgq_clear) and must not be used otherwise.
+@param[in]	sf			Pointer to sfr_t struct where state will be kept
+@param[in]	devnum		serialq USART peripheral number, initialized by the caller
+@param[in]	txq			Array of nch TX queues, index 0 has the highest priority
+@param[in]	nch			Number of TX channels
+*/
+void sfr_init(struct sfr_t* sf, const uint8_t devnum, volatile struct msgq_t* txq, const uint8_t nch)
+{
+	sf->devnum = devnum;
+	sf->nch = nch;
+	sf->txq = txq;
+	sf->txch = SFR_NONE;
+	sf->txoff = 0;
+	sf->txbusy = 0;
+	sf->txagain = 0;
+	sf->txdrop = 0;
+	sf->rxbad = 0;
+	sf->rxcrc = 0;
+}
+
+/**
+@brief Queue a frame for transmission, do not wait.
+@param[in]	sf			Pointer to sfr_t
+@param[in]	ch			Channel (0..nch-1)
+@param[in]	p			Payload
+@param[in]	n			Payload length
+@return True if queued, false otherwise (channel's TX queue full).
+*/
+uint8_t sfr_send(struct sfr_t* sf, const uint8_t ch, const void* p, const uint16_t n)
+{
+	volatile struct msgq_t* q = &sf->txq[ch];
+
+	uint8_t* d = msgq_reserve(q, SFR_ENCLEN(n));
+	if( d == 0 ) {
+		sf->txdrop++;
+		return 0;
+	}
+	msgq_commit(q, sfr_encode(d, ch, p, n));
+
+	sfr_tx(sf);
+	return 1;
+}
+
+/**
+@brief printf a frame (without dynamic malloc), see fmt.c for supported conversions.
+
+Output longer than SFR_PRINTF_LEN is cut short.
+@param[in]	sf			Pointer to sfr_t
+@param[in]	ch			Channel (0..nch-1)
+@param[in]	f			Format
+@return Number of chars in frame, 0 if channel's TX queue full.
+*/
+int sfr_printf(struct sfr_t* sf, const uint8_t ch, const char* f, ...)
+{
+	struct sfr_pbuf_t pb;
+	pb.n = 0;
+
+	va_list vl;
+	va_start(vl, f);
+	fmt_vprintf(sfr_sink, &pb, f, vl);
+	va_end(vl);
+
+	return sfr_send(sf, ch, pb.b, pb.n) ? pb.n : 0;
+}
+
+/** @privatesection */
+
+/**
+@brief Write queued frames to serialq until its TX queue is full or no frames are left.
+*/
+static void sfr_txpump(struct sfr_t* sf)
+{
+	while( 1 ) {
+		if( sf->txch == SFR_NONE ) {	// pick the highest priority channel with a frame
+			uint8_t ch = 0;
+			while( (ch < sf->nch) && (msgq_count(&sf->txq[ch]) == 0) ) { ch++; }
+			if( ch == sf->nch ) { break; }
+			sf->txch = ch;
+			sf->txoff = 0;
+		}
+
+		volatile struct msgq_t* q = &sf->txq[sf->txch];
+		uint16_t n;
+		uint8_t* p = msgq_peek(q, &n);
+		uint16_t w = ser_write(sf->devnum, p + sf->txoff, n - sf->txoff);
+		sf->txoff += w;
+		if( sf->txoff < n ) { break; }	// serialq full, continue this frame next time
+
+		msgq_drop(q);
+		sf->txch = SFR_NONE;
+	}
+}
+
+/** @publicsection */
+
+/**
+@brief Move queued frames to serialq, do not wait.
+@param[in]	sf			Pointer to sfr_t
+*/
+void sfr_tx(struct sfr_t* sf)
+{
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	if( sf->txbusy ) {	// interrupted sfr_tx will go round once more
+		sf->txagain = 1;
+		__set_PRIMASK(g);
+		return;
+	}
+	sf->txbusy = 1;
+	__set_PRIMASK(g);
+
+	while( 1 ) {
+		sfr_txpump(sf);
+
+		g = __get_PRIMASK();
+		__disable_irq();
+		if( !sf->txagain ) {
+			sf->txbusy = 0;
+			__set_PRIMASK(g);
+			break;
+		}
+		sf->txagain = 0;
+		__set_PRIMASK(g);
+	}
+}
+
+/**
+@brief Get a received frame.
+@param[in]	sf			Pointer to sfr_t
+@param[out]	ch			Channel
+@param[out]	buf			Buffer where the payload is put, decoding needs SFR_ENCLEN(payload length) bytes
+@param[in,out]	n		In: sizeof(buf), out: payload length
+@return True if a frame has been put to buf, false otherwise (no complete frame).
+*/
+uint8_t sfr_recv(struct sfr_t* sf, uint8_t* const ch, uint8_t* buf, uint16_t* const n)
+{
+	while( 1 ) {
+		uint16_t l = ser_read_until(sf->devnum, 0, buf, *n);
+		if( l == 0 ) { return 0; }
+
+		if( buf[l-1] != 0 ) {	// too long for buf (or RX queue full without delimiter)
+			sf->rxbad++;
+			continue;
+		}
+
+		l = sfr_decode(buf, l, ch);
+		if( l == SFR_EEMPTY ) { continue; }
+		if( l == SFR_EBAD ) { sf->rxbad++; continue; }
+		if( l == SFR_ECRC ) { sf->rxcrc++; continue; }
+
+		*n = l;
+		return 1;
+	}
+}
@@ -0,0 +1,45 @@
+#ifndef MAT_SERFRAME_H
+#define MAT_SERFRAME_H
+
+#include <inttypes.h>
+#include "msgq.h"
+
+/** Max encoded frame length (including delimiter) of n bytes payload */
+#define SFR_ENCLEN(n) ((n) + 3 + ((n) + 3) / 254 + 2)
+
+#define SFR_NONE 0xff	/**< no channel */
+
+#define SFR_EEMPTY 0xffff	/**< sfr_decode: empty frame (i.e. a resync delimiter) */
+#define SFR_EBAD 0xfffe	/**< sfr_decode: invalid encoding or too short */
+#define SFR_ECRC 0xfffd	/**< sfr_decode: CRC mismatch */
+
+#ifndef SFR_PRINTF_LEN
+#define SFR_PRINTF_LEN 64	/**< sfr_printf buffer size, longer output is cut short */
+#endif
+
+/** Framed channel state struct */
+struct sfr_t
+{
+	uint8_t devnum;	/**< serialq USART peripheral number */
+	uint8_t nch;	/**< number of TX channels */
+	volatile struct msgq_t* txq;	/**< TX queues of encoded frames, one per channel, index 0 has the highest priority */
+	volatile uint8_t txch;	/**< channel of the frame being written to serialq, SFR_NONE if none */
+	volatile uint16_t txoff;	/**< number of bytes of that frame already written */
+	volatile uint8_t txbusy;	/**< true while sfr_tx is running */
+	volatile uint8_t txagain;	/**< sfr_tx was called while running */
+	uint32_t txdrop;	/**< frames not sent because their TX queue was full */
+	uint32_t rxbad;	/**< frames dropped because of invalid encoding or length */
+	uint32_t rxcrc;	/**< frames dropped because of CRC mismatch */
+};
+
+uint16_t sfr_crc16(uint16_t crc, const void* p, uint16_t n);
+uint16_t sfr_encode(uint8_t* d, const uint8_t ch, const void* p, const uint16_t n);
+uint16_t sfr_decode(uint8_t* p, uint16_t n, uint8_t* const ch);
+
+void sfr_init(struct sfr_t* sf, const uint8_t devnum, volatile struct msgq_t* txq, const uint8_t nch);
+uint8_t sfr_send(struct sfr_t* sf, const uint8_t ch, const void* p, const uint16_t n);
+int sfr_printf(struct sfr_t* sf, const uint8_t ch, const char* f, ...);
+void sfr_tx(struct sfr_t* sf);
+uint8_t sfr_recv(struct sfr_t* sf, uint8_t* const ch, uint8_t* buf, uint16_t* const n);
+
+#endif
@@ -3,6 +3,49 @@
 All USART data transmission is interrupt driven. Received data is put into a FIFO (provided by circbuf8.c).
 Data to be transmitted is likewise put into a FIFO. Memory for both FIFOs is provided by the caller on init.
 
+Each queue has exactly one ISR side and one thread side, so the library can be built with CBUF8_SPSC
+to avoid masking interrupts on every byte. This holds as long as a port is written to (and read from)
+by a single context only. SER_RX_DMA can not be combined with CBUF8_SPSC, see cbuf8_commit.
+
+Define SER_TX_DMA as a bitmask of ports (bit 0 for USART1, bit 1 for USART2, bit 2 for USART3) to
+transmit on those ports with DMA instead of one TXE interrupt per byte. The largest contiguous span of
+the TX queue is handed to the port's DMA channel (DMA1 channel 4, 7 and 2 respectively) and removed from
+the queue on transfer complete, when the next span is started. This takes one interrupt per span.
+The DMA channel interrupt handler of such a port is defined here, so the channel can not be used
+by anything else.
+
+Likewise define SER_RX_DMA as a bitmask of ports to receive on them with a circular DMA (DMA1 channel 5,
+6 and 3 respectively) writing straight into the caller's RX buffer, so there is no per byte CPU work
+and longer interrupts elsewhere do not cause overruns. The bytes written by DMA are published to the RX
+queue on the USART idle line interrupt, on DMA half and full transfer and whenever ser_getc finds the
+queue empty. The DMA does not stop on a full buffer, so size it for the longest time data is not read;
+unread bytes that got overwritten are counted in the queue's drop member.
+
+ser_read_until and ser_readline return complete frames or lines straight from the RX queue, which is
+searched in place. Define SER_RX_DELIM as a delimiter byte (i.e. '\n') to count delimiters as they are
+received, ser_rxlines then tells if a complete line is waiting without searching the queue.
+
+ser_write and ser_try_putc never wait, they enqueue as much as fits. Cooperative code can use them
+(and ser_txfree) to interleave output with other work instead of spinning in ser_putc.
+
+Overrun, framing, noise and parity errors are detected and cleared in the USART interrupt and counted
+per port, as are bytes lost because the RX queue was full. ser_errs tells the two kinds of data loss
+apart: overruns mean the interrupt (or DMA) was served too late, a full queue means it is read too
+slowly or is too small. Bytes received with a framing, noise or parity error are still queued.
+Define SER_ERR_TIME and implement ser_err_time to also record when each kind of error last occurred.
+
+Define SER_RS485 for half duplex multi-drop buses. ser_rs485 then assigns a driver enable (DE/RE)
+pin to a port, which is asserted before the first queued byte is sent and released by the USART
+transmission complete interrupt once the last stop bit is out, on both the interrupt and the DMA TX
+path. The bus is thus turned around within a bit time, without delays. ser_wait_txe waits for the
+release and ser_txdone tells if it happened.
+
+ser_init_ex additionally selects parity, stop bits, RTS/CTS flow control and the remapped pins of a
+port (see the SER_* mode flags in serialq.h). UART4 and UART5 are available on high density, XL and
+connectivity line parts; they have no flow control and no DMA here. All per port state, including
+the register and pin definitions, is kept in one context struct, so the interrupt handlers find
+everything with a single pointer.
+
 @file		serialq.c
 @brief		Buffered USART routines
 @author		Matej Kogovsek
@@ -18,60 +61,361 @@ Data to be transmitted is likewise put into a FIFO. Memory for both FIFOs is pro
 
 #include "stm32f10x.h"
 #include "circbuf8.h"
+#include "serialq.h"
 #include "itoa.h"
+#include "fmt.h"
+
+#if defined(SER_RX_DMA) && defined(CBUF8_SPSC)
+#error "SER_RX_DMA needs circbuf8 built without CBUF8_SPSC, the DMA overwrites unread bytes when the queue is full"
+#endif
+
+#ifdef SER_TXSPACE_INT
+/**
+@brief Extern. Implement to be notified of free space in the TX queue.
+
+Called by an interrupt when SER_TXSPACE_INT is defined, once after ser_write or ser_try_putc could
+not enqueue everything and at least half of the TX queue is free again. If the queue drained
+before the cut short write returned, it is called from that write instead.
+@param[in]	devnum		USART peripheral number (1..5)
+*/
+extern void ser_txspace_callback(const uint8_t devnum);
+#endif
+
+#ifdef SER_ERR_TIME
+/**
+@brief Extern. Implement to timestamp USART errors (i.e. return a millisecond tick counter).
+
+Called by an interrupt when SER_ERR_TIME is defined, so it should be short.
+@return Current time in any unit.
+*/
+extern uint32_t ser_err_time(void);
+#endif
 
 /** @privatesection */
 
+#if defined(STM32F10X_HD) || defined(STM32F10X_HD_VL) || defined(STM32F10X_XL) || defined(STM32F10X_CL)
+#define SER_NPORTS 5	/**< USART1..3, UART4 and UART5 */
+#else
+#define SER_NPORTS 3	/**< USART1..3 */
+#endif
+
+/** One pin assignment of a USART */
+struct USART_Pins
+{
+	uint32_t remap;	/**< GPIO_PinRemapConfig argument, 0 for default pins */
+	GPIO_TypeDef* gpio_tx;
+	uint16_t pin_tx;
+	GPIO_TypeDef* gpio_rx;
+	uint16_t pin_rx;
+	GPIO_TypeDef* gpio_fc;	/**< port of CTS and RTS, 0 if no flow control */
+	uint16_t pin_cts;
+	uint16_t pin_rts;
+};
+
 struct USART_DevDef
 {
 	uint8_t usart_apb;
 	USART_TypeDef* usart;
 	uint32_t usart_clk;
 	uint8_t usart_irqn;
-	GPIO_TypeDef* gpio;
-	uint32_t gpio_clk;
-	uint16_t pin_tx;
+	struct USART_Pins pins[3];	/**< default, remapped (partially for USART3) and fully remapped pins, gpio_tx 0 if not available */
+	DMA_Channel_TypeDef* txdma;	/**< 0 if no DMA */
+	uint8_t txdma_irqn;
+	uint32_t txdma_if;
+	DMA_Channel_TypeDef* rxdma;	/**< 0 if no DMA */
+	uint8_t rxdma_irqn;
+	uint32_t rxdma_if;
 };
 
 /** Register and pin defs for USART1 */
-struct USART_DevDef USART1_PinDef = {2, USART1, RCC_APB2Periph_USART1, USART1_IRQn, GPIOA, RCC_APB2Periph_GPIOA, GPIO_Pin_9};
+const struct USART_DevDef USART1_PinDef = {2, USART1, RCC_APB2Periph_USART1, USART1_IRQn,
+	{{0, GPIOA, GPIO_Pin_9, GPIOA, GPIO_Pin_10, GPIOA, GPIO_Pin_11, GPIO_Pin_12},
+	{GPIO_Remap_USART1, GPIOB, GPIO_Pin_6, GPIOB, GPIO_Pin_7, GPIOA, GPIO_Pin_11, GPIO_Pin_12}},
+	DMA1_Channel4, DMA1_Channel4_IRQn, DMA_IFCR_CGIF4, DMA1_Channel5, DMA1_Channel5_IRQn, DMA_IFCR_CGIF5};
 /** Register and pin defs for USART2 */
-struct USART_DevDef USART2_PinDef = {1, USART2, RCC_APB1Periph_USART2, USART2_IRQn, GPIOA, RCC_APB2Periph_GPIOA, GPIO_Pin_2};
+const struct USART_DevDef USART2_PinDef = {1, USART2, RCC_APB1Periph_USART2, USART2_IRQn,
+	{{0, GPIOA, GPIO_Pin_2, GPIOA, GPIO_Pin_3, GPIOA, GPIO_Pin_0, GPIO_Pin_1},
+	{GPIO_Remap_USART2, GPIOD, GPIO_Pin_5, GPIOD, GPIO_Pin_6, GPIOD, GPIO_Pin_3, GPIO_Pin_4}},
+	DMA1_Channel7, DMA1_Channel7_IRQn, DMA_IFCR_CGIF7, DMA1_Channel6, DMA1_Channel6_IRQn, DMA_IFCR_CGIF6};
 /** Register and pin defs for USART3 */
-struct USART_DevDef USART3_PinDef = {1, USART3, RCC_APB1Periph_USART3, USART3_IRQn, GPIOB, RCC_APB2Periph_GPIOB, GPIO_Pin_10};
+const struct USART_DevDef USART3_PinDef = {1, USART3, RCC_APB1Periph_USART3, USART3_IRQn,
+	{{0, GPIOB, GPIO_Pin_10, GPIOB, GPIO_Pin_11, GPIOB, GPIO_Pin_13, GPIO_Pin_14},
+	{GPIO_PartialRemap_USART3, GPIOC, GPIO_Pin_10, GPIOC, GPIO_Pin_11, GPIOB, GPIO_Pin_13, GPIO_Pin_14},
+	{GPIO_FullRemap_USART3, GPIOD, GPIO_Pin_8, GPIOD, GPIO_Pin_9, GPIOD, GPIO_Pin_11, GPIO_Pin_12}},
+	DMA1_Channel2, DMA1_Channel2_IRQn, DMA_IFCR_CGIF2, DMA1_Channel3, DMA1_Channel3_IRQn, DMA_IFCR_CGIF3};
+#if SER_NPORTS > 3
+/** Register and pin defs for UART4 */
+const struct USART_DevDef UART4_PinDef = {1, UART4, RCC_APB1Periph_UART4, UART4_IRQn,
+	{{0, GPIOC, GPIO_Pin_10, GPIOC, GPIO_Pin_11, 0, 0, 0}},
+	0, 0, 0, 0, 0, 0};
+/** Register and pin defs for UART5 */
+const struct USART_DevDef UART5_PinDef = {1, UART5, RCC_APB1Periph_UART5, UART5_IRQn,
+	{{0, GPIOC, GPIO_Pin_12, GPIOD, GPIO_Pin_2, 0, 0, 0}},
+	0, 0, 0, 0, 0, 0};
+#endif
+
+/** Register and pin defs of all ports, indexed by devnum-1 */
+const struct USART_DevDef* const usart_pdefs[SER_NPORTS] = {&USART1_PinDef, &USART2_PinDef, &USART3_PinDef,
+#if SER_NPORTS > 3
+	&UART4_PinDef, &UART5_PinDef
+#endif
+};
+
+#define SER_DMA_TX 1	/**< port transmits with DMA */
+#define SER_DMA_RX 2	/**< port receives with DMA */
 
-struct USART_DevDef* usart_get_pdef(uint8_t devnum)
+/** Per port state */
+struct ser_port
 {
-	if( devnum == 1 ) return &USART1_PinDef;
-	if( devnum == 2 ) return &USART2_PinDef;
-	if( devnum == 3 ) return &USART3_PinDef;
+	const struct USART_DevDef* pdef;	/**< register and pin defs, 0 until ser_init */
+	uint8_t devnum;	/**< USART peripheral number */
+	uint8_t dma;	/**< SER_DMA_TX and SER_DMA_RX flags */
+	// VOLATILE QUEUES !!! VERY IMPORTANT !!!
+	volatile struct cbuf8_t rxq;	/**< RX circbuf */
+	volatile struct cbuf8_t txq;	/**< TX circbuf */
+#ifdef SER_RX_DELIM
+	volatile uint16_t rxdelim_in;	/**< number of SER_RX_DELIM bytes put into RX queue */
+	volatile uint16_t rxdelim_out;	/**< number of SER_RX_DELIM bytes removed from RX queue */
+#endif
+#ifdef SER_TXSPACE_INT
+	volatile uint8_t txwait;	/**< true if a non blocking write was cut short */
+#endif
+#ifdef SER_TX_DMA
+	volatile uint16_t txdma_n;	/**< number of bytes in the DMA transfer in progress, 0 if idle */
+#endif
+#ifdef SER_RX_DMA
+	volatile uint16_t rxdma_pos;	/**< RX buffer index the DMA was at when last published */
+#endif
+	volatile struct ser_errs_t errs;	/**< error counters */
+#ifdef SER_RS485
+	GPIO_TypeDef* de_gpio;	/**< driver enable port, 0 if not used */
+	uint16_t de_pin;	/**< driver enable pin */
+	uint8_t de_pol;	/**< driver enable active level */
+	volatile uint8_t de_on;	/**< true while driver is enabled */
+#endif
+};
+
+/** State of all ports, indexed by devnum-1 */
+struct ser_port ser_port[SER_NPORTS];
+
+#ifdef SER_RX_DELIM
+/**
+@brief Count SER_RX_DELIM bytes.
+@param[in]	p			Bytes
+@param[in]	n			Number of bytes
+@return Number of SER_RX_DELIM bytes in p.
+*/
+uint16_t ser_rxdelim_cnt(const uint8_t* p, const uint16_t n)
+{
+	uint16_t r = 0;
+	const uint8_t* e = p + n;
+	while( (p < e) && (p = memchr(p, SER_RX_DELIM, e - p)) ) {
+		r++;
+		p++;
+	}
+	return r;
+}
+#endif
+
+/** SR error flags */
+#define SER_SR_ERR (USART_SR_ORE | USART_SR_FE | USART_SR_NE | USART_SR_PE)
+
+/**
+@brief Count n errors of kind e. Call from interrupt or with interrupts disabled.
+@param[in]	sp			Port
+@param[in]	e			SER_ERR_*
+@param[in]	n			Number of errors
+*/
+void ser_err(struct ser_port* sp, const uint8_t e, const uint32_t n)
+{
+	sp->errs.cnt[e] += n;
+#ifdef SER_ERR_TIME
+	sp->errs.t[e] = ser_err_time();
+#endif
+}
+
+#ifdef SER_RS485
+/**
+@brief Set driver enable pin.
+@param[in]	sp			Port
+@param[in]	on			bool, true = enable driver
+*/
+void ser_de(struct ser_port* sp, const uint8_t on)
+{
+	sp->de_on = on;
+	if( on == sp->de_pol ) {
+		GPIO_SetBits(sp->de_gpio, sp->de_pin);
+	} else {
+		GPIO_ResetBits(sp->de_gpio, sp->de_pin);
+	}
+}
+#endif
+
+#ifdef SER_TXSPACE_INT
+/**
+@brief Call ser_txspace_callback if a writer is waiting and enough space has been freed.
+@param[in]	sp			Port
+*/
+void ser_txspace(struct ser_port* sp)
+{
+	volatile struct cbuf8_t* q = &sp->txq;
+	if( sp->txwait && (cbuf8_free(q) >= q->size / 2) ) {
+		sp->txwait = 0;
+		ser_txspace_callback(sp->devnum);
+	}
+}
+#endif
+
+#ifdef SER_RX_DMA
+/**
+@brief Publish bytes written by the RX DMA since the last call to the RX queue.
+@param[in]	sp			Port
+*/
+void ser_rxdma_sync(struct ser_port* sp)
+{
+	volatile struct cbuf8_t* q = &sp->rxq;
+
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	uint16_t p = q->size - sp->pdef->rxdma->CNDTR;
+	if( p == q->size ) { p = 0; }
+	uint16_t n = p - sp->rxdma_pos;
+	if( p < sp->rxdma_pos ) { n += q->size; }
+#ifdef SER_RX_DELIM
+	uint16_t o = sp->rxdma_pos;
+	uint16_t c = q->size - o;
+	if( c > n ) { c = n; }
+	sp->rxdelim_in += ser_rxdelim_cnt(q->buf + o, c) + ser_rxdelim_cnt(q->buf, n - c);
+#endif
+	sp->rxdma_pos = p;
+	uint32_t d = q->drop;
+	cbuf8_commit(q, n);
+	if( q->drop != d ) {
+		ser_err(sp, SER_ERR_FULL, q->drop - d);
+#ifdef SER_RX_DELIM
+		// delimiters in the dropped bytes are never read, recount the ones still queued
+		o = q->head;
+		c = q->size - o;
+		if( c > q->len ) { c = q->len; }
+		sp->rxdelim_out = sp->rxdelim_in - ser_rxdelim_cnt(q->buf + o, c) - ser_rxdelim_cnt(q->buf, q->len - c);
+#endif
+	}
+
+	__set_PRIMASK(g);
+}
+#endif
+
+/**
+@brief Publish bytes received by DMA, if the port receives with DMA.
+@param[in]	sp			Port
+*/
+static inline void ser_rxdma_poll(struct ser_port* sp)
+{
+#ifdef SER_RX_DMA
+	if( sp->dma & SER_DMA_RX ) { ser_rxdma_sync(sp); }
+#endif
+}
+
+/**
+@brief Remove n bytes from RX queue, copying the first s of them to buf.
+@param[in]	sp			Port
+@param[out]	buf			Buffer where bytes are put (can be 0 if s is 0)
+@param[in]	s			sizeof(buf)
+@param[in]	n			Number of bytes to remove
+@return Number of bytes put to buf.
+*/
+uint16_t ser_rxread(struct ser_port* sp, uint8_t* buf, const uint16_t s, uint16_t n)
+{
+	volatile struct cbuf8_t* q = &sp->rxq;
+	uint16_t r = 0;
+
+	while( n ) {
+		uint8_t* p;
+		uint16_t c = cbuf8_peek(q, &p);
+		if( c == 0 ) { break; }
+		if( c > n ) { c = n; }
+
+		uint16_t k = s - r;
+		if( k > c ) { k = c; }
+		if( k ) {
+			memcpy(buf + r, p, k);
+			r += k;
+		}
+#ifdef SER_RX_DELIM
+		sp->rxdelim_out += ser_rxdelim_cnt(p, c);
+#endif
 
-	return 0;
+		cbuf8_consume(q, c);
+		n -= c;
+	}
+
+	return r;
 }
 
-// VOLATILE QUEUES !!! VERY IMPORTANT !!!
-/** RX circbuf defs for all 3 USARTs */
-volatile struct cbuf8_t uart_rxq[3];
-/** TX circbuf defs for all 3 USARTs */
-volatile struct cbuf8_t uart_txq[3];
+/**
+@brief Enable clock of a GPIO port. GPIO ports are 0x400 apart, as are their APB2 clock enable bits.
+*/
+void ser_gpio_clk(GPIO_TypeDef* gpio)
+{
+	RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOA << (((uint32_t)gpio - (uint32_t)GPIOA) / 0x400), ENABLE);
+}
+
+/**
+@brief Configure a pin.
+*/
+void ser_gpio_init(GPIO_TypeDef* gpio, const uint16_t pin, const GPIOMode_TypeDef mode)
+{
+	ser_gpio_clk(gpio);
+
+	GPIO_InitTypeDef iotd;
+	iotd.GPIO_Pin = pin;
+	iotd.GPIO_Speed = GPIO_Speed_50MHz;
+	iotd.GPIO_Mode = mode;
+	GPIO_Init(gpio, &iotd);
+}
 
 /** @publicsection */
 
 /**
-@brief Init USART.
-@param[in]	devnum		USART peripheral number (1..3)
+@brief Init USART with mode.
+
+Flow control is ignored on UART4 and UART5, as are SER_TX_DMA and SER_RX_DMA.
+@param[in]	devnum		USART peripheral number (1..3, 1..5 on HD, XL and CL parts)
 @param[in]	br			Baudrate (i.e. 115200 for 115.2k), F_CPU independent
+@param[in]	mode		SER_8N1 or an or of SER_PARITY_*, SER_STOP2, SER_RTS, SER_CTS, SER_REMAP or SER_REMAP_FULL
 @param[in]	txb			Pointer to caller allocated TX buffer
 @param[in]	txs			sizeof(txb)
 @param[in]	rxb			Pointer to caller allocated RX buffer
 @param[in]	rxs			sizeof(rxs)
 */
-void ser_init(const uint8_t devnum, const uint32_t br, uint8_t* txb, uint16_t txs, uint8_t* rxb, uint16_t rxs)
+void ser_init_ex(const uint8_t devnum, const uint32_t br, const uint8_t mode, uint8_t* txb, uint16_t txs, uint8_t* rxb, uint16_t rxs)
 {
-	cbuf8_clear(&uart_rxq[devnum-1], rxb, rxs);
-	cbuf8_clear(&uart_txq[devnum-1], txb, txs);
+	struct ser_port* sp = &ser_port[devnum-1];
+	const struct USART_DevDef* pdef = usart_pdefs[devnum-1];
 
-	struct USART_DevDef* pdef = usart_get_pdef(devnum);
+	sp->pdef = pdef;
+	sp->devnum = devnum;
+	sp->dma = 0;
+#ifdef SER_TX_DMA
+	if( pdef->txdma && ((SER_TX_DMA >> (devnum-1)) & 1) ) { sp->dma |= SER_DMA_TX; }
+#endif
+#ifdef SER_RX_DMA
+	if( pdef->rxdma && ((SER_RX_DMA >> (devnum-1)) & 1) ) { sp->dma |= SER_DMA_RX; }
+#endif
+	cbuf8_clear(&sp->rxq, rxb, rxs);
+	cbuf8_clear(&sp->txq, txb, txs);
+#ifdef SER_RX_DELIM
+	sp->rxdelim_in = 0;
+	sp->rxdelim_out = 0;
+#endif
+#ifdef SER_TXSPACE_INT
+	sp->txwait = 0;
+#endif
+#ifdef SER_RS485
+	sp->de_gpio = 0;
+#endif
+	memset((void*)&sp->errs, 0, sizeof(sp->errs));
 
 	// clock config
 	if( pdef->usart_apb == 1 ) {
@@ -79,25 +423,80 @@ void ser_init(const uint8_t devnum, const uint32_t br, uint8_t* txb, uint16_t tx
 	} else {
 		RCC_APB2PeriphClockCmd(pdef->usart_clk, ENABLE);
 	}
-	RCC_APB2PeriphClockCmd(pdef->gpio_clk, ENABLE);
 
-	// GPIO config
-	GPIO_InitTypeDef iotd;
-	iotd.GPIO_Pin = pdef->pin_tx;
-	iotd.GPIO_Speed = GPIO_Speed_2MHz;
-	iotd.GPIO_Mode = GPIO_Mode_AF_PP;
-	GPIO_Init(pdef->gpio, &iotd);
+	// GPIO config, fall back to default pins if the wanted remap does not exist
+	const struct USART_Pins* pins = &pdef->pins[(mode & SER_REMAP_FULL) ? 2 : (mode & SER_REMAP) ? 1 : 0];
+	if( pins->gpio_tx == 0 ) { pins = &pdef->pins[0]; }
+	if( pins->remap ) {
+		RCC_APB2PeriphClockCmd(RCC_APB2Periph_AFIO, ENABLE);
+		GPIO_PinRemapConfig(pins->remap, ENABLE);
+	}
+	ser_gpio_init(pins->gpio_tx, pins->pin_tx, GPIO_Mode_AF_PP);
+	ser_gpio_init(pins->gpio_rx, pins->pin_rx, GPIO_Mode_IPU);
+
+	uint16_t fc = USART_HardwareFlowControl_None;
+	if( pins->gpio_fc ) {
+		if( mode & SER_RTS ) {
+			ser_gpio_init(pins->gpio_fc, pins->pin_rts, GPIO_Mode_AF_PP);
+			fc |= USART_HardwareFlowControl_RTS;
+		}
+		if( mode & SER_CTS ) {
+			ser_gpio_init(pins->gpio_fc, pins->pin_cts, GPIO_Mode_IN_FLOATING);
+			fc |= USART_HardwareFlowControl_CTS;
+		}
+	}
 
-	// USART config
+	// USART config, a parity bit makes the frame 9 bits long
 	USART_InitTypeDef uatd;
 	uatd.USART_BaudRate = br;
-	uatd.USART_WordLength = USART_WordLength_8b;
-	uatd.USART_StopBits = USART_StopBits_1;
-	uatd.USART_Parity = USART_Parity_No;
-	uatd.USART_HardwareFlowControl = USART_HardwareFlowControl_None;
+	uatd.USART_WordLength = (mode & (SER_PARITY_EVEN | SER_PARITY_ODD)) ? USART_WordLength_9b : USART_WordLength_8b;
+	uatd.USART_StopBits = (mode & SER_STOP2) ? USART_StopBits_2 : USART_StopBits_1;
+	uatd.USART_Parity = (mode & SER_PARITY_ODD) ? USART_Parity_Odd : (mode & SER_PARITY_EVEN) ? USART_Parity_Even : USART_Parity_No;
+	uatd.USART_HardwareFlowControl = fc;
 	uatd.USART_Mode = USART_Mode_Tx | USART_Mode_Rx;
 	USART_Init(pdef->usart, &uatd);
+#ifdef SER_RX_DMA
+	if( sp->dma & SER_DMA_RX ) {
+		// DMA config, USART_DR to RX buffer, circular, interrupt on half and full transfer
+		RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+		sp->rxdma_pos = 0;
+		pdef->rxdma->CCR = 0;
+		pdef->rxdma->CPAR = (uint32_t)&pdef->usart->DR;
+		pdef->rxdma->CMAR = (uint32_t)rxb;
+		pdef->rxdma->CNDTR = rxs;
+		DMA1->IFCR = pdef->rxdma_if;
+		pdef->rxdma->CCR = DMA_CCR1_MINC | DMA_CCR1_CIRC | DMA_CCR1_HTIE | DMA_CCR1_TCIE | DMA_CCR1_EN;
+		USART_DMACmd(pdef->usart, USART_DMAReq_Rx, ENABLE);
+		USART_ITConfig(pdef->usart, USART_IT_IDLE, ENABLE);
+		USART_ITConfig(pdef->usart, USART_IT_ERR, ENABLE);	// RXNEIE would otherwise report overruns
+
+		NVIC_InitTypeDef ictd;
+		ictd.NVIC_IRQChannel = pdef->rxdma_irqn;
+		ictd.NVIC_IRQChannelCmd = ENABLE;
+		NVIC_Init(&ictd);
+	} else
+#endif
 	USART_ITConfig(pdef->usart, USART_IT_RXNE, ENABLE);
+	if( mode & (SER_PARITY_EVEN | SER_PARITY_ODD) ) {
+		USART_ITConfig(pdef->usart, USART_IT_PE, ENABLE);
+	}
+#ifdef SER_TX_DMA
+	if( sp->dma & SER_DMA_TX ) {
+		// DMA config, memory to USART_DR, a byte at a time, interrupt on transfer complete
+		RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+		sp->txdma_n = 0;
+		pdef->txdma->CCR = 0;
+		pdef->txdma->CPAR = (uint32_t)&pdef->usart->DR;
+		pdef->txdma->CCR = DMA_CCR1_MINC | DMA_CCR1_DIR | DMA_CCR1_TCIE;
+		DMA1->IFCR = pdef->txdma_if;
+		USART_DMACmd(pdef->usart, USART_DMAReq_Tx, ENABLE);
+
+		NVIC_InitTypeDef ictd;
+		ictd.NVIC_IRQChannel = pdef->txdma_irqn;
+		ictd.NVIC_IRQChannelCmd = ENABLE;
+		NVIC_Init(&ictd);
+	}
+#endif
 	// USART_ITConfig(pdef->usart, USART_IT_TXE, ENABLE);
 	USART_Cmd(pdef->usart, ENABLE);
 
@@ -108,9 +507,51 @@ void ser_init(const uint8_t devnum, const uint32_t br, uint8_t* txb, uint16_t tx
 	NVIC_Init(&ictd);
 }
 
+/**
+@brief Init USART, 8 data bits, no parity, 1 stop bit, no flow control, default pins.
+@param[in]	devnum		USART peripheral number (1..3, 1..5 on HD, XL and CL parts)
+@param[in]	br			Baudrate (i.e. 115200 for 115.2k), F_CPU independent
+@param[in]	txb			Pointer to caller allocated TX buffer
+@param[in]	txs			sizeof(txb)
+@param[in]	rxb			Pointer to caller allocated RX buffer
+@param[in]	rxs			sizeof(rxs)
+*/
+void ser_init(const uint8_t devnum, const uint32_t br, uint8_t* txb, uint16_t txs, uint8_t* rxb, uint16_t rxs)
+{
+	ser_init_ex(devnum, br, SER_8N1, txb, txs, rxb, rxs);
+}
+
+#ifdef SER_RS485
+/**
+@brief Use a driver enable pin for half duplex (RS-485) transmission.
+
+Call after ser_init. The pin is configured as output and set inactive.
+@param[in]	devnum		USART peripheral number (1..5)
+@param[in]	gpio		Driver enable port (i.e. GPIOA), 0 to stop using it
+@param[in]	pin			Driver enable pin (i.e. GPIO_Pin_1)
+@param[in]	pol			Driver enable active level, 1 = high
+*/
+void ser_rs485(const uint8_t devnum, GPIO_TypeDef* gpio, const uint16_t pin, const uint8_t pol)
+{
+	struct ser_port* sp = &ser_port[devnum-1];
+
+	ser_wait_txe(devnum);
+	USART_ITConfig(sp->pdef->usart, USART_IT_TC, DISABLE);
+
+	sp->de_gpio = 0;
+	if( gpio ) {
+		sp->de_pin = pin;
+		sp->de_pol = pol ? 1 : 0;
+		sp->de_gpio = gpio;
+		ser_de(sp, 0);
+		ser_gpio_init(gpio, pin, GPIO_Mode_Out_PP);
+	}
+}
+#endif
+
 /**
 @brief Deinit USART.
-@param[in]	devnum		USART peripheral number (1..3)
+@param[in]	devnum		USART peripheral number (1..5)
 */
 void ser_shutdown(const uint8_t devnum)
 {
@@ -119,50 +560,314 @@ void ser_shutdown(const uint8_t devnum)
 
 /**
 @brief Flush rx buffer.
-@param[in]	devnum		USART peripheral number (1..3)
+@param[in]	devnum		USART peripheral number (1..5)
 */
 void ser_flush_rxbuf(const uint8_t devnum)
 {
-	cbuf8_clear(&uart_rxq[devnum-1], uart_rxq[devnum-1].buf, uart_rxq[devnum-1].size);
+	struct ser_port* sp = &ser_port[devnum-1];
+#ifdef SER_RX_DMA
+	if( sp->dma & SER_DMA_RX ) {	// the DMA keeps its position, so just consume everything
+		ser_rxdma_sync(sp);
+		ser_rxread(sp, 0, 0, cbuf8_len(&sp->rxq));
+		return;
+	}
+#endif
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	cbuf8_clear_m(&sp->rxq, sp->rxq.buf, sp->rxq.size, sp->rxq.mode);
+#ifdef SER_RX_DELIM
+	sp->rxdelim_out = sp->rxdelim_in;
+#endif
+
+	__set_PRIMASK(g);
+}
+
+/**
+@brief Set TX queue mode.
+
+In CBUF8_OVERWRITE mode the ser_put* routines never wait for space in the TX queue. The oldest queued
+bytes are dropped instead, so logging can not stall the caller. Data still queued is discarded, so
+call this right after ser_init.
+
+On SER_TX_DMA ports the DMA reads queued bytes in place, so dropping the oldest ones is not possible.
+There CBUF8_OVERWRITE is only accepted with CBUF8_SPSC, where the new bytes are dropped instead.
+@param[in]	devnum		USART peripheral number (1..5)
+@param[in]	m			CBUF8_BLOCK (default) or CBUF8_OVERWRITE
+@return True if the mode has been set, false otherwise (CBUF8_OVERWRITE on a SER_TX_DMA port, nothing is changed).
+*/
+uint8_t ser_txmode(const uint8_t devnum, const uint8_t m)
+{
+	struct ser_port* sp = &ser_port[devnum-1];
+#if defined(SER_TX_DMA) && !defined(CBUF8_SPSC)
+	if( (sp->dma & SER_DMA_TX) && (m == CBUF8_OVERWRITE) ) { return 0; }
+#endif
+	cbuf8_clear_m(&sp->txq, sp->txq.buf, sp->txq.size, m);
+	return 1;
+}
+
+/**
+@brief Number of bytes dropped from the TX queue in CBUF8_OVERWRITE mode.
+@param[in]	devnum		USART peripheral number (1..5)
+@return Number of dropped bytes since ser_init or ser_txmode.
+*/
+uint32_t ser_txdrop(const uint8_t devnum)
+{
+	return ser_port[devnum-1].txq.drop;
 }
 
 /**
 @brief Wait for output queue to be transmitted
-@param[in]	devnum		USART peripheral number (1..3)
+@param[in]	devnum		USART peripheral number (1..5)
 */
 void ser_wait_txe(const uint8_t devnum)
 {
-	struct USART_DevDef* pdef = usart_get_pdef(devnum);
+	struct ser_port* sp = &ser_port[devnum-1];
+
+	while( cbuf8_len(&sp->txq) );
+#ifdef SER_RS485
+	if( sp->de_gpio ) {	// released by the TC interrupt
+		while( sp->de_on );
+		return;
+	}
+#endif
+	while( USART_GetFlagStatus(sp->pdef->usart, USART_FLAG_TC) == RESET );
+}
+
+/**
+@brief Check if output queue has been transmitted, do not wait.
+@param[in]	devnum		USART peripheral number (1..5)
+@return True if everything has been sent (and driver released with SER_RS485), false otherwise.
+*/
+uint8_t ser_txdone(const uint8_t devnum)
+{
+	struct ser_port* sp = &ser_port[devnum-1];
 
-	while( USART_GetFlagStatus(pdef->usart, USART_FLAG_TC) == RESET );
+	if( cbuf8_len(&sp->txq) ) { return 0; }
+#ifdef SER_RS485
+	if( sp->de_gpio ) { return !sp->de_on; }
+#endif
+	return USART_GetFlagStatus(sp->pdef->usart, USART_FLAG_TC) != RESET;
 }
 
 /**
 @brief Get a byte from the serial queue.
-@param[in]	devnum		USART peripheral number (1..3)
+@param[in]	devnum		USART peripheral number (1..5)
 @param[out]	d			Pointer to uint8_t where received data is put
 @return Same as cbuf8_get
 */
 uint8_t ser_getc(const uint8_t devnum, uint8_t* const d)
 {
-	uint8_t r = cbuf8_get(&uart_rxq[devnum-1], d);
+	struct ser_port* sp = &ser_port[devnum-1];
+#ifdef SER_RX_DMA
+	if( (sp->dma & SER_DMA_RX) && (cbuf8_len(&sp->rxq) == 0) ) {	// one get, so an empty poll is counted once
+		ser_rxdma_sync(sp);
+	}
+#endif
+	uint8_t r = cbuf8_get(&sp->rxq, d);
+#ifdef SER_RX_DELIM
+	if( r && d && (*d == SER_RX_DELIM) ) { sp->rxdelim_out++; }
+#endif
 	return r;
 }
 
+/**
+@brief Get a frame ending with delim.
+
+The RX queue is searched in place, nothing is removed unless the whole frame has been received.
+If the RX queue fills up without a delimiter, its content is returned as a frame, so a too long
+frame can not block the port.
+@param[in]	devnum		USART peripheral number (1..5)
+@param[in]	delim		Frame delimiter
+@param[out]	buf			Buffer where the frame (including delim) is put
+@param[in]	s			sizeof(buf), the rest of a longer frame is discarded
+@return Number of bytes put to buf, 0 if there is no complete frame.
+*/
+uint16_t ser_read_until(const uint8_t devnum, const uint8_t delim, uint8_t* buf, const uint16_t s)
+{
+	struct ser_port* sp = &ser_port[devnum-1];
+	volatile struct cbuf8_t* q = &sp->rxq;
+	ser_rxdma_poll(sp);
+
+	uint16_t n = cbuf8_find(q, delim);
+	if( n == 0 ) {
+		if( cbuf8_free(q) ) { return 0; }
+		n = cbuf8_len(q);
+	}
+
+	return ser_rxread(sp, buf, s, n);
+}
+
+/**
+@brief Get a line.
+
+Lines end with CR, LF or both. Empty lines are skipped.
+@param[in]	devnum		USART peripheral number (1..5)
+@param[out]	buf			Buffer where the zero terminated line (without CR/LF) is put
+@param[in]	s			sizeof(buf), the rest of a longer line is discarded
+@return True if a line has been put to buf, false otherwise (no complete line).
+*/
+uint8_t ser_readline(const uint8_t devnum, char* buf, const uint16_t s)
+{
+	struct ser_port* sp = &ser_port[devnum-1];
+	volatile struct cbuf8_t* q = &sp->rxq;
+	ser_rxdma_poll(sp);
+
+	while( 1 ) {
+		uint16_t n = cbuf8_find(q, '\n');
+		uint16_t r = cbuf8_find(q, '\r');
+		if( r && (!n || (r < n)) ) { n = r; }
+		if( n == 0 ) {
+			if( cbuf8_free(q) ) { return 0; }
+			n = cbuf8_len(q);
+		}
+
+		if( n == 1 ) {	// empty line or LF of CRLF
+			ser_rxread(sp, 0, 0, 1);
+			continue;
+		}
+
+		uint16_t l = ser_rxread(sp, (uint8_t*)buf, s - 1, n);
+		while( l && ((buf[l-1] == '\r') || (buf[l-1] == '\n')) ) { l--; }
+		buf[l] = 0;
+		return 1;
+	}
+}
+
+#ifdef SER_RX_DELIM
+/**
+@brief Number of SER_RX_DELIM terminated lines waiting in RX queue.
+@param[in]	devnum		USART peripheral number (1..5)
+@return Number of SER_RX_DELIM bytes in RX queue.
+*/
+uint16_t ser_rxlines(const uint8_t devnum)
+{
+	struct ser_port* sp = &ser_port[devnum-1];
+	ser_rxdma_poll(sp);
+	return sp->rxdelim_in - sp->rxdelim_out;
+}
+#endif
+
+/**
+@brief Get error counters.
+
+Overruns (SER_ERR_ORE) mean the USART interrupt or RX DMA was served too late, bytes lost to a full
+RX queue (SER_ERR_FULL) mean the queue is read too slowly or is too small.
+@param[in]	devnum		USART peripheral number (1..5)
+@param[out]	e			Pointer to caller allocated ser_errs_t
+@param[in]	clr			bool, true = reset counters after copying
+*/
+void ser_errs(const uint8_t devnum, struct ser_errs_t* e, const uint8_t clr)
+{
+	struct ser_port* sp = &ser_port[devnum-1];
+
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	memcpy(e, (void*)&sp->errs, sizeof(*e));
+	if( clr ) {
+		memset((void*)&sp->errs, 0, sizeof(sp->errs));
+	}
+
+	__set_PRIMASK(g);
+}
+
+#ifdef CBUF8_STATS
+/**
+@brief Get RX and TX queue statistics.
+
+A non zero RX ovf means received bytes were dropped. TX ovf counts the ser_putc calls that had to
+wait for space in the TX queue (once per call) and the writes that were cut short. RX unf counts
+ser_getc calls on an empty queue, i.e. every empty poll.
+@param[in]	devnum		USART peripheral number (1..5)
+@param[out]	rx			Pointer to caller allocated cbuf8_stats_t for RX queue statistics (can be 0)
+@param[out]	tx			Pointer to caller allocated cbuf8_stats_t for TX queue statistics (can be 0)
+@param[in]	clr			bool, true = reset statistics after copying
+*/
+void ser_stats(const uint8_t devnum, struct cbuf8_stats_t* rx, struct cbuf8_stats_t* tx, const uint8_t clr)
+{
+	if( rx ) { cbuf8_stats(&ser_port[devnum-1].rxq, rx, clr); }
+	if( tx ) { cbuf8_stats(&ser_port[devnum-1].txq, tx, clr); }
+}
+#endif
+
+/** @privatesection */
+
+#ifdef SER_TX_DMA
+/**
+@brief Start DMA transfer of the next contiguous span of the TX queue, unless one is in progress.
+@param[in]	sp			Port
+*/
+void ser_txdma_next(struct ser_port* sp)
+{
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+
+	if( sp->txdma_n == 0 ) {
+		uint8_t* p;
+		uint16_t n = cbuf8_peek(&sp->txq, &p);
+		if( n ) {
+			DMA_Channel_TypeDef* ch = sp->pdef->txdma;
+#ifdef SER_RS485
+			// DMA writes to DR do not clear TC, clear it so it marks the end of this span
+			if( sp->de_gpio ) { USART_ClearFlag(sp->pdef->usart, USART_FLAG_TC); }
+#endif
+			ch->CCR &= ~DMA_CCR1_EN;
+			ch->CMAR = (uint32_t)p;
+			ch->CNDTR = n;
+			sp->txdma_n = n;
+			ch->CCR |= DMA_CCR1_EN;
+		}
+	}
+
+	__set_PRIMASK(g);
+}
+#endif
+
+/**
+@brief Start transmission of queued data.
+@param[in]	sp			Port
+*/
+void ser_txstart(struct ser_port* sp)
+{
+#ifdef SER_RS485
+	if( sp->de_gpio ) {	// enable driver before the first byte, release is rearmed when the queue empties
+		uint32_t g = __get_PRIMASK();
+		__disable_irq();
+		USART_ITConfig(sp->pdef->usart, USART_IT_TC, DISABLE);
+		if( !sp->de_on ) { ser_de(sp, 1); }
+		__set_PRIMASK(g);
+	}
+#endif
+#ifdef SER_TX_DMA
+	if( sp->dma & SER_DMA_TX ) {
+		ser_txdma_next(sp);
+		return;
+	}
+#endif
+	USART_ITConfig(sp->pdef->usart, USART_IT_TXE, ENABLE); // enable data register empty interrupt
+}
+
+/** @publicsection */
+
 /**
 @brief Enqueue a byte to the serial queue for transmission.
-@param[in]	devnum		USART peripheral number (1..3)
+@param[in]	devnum		USART peripheral number (1..5)
 @param[in]	a			Byte to transmit
 */
 void ser_putc(const uint8_t devnum, const char a)
 {
-	while( 1 ) {
-		if( cbuf8_put(&uart_txq[devnum-1], a) ) { break; }
+	struct ser_port* sp = &ser_port[devnum-1];
+
+	if( !cbuf8_put(&sp->txq, a) ) {	// counted once in stats, wait without further failed puts
+		do {
+			while( cbuf8_free(&sp->txq) == 0 ) {}
+		} while( !cbuf8_put(&sp->txq, a) );
 	}
 
-	USART_ITConfig(usart_get_pdef(devnum)->usart, USART_IT_TXE, ENABLE); // enable data register empty interrupt
+	ser_txstart(sp);
 /*
-	struct USART_DevDef* pdef = usart_get_pdef(devnum);
+	const struct USART_DevDef* pdef = sp->pdef;
 
 	while( RESET == USART_GetFlagStatus(pdef->usart, USART_FLAG_TXE) ) {}
 
@@ -170,40 +875,115 @@ void ser_putc(const uint8_t devnum, const char a)
 */
 }
 
+/**
+@brief Enqueue as many of n bytes as fit, do not wait.
+@param[in]	devnum		USART peripheral number (1..5)
+@param[in]	p			Bytes to transmit
+@param[in]	n			Number of bytes
+@return Number of bytes enqueued (less than n if TX queue full).
+*/
+uint16_t ser_write(const uint8_t devnum, const void* p, const uint16_t n)
+{
+	struct ser_port* sp = &ser_port[devnum-1];
+	uint16_t w = cbuf8_write(&sp->txq, p, n);
+	if( w ) {
+		ser_txstart(sp);
+	}
+#ifdef SER_TXSPACE_INT
+	if( w < n ) {
+		sp->txwait = 1;
+		// the queue may have drained meanwhile, recheck so the callback is not missed
+		uint32_t g = __get_PRIMASK();
+		__disable_irq();
+		ser_txspace(sp);
+		__set_PRIMASK(g);
+	}
+#endif
+	return w;
+}
+
+/**
+@brief Enqueue a byte if there is room, do not wait.
+@param[in]	devnum		USART peripheral number (1..5)
+@param[in]	a			Byte to transmit
+@return True if enqueued, false otherwise (TX queue full).
+*/
+uint8_t ser_try_putc(const uint8_t devnum, const char a)
+{
+	return ser_write(devnum, &a, 1);
+}
+
+/**
+@brief Number of bytes that can be enqueued without waiting.
+@param[in]	devnum		USART peripheral number (1..5)
+@return Free space in TX queue.
+*/
+uint16_t ser_txfree(const uint8_t devnum)
+{
+	return cbuf8_free(&ser_port[devnum-1].txq);
+}
+
+/** @privatesection */
+
+/**
+@brief Enqueue n bytes for transmission, waiting for space if necessary.
+@param[in]	devnum		USART peripheral number (1..5)
+@param[in]	s			Bytes to transmit
+@param[in]	n			Number of bytes
+*/
+void ser_putbuf(const uint8_t devnum, const char* s, uint16_t n)
+{
+	struct ser_port* sp = &ser_port[devnum-1];
+
+	while( n ) {
+		uint16_t w = cbuf8_write(&sp->txq, (const uint8_t*)s, n);
+		if( w ) {
+			ser_txstart(sp);
+			s += w;
+			n -= w;
+		}
+	}
+}
+
+/** @publicsection */
+
 /**
 @brief Send a string.
-@param[in]	devnum		USART peripheral number (1..3)
+@param[in]	devnum		USART peripheral number (1..5)
 @param[in]	s			Zero terminated string to send
 */
 void ser_puts(const uint8_t devnum, const char* s)
 {
-	while( *s )	{
-		ser_putc(devnum, *s);
-		s++;
-	}
+	ser_putbuf(devnum, s, strlen(s));
 }
 
 /**
 @brief Send n chars of string.
-@param[in]	devnum		USART peripheral number (1..3)
+@param[in]	devnum		USART peripheral number (1..5)
 @param[in]	s			String, zeros are sent as spaces
 @param[in]	n			Number of chars to send
 */
 void ser_putsn(const uint8_t devnum, const char* s, uint16_t n)
 {
-	while( n-- ) {
-		if( *s ) {
-			ser_putc(devnum, *s);
-		} else {
+	while( n ) {
+		// enqueue the run of non-zero chars in one go
+		uint16_t i = 0;
+		while( (i < n) && s[i] ) { ++i; }
+		ser_putbuf(devnum, s, i);
+		s += i;
+		n -= i;
+
+		if( n ) {
 			ser_putc(devnum, ' ');
+			s++;
+			n--;
 		}
-		s++;
 	}
 }
 
 /**
 @brief Send int in the specified radix r of minlen w prepended by char c.
-@param[in]	devnum		USART peripheral number (1..3)
+@param[in]	devnum		USART peripheral number (1..5)
 @param[in]	a			int
 @param[in]	r			Radix
 @param[in]	w			Min width
@@ -211,42 +991,47 @@ void ser_putsn(const uint8_t devnum, const char* s, uint16_t n)
 */
 void ser_puti_lc(const uint8_t devnum, const int32_t a, const uint8_t r, uint8_t w, char c)
 {
-	char s[16];
+	char s[34];
 
-	itoa(a, s, r);
+	uint8_t n = i32toa(a, s, r);
 
-	while( w-- > strlen(s) ) { ser_putc(devnum, c); }
+	while( w-- > n ) { ser_putc(devnum, c); }
 
-	ser_puts(devnum, s);
+	ser_putbuf(devnum, s, n);
 }
 
 /**
-@brief Send float with specified precision.
-@param[in]	devnum		USART peripheral number (1..3)
+@brief Send float with specified precision, rounded (see ftoa in itoa.c).
+@param[in]	devnum		USART peripheral number (1..5)
 @param[in]	f			float
-@param[in]	prec		Number of decimals
+@param[in]	prec		Number of decimals (0..9)
 */
 void ser_putf(const uint8_t devnum, float f, uint8_t prec)
 {
-	if( f < 0 ) {
-		f = -f;
-		ser_putc(devnum, '-');
-	}
-	ser_puti_lc(devnum, f, 10, 0, 0);
-	ser_putc(devnum, '.');
-	f = f - (int)f;
-	uint8_t i = prec;
-	while( i-- ) f *= 10;
-	ser_puti_lc(devnum, f, 10, prec, '0');
+	char s[FTOA_LEN];
+	ser_putbuf(devnum, s, ftoa(f, s, prec));
 }
 
 uint8_t ser_printf_devnum = 0; /**< USART peripheral number used by ser_printf */
 
+/** @privatesection */
+
+/**
+@brief fmt sink, ctx points to the USART peripheral number.
+*/
+static void ser_sink(void* ctx, const char* s, uint16_t n)
+{
+	ser_putbuf(*(const uint8_t*)ctx, s, n);
+}
+
+/** @publicsection */
+
 /**
-@brief Simplified implementation of printf (without dynamic malloc).
-@return Always returns 1.
+@brief printf to USART (without dynamic malloc), see fmt.c for supported conversions.
 
-Variable ser_printf_devnum has to be set to the wanted USART peripheral number (1..3) prior to calling.
+Output is enqueued in chunks instead of char by char.
+Variable ser_printf_devnum has to be set to the wanted USART peripheral number (1..5) prior to calling.
+@return Number of chars output, 0 if ser_printf_devnum not set.
 */
 int ser_printf(const char* s, ...)
 {
@@ -254,84 +1039,170 @@ int ser_printf(const char* s, ...)
 	if( devnum == 0 ) return 0;
 	va_list vl;
 	va_start(vl, s);
-	uint8_t esc = 0;
-
-	while( *s ) {
-		if( *s == '%' ) {
-			if( esc ) {	ser_putc(devnum, '%');	}
-			esc = !esc;
-		} else
-		if( esc ) {
-			uint8_t w = 1;
-			if( (*s >= '1') && (*s <= '9') ) {
-				w = *s - '0';
-				++s;
-				if( *s == 0 ) break;
-			}
-			if( (*s == 'd') || (*s == 'i') ) {
-				ser_puti_lc(devnum, va_arg(vl, int), 10, w, ' ');
-			} else
-			if( (*s == 'x') || (*s == 'X') ) {
-				ser_puti_lc(devnum, va_arg(vl, int), 16, w, '0');
-			} else
-			if( (*s == 'f') || (*s == 'F') ) {
-				ser_putf(devnum, va_arg(vl, double), w);
-			} else
-			if( *s == 'c' ) {
-				ser_putc(devnum, va_arg(vl, int));
-			} else
-			if( *s == 's' ) {
-				ser_puts(devnum, va_arg(vl, char*));
-			} else {
-				ser_putc(devnum, '?');
-			}
-			esc = 0;
-		} else {
-			ser_putc(devnum, *s);
-		}
-		++s;
-	}
-
+	int r = fmt_vprintf(ser_sink, &devnum, s, vl);
 	va_end(vl);
-	return 1;
+	return r;
 }
 
 /** @privatesection */
 
-void ser_rxtx(const uint8_t devnum)
+/**
+@brief USART interrupt, called with the port's context.
+@param[in]	sp			Port
+*/
+void ser_rxtx(struct ser_port* sp)
 {
-	struct USART_DevDef* pdef = usart_get_pdef(devnum);
+	USART_TypeDef* usart = sp->pdef->usart;
+	// SR is read once, its error and IDLE flags are cleared by the DR read that follows
+	uint16_t sr = usart->SR;
+	uint16_t cr1 = usart->CR1;
+
+	if( sr & SER_SR_ERR ) {
+		if( sr & USART_SR_ORE ) { ser_err(sp, SER_ERR_ORE, 1); }
+		if( sr & USART_SR_FE ) { ser_err(sp, SER_ERR_FE, 1); }
+		if( sr & USART_SR_NE ) { ser_err(sp, SER_ERR_NE, 1); }
+		if( sr & USART_SR_PE ) { ser_err(sp, SER_ERR_PE, 1); }
+		// without a byte to receive below (or with RX DMA) read DR here, or a set ORE keeps firing the interrupt
+		if( !((sr & USART_SR_RXNE) && (cr1 & USART_CR1_RXNEIE)) ) { USART_ReceiveData(usart); }
+	}
 
-	if( USART_GetITStatus(pdef->usart, USART_IT_RXNE) != RESET ) {
+	if( (sr & USART_SR_RXNE) && (cr1 & USART_CR1_RXNEIE) ) {
 		// read one byte from the receive data register
-		uint8_t d = USART_ReceiveData(pdef->usart);
+		uint8_t d = USART_ReceiveData(usart);
 		// put byte to queue
-		cbuf8_put(&uart_rxq[devnum-1], d);
+		if( cbuf8_put(&sp->rxq, d) ) {
+#ifdef SER_RX_DELIM
+			if( d == SER_RX_DELIM ) { sp->rxdelim_in++; }
+#endif
+		} else {
+			ser_err(sp, SER_ERR_FULL, 1);
+		}
+	}
+
+#ifdef SER_RX_DMA
+	if( (sr & USART_SR_IDLE) && (cr1 & USART_CR1_IDLEIE) ) {
+		USART_ReceiveData(usart);	// clears IDLE (after reading SR)
+		ser_rxdma_sync(sp);
 	}
+#endif
 
-	if( USART_GetITStatus(pdef->usart, USART_IT_TXE) != RESET ) {
+	if( (sr & USART_SR_TXE) && (cr1 & USART_CR1_TXEIE) ) {
 		uint8_t d;
-		if( cbuf8_get(&uart_txq[devnum-1], &d) ) {
+		if( cbuf8_get(&sp->txq, &d) ) {
 			// send next byte from buffer
-			USART_SendData(pdef->usart, d);
+			USART_SendData(usart, d);
+#ifdef SER_TXSPACE_INT
+			ser_txspace(sp);
+#endif
 		} else {
 			// no more data to send, disable UDR empty int
-			USART_ITConfig(pdef->usart, USART_IT_TXE, DISABLE);
+			USART_ITConfig(usart, USART_IT_TXE, DISABLE);
+#ifdef SER_RS485
+			// release driver when the last byte is out
+			if( sp->de_gpio ) { USART_ITConfig(usart, USART_IT_TC, ENABLE); }
+#endif
 		}
 	}
+
+#ifdef SER_RS485
+	if( (sr & USART_SR_TC) && (cr1 & USART_CR1_TCIE) ) {
+		USART_ITConfig(usart, USART_IT_TC, DISABLE);
+		// data queued meanwhile keeps the driver enabled, ser_txstart follows
+		if( cbuf8_len(&sp->txq) == 0 ) { ser_de(sp, 0); }
+	}
+#endif
 }
 
 void USART1_IRQHandler(void)
 {
-	ser_rxtx(1);
+	ser_rxtx(&ser_port[0]);
 }
 
 void USART2_IRQHandler(void)
 {
-	ser_rxtx(2);
+	ser_rxtx(&ser_port[1]);
 }
 
 void USART3_IRQHandler(void)
 {
-	ser_rxtx(3);
+	ser_rxtx(&ser_port[2]);
+}
+
+#if SER_NPORTS > 3
+void UART4_IRQHandler(void)
+{
+	ser_rxtx(&ser_port[3]);
+}
+
+void UART5_IRQHandler(void)
+{
+	ser_rxtx(&ser_port[4]);
+}
+#endif
+
+#ifdef SER_TX_DMA
+void ser_txdma_tc(struct ser_port* sp)
+{
+	DMA1->IFCR = sp->pdef->txdma_if;
+	cbuf8_consume(&sp->txq, sp->txdma_n);
+	sp->txdma_n = 0;
+	ser_txdma_next(sp);
+#ifdef SER_RS485
+	// release driver when the last byte is out
+	if( sp->de_gpio && (sp->txdma_n == 0) ) { USART_ITConfig(sp->pdef->usart, USART_IT_TC, ENABLE); }
+#endif
+#ifdef SER_TXSPACE_INT
+	ser_txspace(sp);
+#endif
+}
+
+#if SER_TX_DMA & 1
+void DMA1_Channel4_IRQHandler(void)
+{
+	ser_txdma_tc(&ser_port[0]);
+}
+#endif
+
+#if SER_TX_DMA & 2
+void DMA1_Channel7_IRQHandler(void)
+{
+	ser_txdma_tc(&ser_port[1]);
+}
+#endif
+
+#if SER_TX_DMA & 4
+void DMA1_Channel2_IRQHandler(void)
+{
+	ser_txdma_tc(&ser_port[2]);
+}
+#endif
+#endif
+
+#ifdef SER_RX_DMA
+void ser_rxdma_ht_tc(struct ser_port* sp)
+{
+	DMA1->IFCR = sp->pdef->rxdma_if;
+	ser_rxdma_sync(sp);
+}
+
+#if SER_RX_DMA & 1
+void DMA1_Channel5_IRQHandler(void)
+{
+	ser_rxdma_ht_tc(&ser_port[0]);
+}
+#endif
+
+#if SER_RX_DMA & 2
+void DMA1_Channel6_IRQHandler(void)
+{
+	ser_rxdma_ht_tc(&ser_port[1]);
+}
+#endif
+
+#if SER_RX_DMA & 4
+void DMA1_Channel3_IRQHandler(void)
+{
+	ser_rxdma_ht_tc(&ser_port[2]);
 }
+#endif
+#endif
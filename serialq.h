@@ -2,15 +2,64 @@
 #define MAT_SERIALQ_H
 
 #include <inttypes.h>
+#include "stm32f10x.h"
+#include "circbuf8.h"
 
+#define SER_8N1			0x00	/**< 8 data bits, no parity, 1 stop bit, no flow control, default pins */
+#define SER_PARITY_EVEN	0x01	/**< 8 data bits and even parity (9 bit word) */
+#define SER_PARITY_ODD	0x02	/**< 8 data bits and odd parity (9 bit word) */
+#define SER_STOP2		0x04	/**< 2 stop bits */
+#define SER_RTS			0x08	/**< RTS flow control (USART1..3 only) */
+#define SER_CTS			0x10	/**< CTS flow control (USART1..3 only) */
+#define SER_RTSCTS		(SER_RTS | SER_CTS)
+#define SER_REMAP		0x20	/**< remapped pins (partial remap on USART3) */
+#define SER_REMAP_FULL	0x40	/**< fully remapped pins (USART3 only) */
+
+#define SER_ERR_ORE		0	/**< overrun, the interrupt or RX DMA was late and bytes were lost */
+#define SER_ERR_FE		1	/**< framing error */
+#define SER_ERR_NE		2	/**< noise detected */
+#define SER_ERR_PE		3	/**< parity error */
+#define SER_ERR_FULL	4	/**< bytes lost because the RX queue was full */
+#define SER_ERR_NUM		5	/**< number of error kinds */
+
+/** USART error counters */
+struct ser_errs_t
+{
+	uint32_t cnt[SER_ERR_NUM];	/**< number of errors of each kind, indexed by SER_ERR_* */
+#ifdef SER_ERR_TIME
+	uint32_t t[SER_ERR_NUM];	/**< ser_err_time() of the last error of each kind */
+#endif
+};
+
+void ser_init_ex(const uint8_t devnum, const uint32_t br, const uint8_t mode, uint8_t* txb, uint16_t txs, uint8_t* rxb, uint16_t rxs);
 void ser_init(const uint8_t devnum, const uint32_t br, uint8_t* txb, uint16_t txs, uint8_t* rxb, uint16_t rxs);
 void ser_shutdown(const uint8_t devnum);
+#ifdef SER_RS485
+void ser_rs485(const uint8_t devnum, GPIO_TypeDef* gpio, const uint16_t pin, const uint8_t pol);
+#endif
 
 void ser_flush_rxbuf(const uint8_t devnum);
+uint8_t ser_txmode(const uint8_t devnum, const uint8_t m);
+uint32_t ser_txdrop(const uint8_t devnum);
 void ser_wait_txe(const uint8_t devnum);
+uint8_t ser_txdone(const uint8_t devnum);
 uint8_t ser_getc(const uint8_t devnum, uint8_t* const d);
+uint16_t ser_read_until(const uint8_t devnum, const uint8_t delim, uint8_t* buf, const uint16_t s);
+uint8_t ser_readline(const uint8_t devnum, char* buf, const uint16_t s);
+#ifdef SER_RX_DELIM
+uint16_t ser_rxlines(const uint8_t devnum);
+#endif
+
+void ser_errs(const uint8_t devnum, struct ser_errs_t* e, const uint8_t clr);
+
+#ifdef CBUF8_STATS
+void ser_stats(const uint8_t devnum, struct cbuf8_stats_t* rx, struct cbuf8_stats_t* tx, const uint8_t clr);
+#endif
 
 void ser_putc(const uint8_t devnum, const char a);
+uint8_t ser_try_putc(const uint8_t devnum, const char a);
+uint16_t ser_write(const uint8_t devnum, const void* p, const uint16_t n);
+uint16_t ser_txfree(const uint8_t devnum);
 void ser_puts(const uint8_t devnum, const char* s);
 void ser_putsn(const uint8_t devnum, const char* s, uint16_t n);
 void ser_puti_lc(const uint8_t devnum, const int32_t a, const uint8_t r, uint8_t w, char c);
@@ -1,4 +1,25 @@
 /**
+
+spi_init takes the SPI mode (0..3) or-ed with SPI_LSB_FIRST, SPI_16BIT and SPI_REMAP flags. On 16 bit
+ports use spi_xfer16 and spi_xfer16_async instead of the byte routines. SPI3 is available on high density,
+XL and connectivity line parts. Its default pins and the remapped SPI1 pins are shared with JTAG, which
+is then disabled (SWD stays available); remapped SPI3 pins exist on connectivity line parts only.
+
+Define SPI_DMA as a bitmask of ports (bit 0 for SPI1, bit 1 for SPI2, bit 2 for SPI3) to make
+spi_xfer_async available on them. It starts a full duplex transfer on the port's DMA channels (DMA1
+channel 2 RX and 3 TX for SPI1, 4 RX and 5 TX for SPI2, DMA2 channel 1 RX and 2 TX for SPI3) and returns at once. When the last byte is received, the RX channel interrupt
+optionally releases chip select and calls a completion callback; spi_busy can be polled instead.
+The RX channel interrupt handler is defined here. Because the channels are shared with USART3 and USART1
+respectively, the serialq SER_TX_DMA and SER_RX_DMA bits of those ports can not be set at the same time.
+
+spi_slave_init makes such a port a slave, framed by the hardware NSS pin. Both directions run on DMA
+over caller buffers of two halves (ping-pong), one half per frame, so data streams at the full SPI
+clock without per byte CPU work. A frame ends on the NSS rising edge: the EXTI interrupt of the NSS
+line takes the received length from the RX channel's CNDTR, arms the DMA on the other half for the
+next frame and calls the callback with the half just done and its length. Frames may have any length
+up to one half, longer ones are cut to it. The application's EXTI handler of the NSS line calls
+spi_slave_nss_irq (with misc.c MISC_EXTI_INT, from exti_int), so the line can be shared.
+
 @file		spi.c
 @brief		SPI routines
 @author		Matej Kogovsek
@@ -8,48 +29,195 @@
 
 #include <inttypes.h>
 #include "stm32f10x.h"
+#include "spi.h"
+#include "misc.h"
+
+#if defined(SPI_DMA) && (SPI_DMA & 1) && defined(SER_TX_DMA) && (SER_TX_DMA & 4)
+#error "SPI1 DMA and USART3 TX DMA both use DMA1 channel 2"
+#endif
+#if defined(SPI_DMA) && (SPI_DMA & 1) && defined(SER_RX_DMA) && (SER_RX_DMA & 4)
+#error "SPI1 DMA and USART3 RX DMA both use DMA1 channel 3"
+#endif
+#if defined(SPI_DMA) && (SPI_DMA & 2) && defined(SER_TX_DMA) && (SER_TX_DMA & 1)
+#error "SPI2 DMA and USART1 TX DMA both use DMA1 channel 4"
+#endif
+#if defined(SPI_DMA) && (SPI_DMA & 2) && defined(SER_RX_DMA) && (SER_RX_DMA & 1)
+#error "SPI2 DMA and USART1 RX DMA both use DMA1 channel 5"
+#endif
+
+#if defined(STM32F10X_HD) || defined(STM32F10X_HD_VL) || defined(STM32F10X_XL) || defined(STM32F10X_CL)
+#define SPI_NPORTS 3	/**< SPI1..3 */
+#else
+#define SPI_NPORTS 2	/**< SPI1..2 */
+#endif
+
+#if defined(SPI_DMA) && (SPI_DMA & 4) && (SPI_NPORTS < 3)
+#error "SPI3 is only available on high density, XL and connectivity line parts"
+#endif
 
 /** @privatesection */
 
-struct SPI_DevDef
+/** One pin assignment of a SPI */
+struct SPI_Pins
 {
-	uint8_t spi_apb;
-	SPI_TypeDef* spi;
-	uint32_t spi_clk;
-	GPIO_TypeDef* gpio;
-	uint32_t gpio_clk;
+	uint32_t remap;	/**< GPIO_PinRemapConfig argument, 0 for default pins */
+	uint8_t swj;	/**< true if pins are shared with JTAG */
+	GPIO_TypeDef* gpio_nss;
 	uint16_t pin_nss;
+	GPIO_TypeDef* gpio;	/**< port of SCK, MISO and MOSI */
 	uint16_t pin_sck;
 	uint16_t pin_miso;
 	uint16_t pin_mosi;
 };
 
+struct SPI_DevDef
+{
+	uint8_t spi_apb;
+	SPI_TypeDef* spi;
+	uint32_t spi_clk;
+	struct SPI_Pins pins[2];	/**< default and remapped pins, gpio 0 if not available */
+	DMA_TypeDef* dma;
+	uint32_t dma_clk;
+	DMA_Channel_TypeDef* rxdma;
+	uint8_t rxdma_irqn;
+	uint32_t rxdma_if;
+	DMA_Channel_TypeDef* txdma;
+	uint32_t txdma_if;
+};
+
 /** Register and pin defs for SPI1 */
-struct SPI_DevDef SPI1_PinDef = {2, SPI1, RCC_APB2Periph_SPI1, GPIOA, RCC_APB2Periph_GPIOA, GPIO_Pin_4, GPIO_Pin_5, GPIO_Pin_6, GPIO_Pin_7};
+const struct SPI_DevDef SPI1_PinDef = {2, SPI1, RCC_APB2Periph_SPI1,
+	{{0, 0, GPIOA, GPIO_Pin_4, GPIOA, GPIO_Pin_5, GPIO_Pin_6, GPIO_Pin_7},
+	{GPIO_Remap_SPI1, 1, GPIOA, GPIO_Pin_15, GPIOB, GPIO_Pin_3, GPIO_Pin_4, GPIO_Pin_5}},
+	DMA1, RCC_AHBPeriph_DMA1, DMA1_Channel2, DMA1_Channel2_IRQn, DMA_IFCR_CGIF2, DMA1_Channel3, DMA_IFCR_CGIF3};
 /** Register and pin defs for SPI2 */
-struct SPI_DevDef SPI2_PinDef = {1, SPI2, RCC_APB1Periph_SPI2, GPIOB, RCC_APB2Periph_GPIOB, GPIO_Pin_12, GPIO_Pin_13, GPIO_Pin_14, GPIO_Pin_15};
+const struct SPI_DevDef SPI2_PinDef = {1, SPI2, RCC_APB1Periph_SPI2,
+	{{0, 0, GPIOB, GPIO_Pin_12, GPIOB, GPIO_Pin_13, GPIO_Pin_14, GPIO_Pin_15}},
+	DMA1, RCC_AHBPeriph_DMA1, DMA1_Channel4, DMA1_Channel4_IRQn, DMA_IFCR_CGIF4, DMA1_Channel5, DMA_IFCR_CGIF5};
+#if SPI_NPORTS > 2
+/** Register and pin defs for SPI3 */
+const struct SPI_DevDef SPI3_PinDef = {1, SPI3, RCC_APB1Periph_SPI3,
+	{{0, 1, GPIOA, GPIO_Pin_15, GPIOB, GPIO_Pin_3, GPIO_Pin_4, GPIO_Pin_5},
+#ifdef STM32F10X_CL
+	{GPIO_Remap_SPI3, 0, GPIOA, GPIO_Pin_4, GPIOC, GPIO_Pin_10, GPIO_Pin_11, GPIO_Pin_12}
+#endif
+	},
+	DMA2, RCC_AHBPeriph_DMA2, DMA2_Channel1, DMA2_Channel1_IRQn, DMA_IFCR_CGIF1, DMA2_Channel2, DMA_IFCR_CGIF2};
+#endif
+
+/** Register and pin defs of all ports, indexed by devnum-1 */
+const struct SPI_DevDef* const spi_pdefs[SPI_NPORTS] = {&SPI1_PinDef, &SPI2_PinDef,
+#if SPI_NPORTS > 2
+	&SPI3_PinDef
+#endif
+};
 
-struct SPI_DevDef* spi_get_pdef(uint8_t devnum)
+/** Pins in use by each port, selected by spi_init */
+const struct SPI_Pins* spi_pins[SPI_NPORTS] = {&SPI1_PinDef.pins[0], &SPI2_PinDef.pins[0],
+#if SPI_NPORTS > 2
+	&SPI3_PinDef.pins[0]
+#endif
+};
+
+#ifdef SPI_DMA
+/** Asynchronous transfer state of a port */
+struct spi_async_t
 {
-	if( devnum == 1 ) return &SPI1_PinDef;
-	if( devnum == 2 ) return &SPI2_PinDef;
+	volatile uint8_t busy;	/**< transfer running */
+	spi_cs_t cs;	/**< called to release chip select on completion, if set */
+	spi_cb_t cb;	/**< called on completion, if set */
+	void* ctx;	/**< cb or scb context */
+	spi_slave_cb_t scb;	/**< slave mode frame callback, 0 in master mode */
+	uint16_t sink;	/**< discarded RX frames, one per port as the channels run concurrently */
+	uint8_t* txb;	/**< slave mode TX buffer */
+	uint8_t* rxb;	/**< slave mode RX buffer */
+	uint16_t n;	/**< slave mode frames per half */
+	uint16_t cr1;	/**< slave mode CR1, without SPE */
+	uint8_t half;	/**< slave mode half of the buffers of the current frame */
+};
 
-	return 0;
+struct spi_async_t spi_async[SPI_NPORTS];
+
+/** Source of TX frames when there is no tx buffer, never written */
+static const uint16_t spi_zero = 0;
+#endif
+
+const struct SPI_DevDef* spi_get_pdef(uint8_t devnum)
+{
+	return spi_pdefs[devnum-1];
+}
+
+/**
+@brief Select and configure the pins of a port.
+
+A master drives SCK, MOSI and NSS (as GPIO), a slave drives MISO only.
+*/
+void spi_pins_init(uint8_t devnum, uint8_t remap, uint8_t master)
+{
+	const struct SPI_DevDef* pdef = spi_get_pdef(devnum);
+
+	// fall back to default pins if the remap does not exist
+	const struct SPI_Pins* pins = &pdef->pins[remap ? 1 : 0];
+	if( pins->gpio == 0 ) { pins = &pdef->pins[0]; }
+	spi_pins[devnum-1] = pins;
+
+	RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOA << (((uint32_t)pins->gpio - (uint32_t)GPIOA) / 0x400), ENABLE);
+	RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOA << (((uint32_t)pins->gpio_nss - (uint32_t)GPIOA) / 0x400), ENABLE);
+	if( pins->remap || pins->swj ) {
+		RCC_APB2PeriphClockCmd(RCC_APB2Periph_AFIO, ENABLE);
+	}
+	if( pins->remap ) {
+		GPIO_PinRemapConfig(pins->remap, ENABLE);
+	}
+	if( pins->swj ) {	// keep SWD
+		GPIO_PinRemapConfig(GPIO_Remap_SWJ_JTAGDisable, ENABLE);
+	}
+
+	GPIO_InitTypeDef iotd;
+
+	if( master ) {
+		iotd.GPIO_Speed = GPIO_Speed_10MHz;
+
+		iotd.GPIO_Pin = pins->pin_sck | pins->pin_mosi;
+		iotd.GPIO_Mode = GPIO_Mode_AF_PP;
+		GPIO_Init(pins->gpio, &iotd);
+
+		iotd.GPIO_Pin = pins->pin_nss;
+		iotd.GPIO_Mode = GPIO_Mode_Out_PP;
+		GPIO_Init(pins->gpio_nss, &iotd);
+
+		iotd.GPIO_Pin = pins->pin_miso;
+		iotd.GPIO_Mode = GPIO_Mode_IN_FLOATING;
+		GPIO_Init(pins->gpio, &iotd);
+	} else {
+		iotd.GPIO_Speed = GPIO_Speed_50MHz;
+
+		iotd.GPIO_Pin = pins->pin_miso;
+		iotd.GPIO_Mode = GPIO_Mode_AF_PP;
+		GPIO_Init(pins->gpio, &iotd);
+
+		iotd.GPIO_Pin = pins->pin_sck | pins->pin_mosi;
+		iotd.GPIO_Mode = GPIO_Mode_IN_FLOATING;
+		GPIO_Init(pins->gpio, &iotd);
+
+		iotd.GPIO_Pin = pins->pin_nss;
+		GPIO_Init(pins->gpio_nss, &iotd);
+	}
 }
 
 /**
 @brief SPI chip select control.
-@param[in]	devnum		SPI peripheral number (1..2)
+@param[in]	devnum		SPI peripheral number (1..2, 1..3 on HD, XL and CL parts)
 @param[in]	cs			bool, true = NSS high (deselect), false = NSS low (select)
 */
 void spi_cs(uint8_t devnum, uint8_t nss)
 {
-	struct SPI_DevDef* pdef = spi_get_pdef(devnum);
+	const struct SPI_Pins* pins = spi_pins[devnum-1];
 
 	if( nss ) {
-		GPIO_WriteBit(pdef->gpio, pdef->pin_nss, Bit_SET);
+		GPIO_WriteBit(pins->gpio_nss, pins->pin_nss, Bit_SET);
 	} else {
-		GPIO_WriteBit(pdef->gpio, pdef->pin_nss, Bit_RESET);
+		GPIO_WriteBit(pins->gpio_nss, pins->pin_nss, Bit_RESET);
 	}
 }
 
@@ -57,13 +225,13 @@ void spi_cs(uint8_t devnum, uint8_t nss)
 @brief Send and receive byte (NSS not controlled)
 
 This is the only function which does not control NSS. All others do.
-@param[in]	devnum		SPI peripheral number (1..2)
+@param[in]	devnum		SPI peripheral number (1..2, 1..3 on HD, XL and CL parts)
 @param[in]	d			Byte to send
 @return byte received
 */
 uint8_t spi_rw(uint8_t devnum, const uint8_t d)
 {
-	struct SPI_DevDef* pdef = spi_get_pdef(devnum);
+	const struct SPI_DevDef* pdef = spi_get_pdef(devnum);
 
 	while (SPI_I2S_GetFlagStatus(pdef->spi, SPI_I2S_FLAG_TXE) == RESET);
 	SPI_I2S_SendData(pdef->spi, d);
@@ -71,21 +239,107 @@ uint8_t spi_rw(uint8_t devnum, const uint8_t d)
 	return SPI_I2S_ReceiveData(pdef->spi);
 }
 
+/**
+@brief Send and receive n bytes back to back (NSS not controlled)
+
+The next byte is written to DR as soon as TXE sets, while the previous one is still being shifted
+out, so SCK runs without gaps between bytes. At most two bytes are in flight, which leaves one byte
+time to read each received byte. An interrupt longer than that while receiving causes an overrun:
+the second byte arrives while the first is still unread and is lost (OVR). The first one is still
+in DR and is stored, the lost one is stored as 0 and counted; all n bytes are always clocked.
+@param[in]	devnum		SPI peripheral number (1..2, 1..3 on HD, XL and CL parts)
+@param[in]	tx			Bytes to send, 0 sends zeros (read only)
+@param[out]	rx			Buffer for received bytes, 0 discards them (write only), may be the same as tx
+@param[in]	n			Number of bytes
+@return Number of received bytes lost to overruns, 0 if none.
+*/
+uint16_t spi_xfer(uint8_t devnum, const uint8_t* tx, uint8_t* rx, uint16_t n)
+{
+	SPI_TypeDef* spi = spi_get_pdef(devnum)->spi;
+	uint16_t ti = 0, ri = 0, lost = 0;
+
+	// a stale byte would shift rx by one, a stale OVR (e.g. left by a DMA transfer, with RXNE
+	// clear) would count a phantom lost byte: DR then SR read clears both
+	(void)spi->DR;
+	(void)spi->SR;
+
+	while( ri < n ) {
+		uint16_t sr = spi->SR;
+		if( (sr & SPI_I2S_FLAG_TXE) && (ti < n) && (ti - ri < 2) ) {
+			spi->DR = tx ? tx[ti] : 0;
+			ti++;
+		}
+		if( sr & SPI_I2S_FLAG_RXNE ) {
+			uint8_t d = spi->DR;
+			if( rx ) { rx[ri] = d; }
+			ri++;
+		}
+		if( sr & SPI_I2S_FLAG_OVR ) {	// the byte after the one read last was lost, no RXNE comes for it
+			(void)spi->SR;	// DR then SR read clears OVR (already cleared if DR was read before sr)
+			if( rx ) { rx[ri] = 0; }
+			ri++;
+			lost++;
+		}
+	}
+
+	return lost;
+}
+
+/**
+@brief Send and receive n 16 bit words back to back (NSS not controlled)
+
+Same as spi_xfer, for a port configured with 16 bit frames. A word lost to an overrun is stored
+as 0 and counted.
+@param[in]	devnum		SPI peripheral number (1..2, 1..3 on HD, XL and CL parts)
+@param[in]	tx			Words to send, 0 sends zeros (read only)
+@param[out]	rx			Buffer for received words, 0 discards them (write only), may be the same as tx
+@param[in]	n			Number of words
+@return Number of received words lost to overruns, 0 if none.
+*/
+uint16_t spi_xfer16(uint8_t devnum, const uint16_t* tx, uint16_t* rx, uint16_t n)
+{
+	SPI_TypeDef* spi = spi_get_pdef(devnum)->spi;
+	uint16_t ti = 0, ri = 0, lost = 0;
+
+	(void)spi->DR;	// clears a stale word and OVR, as in spi_xfer
+	(void)spi->SR;
+
+	while( ri < n ) {
+		uint16_t sr = spi->SR;
+		if( (sr & SPI_I2S_FLAG_TXE) && (ti < n) && (ti - ri < 2) ) {
+			spi->DR = tx ? tx[ti] : 0;
+			ti++;
+		}
+		if( sr & SPI_I2S_FLAG_RXNE ) {
+			uint16_t d = spi->DR;
+			if( rx ) { rx[ri] = d; }
+			ri++;
+		}
+		if( sr & SPI_I2S_FLAG_OVR ) {
+			(void)spi->SR;
+			if( rx ) { rx[ri] = 0; }
+			ri++;
+			lost++;
+		}
+	}
+
+	return lost;
+}
+
 /** @publicsection */
 
 /**
 @brief Initialize SPI interface.
 
-Although SPI can have different clock phase and polarity, I have never ran across anything that uses other
-than low polarity and 1st edge phase. Therefore these parameters are implied and not variable. As are 8 bit
-words and MSB first.
-@param[in]	devnum		SPI peripheral number (1..2)
+Frames are 8 bit MSB first, unless SPI_16BIT or SPI_LSB_FIRST is set. SPI_REMAP selects the
+remapped pins, if the port has them.
+@param[in]	devnum		SPI peripheral number (1..2, 1..3 on HD, XL and CL parts)
 @param[in]	brps		Baudrate prescaler, F_CPU dependent
-@param[in] mode			SPI mode
+@param[in] mode			SPI mode (0..3) | SPI_LSB_FIRST | SPI_16BIT | SPI_REMAP
 */
 void spi_init(uint8_t devnum, uint16_t brps, uint8_t mode)
 {
-	struct SPI_DevDef* pdef = spi_get_pdef(devnum);
+	const struct SPI_DevDef* pdef = spi_get_pdef(devnum);
 
 	// clock config
 	if( pdef->spi_apb == 1 ) {
@@ -93,23 +347,9 @@ void spi_init(uint8_t devnum, uint16_t brps, uint8_t mode)
 	} else {
 		RCC_APB2PeriphClockCmd(pdef->spi_clk, ENABLE);
 	}
-	RCC_APB2PeriphClockCmd(pdef->gpio_clk, ENABLE);
 
 	// GPIO config
-	GPIO_InitTypeDef iotd;
-
-	iotd.GPIO_Pin = pdef->pin_sck | pdef->pin_mosi;
-	iotd.GPIO_Speed = GPIO_Speed_10MHz;
-	iotd.GPIO_Mode = GPIO_Mode_AF_PP;
-	GPIO_Init(pdef->gpio, &iotd);
-
-	iotd.GPIO_Pin = pdef->pin_nss;
-	iotd.GPIO_Mode = GPIO_Mode_Out_PP;
-	GPIO_Init(pdef->gpio, &iotd);
-
-	iotd.GPIO_Pin = pdef->pin_miso;
-	iotd.GPIO_Mode = GPIO_Mode_IN_FLOATING;
-	GPIO_Init(pdef->gpio, &iotd);
+	spi_pins_init(devnum, mode & SPI_REMAP, 1);
 
 	// NSS high
 	spi_cs(devnum, 1);
@@ -118,23 +358,59 @@ void spi_init(uint8_t devnum, uint16_t brps, uint8_t mode)
 	SPI_InitTypeDef sptd;
 	sptd.SPI_Direction = SPI_Direction_2Lines_FullDuplex;
 	sptd.SPI_Mode = SPI_Mode_Master;
-	sptd.SPI_DataSize = SPI_DataSize_8b;
+	sptd.SPI_DataSize = (mode & SPI_16BIT) ? SPI_DataSize_16b : SPI_DataSize_8b;
 	sptd.SPI_CPOL = SPI_CPOL_Low;
-	if( mode > 1 ) sptd.SPI_CPOL = SPI_CPOL_High;
+	if( mode & 2 ) sptd.SPI_CPOL = SPI_CPOL_High;
 	sptd.SPI_CPHA = SPI_CPHA_1Edge;
 	if( mode & 1 ) sptd.SPI_CPHA = SPI_CPHA_2Edge;
 	sptd.SPI_NSS = SPI_NSS_Soft;
 	sptd.SPI_BaudRatePrescaler = brps;
-	sptd.SPI_FirstBit = SPI_FirstBit_MSB;
+	sptd.SPI_FirstBit = (mode & SPI_LSB_FIRST) ? SPI_FirstBit_LSB : SPI_FirstBit_MSB;
 	sptd.SPI_CRCPolynomial = 7;
 	SPI_Init(pdef->spi, &sptd);
 
 	SPI_Cmd(pdef->spi, ENABLE);
+
+#ifdef SPI_DMA
+	if( (SPI_DMA >> (devnum-1)) & 1 ) {
+		RCC_AHBPeriphClockCmd(pdef->dma_clk, ENABLE);
+		spi_async[devnum-1].busy = 0;
+		spi_async[devnum-1].scb = 0;
+		pdef->rxdma->CCR = 0;
+		pdef->rxdma->CPAR = (uint32_t)&pdef->spi->DR;
+		pdef->txdma->CCR = 0;
+		pdef->txdma->CPAR = (uint32_t)&pdef->spi->DR;
+
+		NVIC_InitTypeDef ictd;
+		ictd.NVIC_IRQChannel = pdef->rxdma_irqn;
+		ictd.NVIC_IRQChannelCmd = ENABLE;
+		NVIC_Init(&ictd);
+	}
+#endif
+}
+
+/**
+@brief Change prescaler and mode of an initialized SPI interface.
+
+Waits for the current frame to finish, then rewrites CR1 with the peripheral disabled.
+@param[in]	devnum		SPI peripheral number (1..2, 1..3 on HD, XL and CL parts)
+@param[in]	brps		Baudrate prescaler, F_CPU dependent
+@param[in]	mode		SPI mode (0..3) | SPI_LSB_FIRST | SPI_16BIT
+*/
+void spi_reconf(uint8_t devnum, uint16_t brps, uint8_t mode)
+{
+	SPI_TypeDef* spi = spi_get_pdef(devnum)->spi;
+
+	while( spi->SR & SPI_I2S_FLAG_BSY );
+	spi->CR1 &= ~SPI_CR1_SPE;
+	spi->CR1 = SPI_Direction_2Lines_FullDuplex | SPI_Mode_Master | SPI_NSS_Soft | brps | (mode & 3) |
+		((mode & SPI_LSB_FIRST) ? SPI_FirstBit_LSB : SPI_FirstBit_MSB) | ((mode & SPI_16BIT) ? SPI_DataSize_16b : SPI_DataSize_8b);
+	spi->CR1 |= SPI_CR1_SPE;
 }
 
 /**
 @brief Send and receive byte
-@param[in]		devnum		SPI peripheral number (1..2)
+@param[in]		devnum		SPI peripheral number (1..2, 1..3 on HD, XL and CL parts)
 @param[in,out]	d			Byte to send/receive
 */
 void spi_putc(uint8_t devnum, uint8_t* d)
@@ -146,7 +422,7 @@ void spi_putc(uint8_t devnum, uint8_t* d)
 
 /**
 @brief Send and receive string.
-@param[in]		devnum		SPI peripheral number (1..2)
+@param[in]		devnum		SPI peripheral number (1..2, 1..3 on HD, XL and CL parts)
 @param[in,out]	s			Zero terminated string to send/receive
 */
 void spi_puts(uint8_t devnum, char* s)
@@ -161,16 +437,329 @@ void spi_puts(uint8_t devnum, char* s)
 
 /**
 @brief Send and receive string of length n.
-@param[in]		devnum		SPI peripheral number (1..2)
+@param[in]		devnum		SPI peripheral number (1..2, 1..3 on HD, XL and CL parts)
 @param[in,out]	s			String to send/receive
 @param[in]		n			Number of bytes to send/receive
 */
 void spi_putsn(uint8_t devnum, char* s, uint16_t n)
 {
 	spi_cs(devnum, 0);
-	while( n-- ) {
-		*s = spi_rw(devnum, *s);
-		s++;
-	}
+	spi_xfer(devnum, (uint8_t*)s, (uint8_t*)s, n);
 	spi_cs(devnum, 1);
 }
+
+#ifdef SPI_DMA
+/** @privatesection */
+
+/**
+@brief Start a DMA transfer of n frames of 8 or 16 bits.
+*/
+uint8_t spi_dma_start(uint8_t devnum, const void* tx, void* rx, uint16_t n, uint8_t wide, spi_cs_t cs, spi_cb_t cb, void* ctx)
+{
+	if( (n == 0) || !((SPI_DMA >> (devnum-1)) & 1) ) { return 0; }
+
+	const struct SPI_DevDef* pdef = spi_get_pdef(devnum);
+	struct spi_async_t* sa = &spi_async[devnum-1];
+
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+	if( sa->busy ) {
+		__set_PRIMASK(g);
+		return 0;
+	}
+	sa->busy = 1;
+	__set_PRIMASK(g);
+
+	sa->cs = cs;
+	sa->cb = cb;
+	sa->ctx = ctx;
+
+	if( pdef->spi->SR & SPI_I2S_FLAG_RXNE ) {	// stale frame would shift rx by one
+		(void)pdef->spi->DR;
+	}
+
+	uint32_t size = wide ? (DMA_CCR1_PSIZE_0 | DMA_CCR1_MSIZE_0) : 0;
+
+	// RX has the higher priority, so DR is always read before the next frame arrives
+	pdef->rxdma->CCR = 0;
+	pdef->rxdma->CMAR = rx ? (uint32_t)rx : (uint32_t)&sa->sink;
+	pdef->rxdma->CNDTR = n;
+	pdef->dma->IFCR = pdef->rxdma_if;
+	pdef->rxdma->CCR = size | (rx ? DMA_CCR1_MINC : 0) | DMA_CCR1_PL_1 | DMA_CCR1_TCIE | DMA_CCR1_EN;
+
+	pdef->txdma->CCR = 0;
+	pdef->txdma->CMAR = tx ? (uint32_t)tx : (uint32_t)&spi_zero;
+	pdef->txdma->CNDTR = n;
+	pdef->dma->IFCR = pdef->txdma_if;
+	pdef->txdma->CCR = size | (tx ? DMA_CCR1_MINC : 0) | DMA_CCR1_DIR | DMA_CCR1_EN;
+
+	pdef->spi->CR2 |= SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN;
+
+	return 1;
+}
+
+/** @publicsection */
+
+/**
+@brief Start a DMA transfer of n bytes (NSS not controlled), do not wait.
+
+Select the device before calling. The buffers must stay valid until completion. No other transfer
+may be made on the port until then, check with spi_busy.
+@param[in]	devnum		SPI peripheral number (1..2, 1..3 on HD, XL and CL parts), its SPI_DMA bit set
+@param[in]	tx			Bytes to send, 0 sends zeros (read only)
+@param[out]	rx			Buffer for received bytes, 0 discards them (write only), may be the same as tx
+@param[in]	n			Number of bytes (1..65535)
+@param[in]	cs			Chip select function, called from the interrupt with nss = 1 when done, 0 to keep the device selected
+@param[in]	cb			Completion callback, called from the interrupt after cs, 0 if not needed
+@param[in]	ctx			Passed to cb
+@return True if started, false otherwise (port busy, n is 0 or no DMA on this port).
+*/
+uint8_t spi_xfer_async(uint8_t devnum, const uint8_t* tx, uint8_t* rx, uint16_t n, spi_cs_t cs, spi_cb_t cb, void* ctx)
+{
+	return spi_dma_start(devnum, tx, rx, n, 0, cs, cb, ctx);
+}
+
+/**
+@brief Start a DMA transfer of n 16 bit words (NSS not controlled), do not wait.
+
+Same as spi_xfer_async, for a port configured with 16 bit frames.
+@param[in]	devnum		SPI peripheral number (1..2, 1..3 on HD, XL and CL parts), its SPI_DMA bit set
+@param[in]	tx			Words to send, 0 sends zeros (read only)
+@param[out]	rx			Buffer for received words, 0 discards them (write only), may be the same as tx
+@param[in]	n			Number of words (1..65535)
+@param[in]	cs			Chip select function, called from the interrupt with nss = 1 when done, 0 to keep the device selected
+@param[in]	cb			Completion callback, called from the interrupt after cs, 0 if not needed
+@param[in]	ctx			Passed to cb
+@return True if started, false otherwise (port busy, n is 0 or no DMA on this port).
+*/
+uint8_t spi_xfer16_async(uint8_t devnum, const uint16_t* tx, uint16_t* rx, uint16_t n, spi_cs_t cs, spi_cb_t cb, void* ctx)
+{
+	return spi_dma_start(devnum, tx, rx, n, 1, cs, cb, ctx);
+}
+
+/**
+@brief Is a transfer started by spi_xfer_async running?
+@param[in]	devnum		SPI peripheral number (1..2, 1..3 on HD, XL and CL parts)
+@return True if running, false otherwise.
+*/
+uint8_t spi_busy(uint8_t devnum)
+{
+	if( !((SPI_DMA >> (devnum-1)) & 1) ) { return 0; }
+	return spi_async[devnum-1].busy;
+}
+
+/** @privatesection */
+
+void spi_rxdma_tc(uint8_t devnum)
+{
+	const struct SPI_DevDef* pdef = spi_get_pdef(devnum);
+	struct spi_async_t* sa = &spi_async[devnum-1];
+
+	pdef->dma->IFCR = pdef->rxdma_if;
+	pdef->spi->CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+	pdef->rxdma->CCR = 0;
+	pdef->txdma->CCR = 0;
+
+	spi_cs_t cs = sa->cs;
+	spi_cb_t cb = sa->cb;
+	void* ctx = sa->ctx;
+
+	if( cs ) {
+		while( pdef->spi->SR & SPI_I2S_FLAG_BSY );	// last clock edge
+		cs(devnum, 1);
+	}
+	sa->busy = 0;	// cb may start the next transfer
+	if( cb ) { cb(devnum, ctx); }
+}
+
+#if SPI_DMA & 1
+void DMA1_Channel2_IRQHandler(void)
+{
+	spi_rxdma_tc(1);
+}
+#endif
+
+#if SPI_DMA & 2
+void DMA1_Channel4_IRQHandler(void)
+{
+	spi_rxdma_tc(2);
+}
+#endif
+
+#if SPI_DMA & 4
+void DMA2_Channel1_IRQHandler(void)
+{
+	spi_rxdma_tc(3);
+}
+#endif
+
+/**
+@brief Arm the slave DMA channels on the current half for the next frame.
+
+The SPI is reset first. A frame shorter than the half leaves the next TX frame preloaded in DR,
+which would go out first in the next frame, and only a reset empties it. It also clears an overrun
+by a frame longer than the half.
+*/
+void spi_slave_arm(uint8_t devnum)
+{
+	const struct SPI_DevDef* pdef = spi_get_pdef(devnum);
+	struct spi_async_t* sa = &spi_async[devnum-1];
+
+	pdef->rxdma->CCR = 0;
+	pdef->txdma->CCR = 0;
+
+	if( pdef->spi_apb == 1 ) {
+		RCC_APB1PeriphResetCmd(pdef->spi_clk, ENABLE);
+		RCC_APB1PeriphResetCmd(pdef->spi_clk, DISABLE);
+	} else {
+		RCC_APB2PeriphResetCmd(pdef->spi_clk, ENABLE);
+		RCC_APB2PeriphResetCmd(pdef->spi_clk, DISABLE);
+	}
+	pdef->spi->CR1 = sa->cr1;
+
+	uint8_t wide = (sa->cr1 & SPI_DataSize_16b) != 0;
+	uint32_t size = wide ? (DMA_CCR1_PSIZE_0 | DMA_CCR1_MSIZE_0) : 0;
+	uint32_t ofs = sa->half ? ((uint32_t)sa->n << wide) : 0;
+
+	pdef->rxdma->CMAR = (uint32_t)(sa->rxb + ofs);
+	pdef->rxdma->CNDTR = sa->n;
+	pdef->dma->IFCR = pdef->rxdma_if;
+	pdef->rxdma->CCR = size | DMA_CCR1_MINC | DMA_CCR1_PL_1 | DMA_CCR1_EN;
+
+	pdef->txdma->CMAR = (uint32_t)(sa->txb + ofs);
+	pdef->txdma->CNDTR = sa->n;
+	pdef->dma->IFCR = pdef->txdma_if;
+	pdef->txdma->CCR = size | DMA_CCR1_MINC | DMA_CCR1_DIR | DMA_CCR1_EN;
+
+	// TX DMA preloads DR with the first frame
+	pdef->spi->CR2 = SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN;
+	pdef->spi->CR1 |= SPI_CR1_SPE;
+}
+
+/** @publicsection */
+
+/**
+@brief Init SPI interface as slave with hardware NSS and ping-pong DMA.
+
+Call instead of spi_init. Both buffers hold two halves of n bytes (words with SPI_16BIT), the first
+frame uses half 0 and each following one the other half. The EXTI handler of the NSS line must call
+spi_slave_nss_irq, which calls cb after each frame with the half it used. The next frame already runs
+on the other half then, so cb processes the received half and refills the sent one, which goes out
+two frames later. Between frames, NSS must stay high for the time of that interrupt.
+
+The NSS line is set up with misc_exti_setup (so misc.c must be linked), which enables its EXTI
+channel at the lowest NVIC priority. The line may be shared, so its priority is left to the caller:
+if other interrupts can delay the re-arm past the NSS high time, raise it with NVIC_Init after this.
+@param[in]	devnum		SPI peripheral number (1..2, 1..3 on HD, XL and CL parts), its SPI_DMA bit set
+@param[in]	mode		SPI mode (0..3) | SPI_LSB_FIRST | SPI_16BIT | SPI_REMAP
+@param[in]	txb			Caller allocated buffer of 2*n frames to send
+@param[in]	rxb			Caller allocated buffer of 2*n frames for received data
+@param[in]	n			Maximum frame length in bytes or words (1..65535)
+@param[in]	cb			Called from the NSS interrupt with the half (0 or 1) and length of each frame
+@param[in]	ctx			Passed to cb
+@return True if started, false otherwise (no DMA on this port, port busy, n is 0 or cb not set).
+*/
+uint8_t spi_slave_init(uint8_t devnum, uint8_t mode, void* txb, void* rxb, uint16_t n, spi_slave_cb_t cb, void* ctx)
+{
+	if( !((SPI_DMA >> (devnum-1)) & 1) || (n == 0) || !cb ) { return 0; }
+
+	const struct SPI_DevDef* pdef = spi_get_pdef(devnum);
+	struct spi_async_t* sa = &spi_async[devnum-1];
+
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+	if( sa->busy ) {
+		__set_PRIMASK(g);
+		return 0;
+	}
+	sa->busy = 1;	// keeps spi_xfer_async off the channels
+	sa->scb = cb;
+	sa->ctx = ctx;
+	__set_PRIMASK(g);
+
+	// clock config
+	if( pdef->spi_apb == 1 ) {
+		RCC_APB1PeriphClockCmd(pdef->spi_clk, ENABLE);
+	} else {
+		RCC_APB2PeriphClockCmd(pdef->spi_clk, ENABLE);
+	}
+	RCC_AHBPeriphClockCmd(pdef->dma_clk, ENABLE);
+
+	// GPIO config, all inputs but MISO
+	spi_pins_init(devnum, mode & SPI_REMAP, 0);
+	const struct SPI_Pins* pins = spi_pins[devnum-1];
+
+	// SPI config, slave, hardware NSS
+	sa->cr1 = (mode & 3) | ((mode & SPI_LSB_FIRST) ? SPI_FirstBit_LSB : SPI_FirstBit_MSB) |
+		((mode & SPI_16BIT) ? SPI_DataSize_16b : SPI_DataSize_8b);
+	sa->txb = txb;
+	sa->rxb = rxb;
+	sa->n = n;
+	sa->half = 0;
+
+	// DMA config, one half per frame, no DMA interrupts
+	pdef->rxdma->CPAR = (uint32_t)&pdef->spi->DR;
+	pdef->txdma->CPAR = (uint32_t)&pdef->spi->DR;
+	spi_slave_arm(devnum);
+
+	// NSS rising edge ends a frame
+	EXTI_ClearITPendingBit(pins->pin_nss);
+	misc_exti_setup(pins->gpio_nss, pins->pin_nss, EXTI_Trigger_Rising);
+
+	return 1;
+}
+
+/**
+@brief End of a slave mode frame, call from the EXTI handler of the NSS line.
+
+Does nothing if the port is not in slave mode, or if no frame was clocked since the last call.
+@param[in]	devnum		SPI peripheral number (1..2, 1..3 on HD, XL and CL parts)
+*/
+void spi_slave_nss_irq(uint8_t devnum)
+{
+	if( !((SPI_DMA >> (devnum-1)) & 1) ) { return; }
+
+	const struct SPI_DevDef* pdef = spi_get_pdef(devnum);
+	struct spi_async_t* sa = &spi_async[devnum-1];
+
+	EXTI_ClearITPendingBit(spi_pins[devnum-1]->pin_nss);
+	if( !sa->scb ) { return; }
+
+	uint16_t len = sa->n - pdef->rxdma->CNDTR;
+	if( len == 0 ) { return; }	// NSS pulse without clocks, the TX frame preloaded in DR is still the first
+
+	uint8_t half = sa->half;
+	sa->half = half ^ 1;
+	spi_slave_arm(devnum);
+
+	sa->scb(devnum, half, len, sa->ctx);
+}
+
+/**
+@brief Stop slave mode started by spi_slave_init.
+@param[in]	devnum		SPI peripheral number (1..2, 1..3 on HD, XL and CL parts)
+*/
+void spi_slave_stop(uint8_t devnum)
+{
+	if( !((SPI_DMA >> (devnum-1)) & 1) ) { return; }
+
+	const struct SPI_DevDef* pdef = spi_get_pdef(devnum);
+	struct spi_async_t* sa = &spi_async[devnum-1];
+
+	if( !sa->scb ) { return; }
+
+	uint16_t pin = spi_pins[devnum-1]->pin_nss;
+	EXTI->IMR &= ~pin;
+	EXTI->RTSR &= ~pin;
+	EXTI_ClearITPendingBit(pin);
+
+	pdef->spi->CR1 &= ~SPI_CR1_SPE;
+	pdef->spi->CR2 = 0;
+	pdef->rxdma->CCR = 0;
+	pdef->txdma->CCR = 0;
+	pdef->dma->IFCR = pdef->rxdma_if | pdef->txdma_if;
+
+	sa->scb = 0;
+	sa->busy = 0;
+}
+#endif
@@ -3,13 +3,36 @@
 
 #include <inttypes.h>
 
+#define SPI_LSB_FIRST 4	/**< mode flag, least significant bit first */
+#define SPI_16BIT 8	/**< mode flag, 16 bit frames */
+#define SPI_REMAP 0x10	/**< mode flag, remapped pins (spi_init and spi_slave_init only) */
+
+/** Chip select function, same as spi_cs */
+typedef void (*spi_cs_t)(uint8_t devnum, uint8_t nss);
+/** Transfer completion callback */
+typedef void (*spi_cb_t)(uint8_t devnum, void* ctx);
+/** Slave mode frame callback, a frame of len bytes or words in half (0 or 1) of the buffers is done */
+typedef void (*spi_slave_cb_t)(uint8_t devnum, uint8_t half, uint16_t len, void* ctx);
+
 void spi_init(uint8_t devnum, const uint16_t brps, const uint8_t mode);
 void spi_putc(uint8_t devnum, uint8_t* d);
 void spi_puts(uint8_t devnum, char* s);
 void spi_putsn(uint8_t devnum, char* s, uint16_t n);
+void spi_reconf(uint8_t devnum, uint16_t brps, uint8_t mode);
+
+#ifdef SPI_DMA
+uint8_t spi_xfer_async(uint8_t devnum, const uint8_t* tx, uint8_t* rx, uint16_t n, spi_cs_t cs, spi_cb_t cb, void* ctx);
+uint8_t spi_xfer16_async(uint8_t devnum, const uint16_t* tx, uint16_t* rx, uint16_t n, spi_cs_t cs, spi_cb_t cb, void* ctx);
+uint8_t spi_busy(uint8_t devnum);
+uint8_t spi_slave_init(uint8_t devnum, uint8_t mode, void* txb, void* rxb, uint16_t n, spi_slave_cb_t cb, void* ctx);
+void spi_slave_nss_irq(uint8_t devnum);
+void spi_slave_stop(uint8_t devnum);
+#endif
 
 // low level routines
 void spi_cs(uint8_t devnum, uint8_t nss);
 uint8_t spi_rw(uint8_t devnum, const uint8_t d);
+uint16_t spi_xfer(uint8_t devnum, const uint8_t* tx, uint8_t* rx, uint16_t n);
+uint16_t spi_xfer16(uint8_t devnum, const uint16_t* tx, uint16_t* rx, uint16_t n);
 
 #endif
@@ -0,0 +1,266 @@
+/**
+
+Several devices on one SPI peripheral, each with its own chip select pin, prescaler, mode, bit order
+and frame size (struct spib_dev_t). Clients queue transactions (struct spib_xact_t, caller allocated,
+no malloc) from any context; they are run in order. CR1 is only rewritten when a transaction is for
+a different device than the previous one, so consecutive transfers to one device cost nothing extra.
+
+A transaction selects the device, sends up to SPIB_CMD_LEN command bytes (instruction, address),
+transfers n data frames and deselects the device. On ports built with SPI_DMA the data phase
+runs on DMA and the next transaction is started from the DMA interrupt, including its command phase;
+otherwise transactions run in spib_run, which spib_submit calls. A queued transaction is run by the
+spib_run call that finds the bus free; when it finds it busy it returns at once, the running one
+takes it over.
+
+Existing drivers that control chip select themselves (fls_25.c, ee_95.c) can share the bus too: take
+it with spib_lock, which configures it for their device, implement their chip select hook with spib_cs
+and release it with spib_unlock.
+
+@file		spibus.c
+@brief		Shared SPI bus with per device settings and transaction queue
+@author		Matej Kogovsek
+@copyright	LGPL 2.1
+@note		This file is part of mat-stm32f1-lib
+*/
+
+#include <inttypes.h>
+
+#include "stm32f10x.h"
+#include "spi.h"
+#include "spibus.h"
+
+/** @privatesection */
+
+/**
+@brief Configure the bus for a device, unless it already is.
+*/
+static void spib_select(struct spib_t* b, struct spib_dev_t* d)
+{
+	if( b->cur != d ) {
+		spi_reconf(b->devnum, d->brps, d->mode);
+		b->cur = d;
+	}
+}
+
+/**
+@brief Select the device and send the command phase.
+*/
+static void spib_start(struct spib_t* b, struct spib_xact_t* x)
+{
+	spib_select(b, x->dev);
+	spib_cs(x->dev, 0);
+
+	if( x->cmdn ) {
+		if( x->dev->mode & SPI_16BIT ) {	// byte pairs, MSB first
+			uint16_t w[SPIB_CMD_LEN / 2];
+			uint8_t i;
+			for( i = 0; i < x->cmdn / 2; ++i ) {
+				w[i] = (x->cmd[2*i] << 8) | x->cmd[2*i+1];
+			}
+			spi_xfer16(b->devnum, w, 0, x->cmdn / 2);
+		} else {
+			spi_xfer(b->devnum, x->cmd, 0, x->cmdn);
+		}
+	}
+}
+
+/**
+@brief Deselect the device, remove the transaction from the queue and notify its owner.
+*/
+static void spib_finish(struct spib_t* b, struct spib_xact_t* x)
+{
+	spib_cs(x->dev, 1);
+
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+	b->head = x->next;
+	if( b->head == 0 ) { b->tail = 0; }
+	__set_PRIMASK(g);
+
+	x->done = 1;
+	if( x->cb ) { x->cb(x); }
+}
+
+#ifdef SPI_DMA
+/**
+@brief spi_xfer_async completion, finish the transaction and run the next one.
+*/
+static void spib_dma_done(uint8_t devnum, void* ctx)
+{
+	struct spib_t* b = ctx;
+
+	spib_finish(b, b->head);
+	b->busy = 0;
+	spib_run(b);
+}
+#endif
+
+/** @publicsection */
+
+/**
+@brief Init SPI peripheral as a shared bus.
+@param[in]	b			Pointer to spib_t struct where state will be kept
+@param[in]	devnum		SPI peripheral number (1..2, 1..3 on HD, XL and CL parts)
+@param[in]	remap		bool, use remapped pins
+*/
+void spib_init(struct spib_t* b, const uint8_t devnum, const uint8_t remap)
+{
+	b->devnum = devnum;
+	b->cur = 0;
+	b->head = 0;
+	b->tail = 0;
+	b->busy = 0;
+	b->locked = 0;
+
+	spi_init(devnum, SPI_BaudRatePrescaler_256, remap ? SPI_REMAP : 0);
+}
+
+/**
+@brief Init device descriptor and its chip select pin (output, deselected).
+@param[in]	d			Pointer to spib_dev_t struct
+@param[in]	gpio		Chip select port (i.e. GPIOA)
+@param[in]	pin			Chip select pin (i.e. GPIO_Pin_4)
+@param[in]	brps		Baudrate prescaler, F_CPU dependent
+@param[in]	mode		SPI mode (0..3) | SPI_LSB_FIRST | SPI_16BIT
+*/
+void spib_dev_init(struct spib_dev_t* d, GPIO_TypeDef* gpio, const uint16_t pin, const uint16_t brps, const uint8_t mode)
+{
+	d->gpio = gpio;
+	d->pin = pin;
+	d->brps = brps;
+	d->mode = mode;
+
+	RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOA << (((uint32_t)gpio - (uint32_t)GPIOA) / 0x400), ENABLE);
+	spib_cs(d, 1);
+
+	GPIO_InitTypeDef iotd;
+	iotd.GPIO_Pin = pin;
+	iotd.GPIO_Speed = GPIO_Speed_10MHz;
+	iotd.GPIO_Mode = GPIO_Mode_Out_PP;
+	GPIO_Init(gpio, &iotd);
+}
+
+/**
+@brief Queue a transaction and run the queue, if the bus is free.
+
+The transaction struct and its buffers must stay valid until done is set or cb is called.
+Command bytes go to 16 bit devices in pairs, so cmdn must be even for them.
+@param[in]	b			Pointer to spib_t
+@param[in]	x			Transaction, dev, cmd, cmdn, tx, rx, n, cb and ctx filled in
+@return True if queued, false otherwise (cmdn over SPIB_CMD_LEN, or odd on a SPI_16BIT device).
+*/
+uint8_t spib_submit(struct spib_t* b, struct spib_xact_t* x)
+{
+	if( (x->cmdn > SPIB_CMD_LEN) || ((x->dev->mode & SPI_16BIT) && (x->cmdn & 1)) ) { return 0; }
+
+	x->done = 0;
+	x->next = 0;
+
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+	if( b->tail ) {
+		b->tail->next = x;
+	} else {
+		b->head = x;
+	}
+	b->tail = x;
+	__set_PRIMASK(g);
+
+	spib_run(b);
+	return 1;
+}
+
+/**
+@brief Run queued transactions, unless the bus is busy or locked.
+
+Returns when the queue is empty, or when a DMA transfer has been started, which continues
+the queue from its interrupt.
+@param[in]	b			Pointer to spib_t
+*/
+void spib_run(struct spib_t* b)
+{
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+	if( b->busy || b->locked ) {
+		__set_PRIMASK(g);
+		return;
+	}
+	b->busy = 1;
+	__set_PRIMASK(g);
+
+	while( 1 ) {
+		g = __get_PRIMASK();
+		__disable_irq();
+		struct spib_xact_t* x = b->head;
+		if( x == 0 ) {	// checked together with clearing busy, so a submit can not slip between
+			b->busy = 0;
+			__set_PRIMASK(g);
+			return;
+		}
+		__set_PRIMASK(g);
+
+		spib_start(b, x);
+
+		uint8_t wide = x->dev->mode & SPI_16BIT;
+#ifdef SPI_DMA
+		if( wide ? spi_xfer16_async(b->devnum, x->tx, x->rx, x->n, 0, spib_dma_done, b) :
+			spi_xfer_async(b->devnum, x->tx, x->rx, x->n, 0, spib_dma_done, b) ) {
+			return;	// busy stays set, spib_dma_done continues
+		}
+#endif
+		if( wide ) {
+			spi_xfer16(b->devnum, x->tx, x->rx, x->n);
+		} else {
+			spi_xfer(b->devnum, x->tx, x->rx, x->n);
+		}
+
+		spib_finish(b, x);
+	}
+}
+
+/**
+@brief Take the bus for direct use (spi_rw, spi_xfer, existing device drivers).
+
+Fails if a transaction is running. Queued transactions wait until spib_unlock.
+@param[in]	b			Pointer to spib_t
+@param[in]	d			Device the bus is configured for
+@return True if taken, false otherwise.
+*/
+uint8_t spib_lock(struct spib_t* b, struct spib_dev_t* d)
+{
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+	if( b->busy || b->locked ) {
+		__set_PRIMASK(g);
+		return 0;
+	}
+	b->locked = 1;
+	__set_PRIMASK(g);
+
+	spib_select(b, d);
+	return 1;
+}
+
+/**
+@brief Release the bus taken by spib_lock and run queued transactions.
+@param[in]	b			Pointer to spib_t
+*/
+void spib_unlock(struct spib_t* b)
+{
+	b->locked = 0;
+	spib_run(b);
+}
+
+/**
+@brief Device chip select control.
+@param[in]	d			Pointer to spib_dev_t
+@param[in]	nss			bool, true = deselect, false = select
+*/
+void spib_cs(struct spib_dev_t* d, uint8_t nss)
+{
+	if( nss ) {
+		d->gpio->BSRR = d->pin;
+	} else {
+		d->gpio->BRR = d->pin;
+	}
+}
@@ -0,0 +1,58 @@
+#ifndef MAT_SPIBUS_H
+#define MAT_SPIBUS_H
+
+#include <inttypes.h>
+#include "stm32f10x.h"
+#include "spi.h"
+
+#define SPIB_CMD_LEN 6	/**< max command phase length */
+
+/** Device on a shared SPI bus */
+struct spib_dev_t
+{
+	GPIO_TypeDef* gpio;	/**< chip select port */
+	uint16_t pin;	/**< chip select pin */
+	uint16_t brps;	/**< baudrate prescaler */
+	uint8_t mode;	/**< SPI mode (0..3) | SPI_LSB_FIRST | SPI_16BIT */
+};
+
+struct spib_xact_t;
+
+/** Transaction completion callback */
+typedef void (*spib_cb_t)(struct spib_xact_t* x);
+
+/** Transaction: chip select, command phase, data phase, chip deselect */
+struct spib_xact_t
+{
+	struct spib_dev_t* dev;	/**< device */
+	uint8_t cmd[SPIB_CMD_LEN];	/**< command bytes sent before the data, as big endian words to 16 bit devices (cmdn even) */
+	uint8_t cmdn;	/**< number of command bytes */
+	const void* tx;	/**< data to send, 0 sends zeros */
+	void* rx;	/**< buffer for received data, 0 discards it */
+	uint16_t n;	/**< number of data frames (bytes, or words with SPI_16BIT) */
+	spib_cb_t cb;	/**< called on completion, 0 if not needed */
+	void* ctx;	/**< for use by cb */
+	volatile uint8_t done;	/**< set on completion */
+	struct spib_xact_t* next;	/**< queue link */
+};
+
+/** Shared SPI bus state struct */
+struct spib_t
+{
+	uint8_t devnum;	/**< SPI peripheral number */
+	struct spib_dev_t* cur;	/**< device CR1 is configured for, 0 if none */
+	struct spib_xact_t* head;	/**< first queued transaction, the running one */
+	struct spib_xact_t* tail;	/**< last queued transaction */
+	volatile uint8_t busy;	/**< transaction running */
+	volatile uint8_t locked;	/**< bus taken by spib_lock */
+};
+
+void spib_init(struct spib_t* b, const uint8_t devnum, const uint8_t remap);
+void spib_dev_init(struct spib_dev_t* d, GPIO_TypeDef* gpio, const uint16_t pin, const uint16_t brps, const uint8_t mode);
+uint8_t spib_submit(struct spib_t* b, struct spib_xact_t* x);
+void spib_run(struct spib_t* b);
+uint8_t spib_lock(struct spib_t* b, struct spib_dev_t* d);
+void spib_unlock(struct spib_t* b);
+void spib_cs(struct spib_dev_t* d, uint8_t nss);
+
+#endif
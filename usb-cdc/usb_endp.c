@@ -6,6 +6,7 @@
 #include "mat/serialq.h"
 #include "mat/circbuf8.h"
 #include "mat/itoa.h"
+#include "mat/fmt.h"
 
 #include <string.h>
 
@@ -26,11 +27,16 @@ void cdc_init(uint8_t* txb, uint16_t txs, uint8_t* rxb, uint16_t rxs)
 	cbuf8_clear(&cdc_rxq, rxb, rxs);
 }
 
+// cdc_txq is consumed here and in EP1_IN_Callback, interrupts are masked so that it stays
+// single consumer (also with CBUF8_SPSC). The flag is only set if a transfer was started.
 void cdc_tx(void)
 {
-  if( ep1_in_transferring ) return;
-	ep1_in_transferring = 1;
-	EP1_IN_PrepareTX();
+	uint32_t g = __get_PRIMASK();
+	__disable_irq();
+	if( !ep1_in_transferring ) {
+		ep1_in_transferring = EP1_IN_PrepareTX();
+	}
+	__set_PRIMASK(g);
 }
 
 void cdc_putc_(const char a)
@@ -50,47 +56,62 @@ void cdc_putc(const char a)
 	cdc_tx();
 }
 
-void cdc_putsn(const char* s, uint8_t n)
+void cdc_putbuf_(const char* s, uint16_t n)
 {
-	while( n-- ) {
-		cdc_putc_(*s);
-		++s;
+	while( n ) {
+		uint16_t w = cbuf8_write(&cdc_txq, (const uint8_t*)s, n);
+		s += w;
+		n -= w;
+		if( n ) {
+			cdc_tx();
+		}
 	}
+}
+
+void cdc_putsn(const char* s, uint8_t n)
+{
+	cdc_putbuf_(s, n);
 	cdc_tx();
 }
 
 void cdc_puts(const char* s)
 {
-	while( *s )	{
-		cdc_putc_(*s);
-		++s;
-	}
+	cdc_putbuf_(s, strlen(s));
 	cdc_tx();
 }
 
 void cdc_puti_lc(const int32_t a, const uint8_t r, uint8_t w, char c)
 {
-	char s[16];
+	char s[34];
 
-	itoa(a, s, r);
+	uint8_t n = i32toa(a, s, r);
 
-	while( w-- > strlen(s) ) { cdc_putc_(c); }
+	while( w-- > n ) { cdc_putc_(c); }
 
-	cdc_puts(s);
+	cdc_putbuf_(s, n);
+	cdc_tx();
 }
 
 void cdc_putf(float f, uint8_t prec)
 {
-	if( f < 0 ) {
-		f = -f;
-		cdc_putc('-');
-	}
-	cdc_puti_lc(f, 10, 0, 0);
-	cdc_putc('.');
-	f = f - (int)f;
-	uint8_t i = prec;
-	while( i-- ) f *= 10;
-	cdc_puti_lc(f, 10, prec, '0');
+	char s[FTOA_LEN];
+	cdc_putbuf_(s, ftoa(f, s, prec));
+	cdc_tx();
+}
+
+static void cdc_sink(void* ctx, const char* s, uint16_t n)
+{
+	cdc_putbuf_(s, n);
+}
+
+int cdc_printf(const char* f, ...)
+{
+	va_list vl;
+	va_start(vl, f);
+	int r = fmt_vprintf(cdc_sink, 0, f, vl);
+	va_end(vl);
+	cdc_tx();
+	return r;
 }
 
 uint8_t cdc_getc(uint8_t* const d)
@@ -99,6 +120,14 @@ uint8_t cdc_getc(uint8_t* const d)
 	return r;
 }
 
+#ifdef CBUF8_STATS
+void cdc_stats(struct cbuf8_stats_t* rx, struct cbuf8_stats_t* tx, const uint8_t clr)
+{
+	if( rx ) { cbuf8_stats(&cdc_rxq, rx, clr); }
+	if( tx ) { cbuf8_stats(&cdc_txq, tx, clr); }
+}
+#endif
+
 // ----------------------------------------------------------------------------
 // USB endpoint callbacks
 // ----------------------------------------------------------------------------
@@ -107,16 +136,15 @@ uint8_t EP1_IN_PrepareTX(void)
 {
 	if( GetEPTxStatus(ENDP1) == EP_TX_VALID ) return 0;
 
-	uint8_t len = 0;
-	uint8_t dh,dl;
+	uint8_t d[VCP_DATA_SIZE+1];
 	uint32_t* pma = (uint32_t*)(PMAAddr + (2 * ENDP1_TXADDR));
 
-	while( cbuf8_get(&cdc_txq, &dl) ) {
-		++len;
-		dh = 0;
-		if( cbuf8_get(&cdc_txq, &dh) ) ++len;
-		*pma++ = dh * 0x100 + dl;
-		if( len >= VCP_DATA_SIZE ) break;
+	uint8_t len = cbuf8_read(&cdc_txq, d, VCP_DATA_SIZE);
+	d[len] = 0;
+
+	uint8_t i;
+	for( i = 0; i < len; i += 2 ) {
+		*pma++ = d[i+1] * 0x100 + d[i];
 	}
 
 	if( len ) {
@@ -136,19 +164,18 @@ void EP1_IN_Callback(void)
 void EP3_OUT_Callback(void)
 {
 	uint8_t len = GetEPRxCount(ENDP3);
-	uint16_t d;
+	uint8_t d[VCP_DATA_SIZE+1];
 	uint32_t* pma = (uint32_t*)(PMAAddr + (2 * ENDP3_RXADDR));
 
-	while( len ) {
-		d = *pma++;
-		cbuf8_put(&cdc_rxq, d);
-		len--;
-		if( len ) {
-			cbuf8_put(&cdc_rxq, d >> 8);
-			len--;
-		}
+	uint8_t i;
+	for( i = 0; i < len; i += 2 ) {
+		uint16_t w = *pma++;
+		d[i] = w;
+		d[i+1] = w >> 8;
 	}
 
+	cbuf8_write(&cdc_rxq, d, len);
+
 	// flag EP as ready for next reception
 	SetEPRxValid(ENDP3);
 }
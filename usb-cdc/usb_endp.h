@@ -2,6 +2,7 @@
 #define USB_ENDP_H
 
 #include <inttypes.h>
+#include "mat/circbuf8.h"
 
 void cdc_init(uint8_t* txb, uint16_t txs, uint8_t* rxb, uint16_t rxs);
 
@@ -12,7 +13,12 @@ void cdc_puti_lc(const int32_t a, const uint8_t r, uint8_t w, char c);
 void cdc_putf(float f, uint8_t prec);
 #define cdc_puti(a, b) cdc_puti_lc(a, b, 0, 'x')
 #define cdc_puti_lz(a, b, c) cdc_puti_lc(a, b, c, '0')
+int cdc_printf(const char* f, ...);
 
 uint8_t cdc_getc(uint8_t* const d);
 
+#ifdef CBUF8_STATS
+void cdc_stats(struct cbuf8_stats_t* rx, struct cbuf8_stats_t* tx, const uint8_t clr);
+#endif
+
 #endif